@@ -19,6 +19,7 @@
 #define PRS_H
 
 #include <lib-mesg.h>
+#include <lib-prg.h>
 #include <assert.h>
 #include <gmp.h>
 #include <stdio.h>
@@ -61,7 +62,7 @@ void prs_plaintext_clear(prs_plaintext_t plaintext);
 void prs_ciphertext_init(prs_ciphertext_t ciphertext);
 void prs_ciphertext_clear(prs_ciphertext_t ciphertext);
 
-void prs_encrypt(prs_ciphertext_t ciphertext, unsigned int k, mpz_t y, mpz_t n, mpz_t k_2, prs_plaintext_t plaintext, gmp_randstate_t prng, unsigned int base_size);
+void prs_encrypt(prs_ciphertext_t ciphertext, unsigned int k, mpz_t y, mpz_t n, mpz_t k_2, prs_plaintext_t plaintext, prg_stream_t rng, unsigned int base_size);
 
 void prs_decrypt(prs_plaintext_t plaintext, mpz_t p, unsigned int k, mpz_t *d, prs_ciphertext_t ciphertext);
 #endif //PRS_H
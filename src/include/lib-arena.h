@@ -0,0 +1,80 @@
+/*
+ * Bump allocator for the temporaries of the scheme, also serving GMP.
+ *
+ * An arena hands out memory from a few large chunks and takes it all back at
+ * once when rewound to a mark, so a loop that allocates the same temporaries
+ * over and over stops touching the heap once its chunks are large enough.
+ *
+ * arena_gmp_install routes the GMP allocation functions through the arena the
+ * calling thread has entered with arena_scope: limbs allocated inside the
+ * scope come from the arena and are dropped when the scope ends, everything
+ * else keeps using the heap. Memory of an arena never leaves the scope that
+ * allocated it, so values that must outlive it (a record handed to another
+ * thread, a global growing for the first time) are written inside arena_heap,
+ * which gives them heap limbs again. Freeing or growing heap limbs inside a
+ * scope goes to the heap as well. Scopes nest, but the limbs of an outer
+ * arena must not be freed or grown inside the scope of a different one.
+ */
+
+#ifndef LIB_ARENA_H
+#define LIB_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* size of the first chunk of an arena, later ones double */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+struct arena_chunk_struct {
+    struct arena_chunk_struct *next;
+    size_t size, used;
+    char *data;
+};
+
+struct arena_struct {
+    struct arena_chunk_struct *chunks, *current; /* current is the one being filled */
+    size_t chunk_size;
+    size_t num_chunks;
+    void *last; /* latest allocation, grown or given back in place */
+    int heap; /* arena_heap nesting, the arena is bypassed while > 0 */
+};
+typedef struct arena_struct arena_t[1];
+
+/* point an arena can be rewound to */
+typedef struct {
+    struct arena_chunk_struct *chunk;
+    size_t used;
+    struct arena_struct *outer; /* arena active before arena_enter */
+} arena_mark_t;
+
+/* the code is variadic so that commas outside parentheses, as in
+ * declarations and initializers, do not split it */
+#define arena_scope(ARENA, ...)                                                \
+    {                                                                          \
+        arena_mark_t arena_mark_ = arena_enter(ARENA);                         \
+        {__VA_ARGS__};                                                         \
+        arena_leave(ARENA, arena_mark_);                                       \
+    }
+
+#define arena_heap(...)                                                        \
+    {                                                                          \
+        arena_heap_begin();                                                    \
+        {__VA_ARGS__};                                                         \
+        arena_heap_end();                                                      \
+    }
+
+void arena_init(arena_t arena, size_t chunk_size);
+void arena_clear(arena_t arena);
+void *arena_alloc(arena_t arena, size_t size);
+bool arena_owns(const arena_t arena, const void *ptr);
+arena_mark_t arena_mark(const arena_t arena);
+void arena_rewind(arena_t arena, arena_mark_t mark);
+
+struct arena_struct *arena_local(void);
+arena_mark_t arena_enter(arena_t arena);
+void arena_leave(arena_t arena, arena_mark_t mark);
+void arena_heap_begin(void);
+void arena_heap_end(void);
+void arena_gmp_install(void);
+
+#endif /* LIB_ARENA_H */
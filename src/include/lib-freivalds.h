@@ -0,0 +1,40 @@
+/*
+ * Freivalds-style verification keys for the quantized linear layers.
+ *
+ * A key holds a secret random vector r over the prime field GF(2^61 - 1)
+ * together with r^T W and r^T b, both precomputed once per layer. Checking
+ * an image then costs O(rows + cols) instead of a full matrix-vector product.
+ */
+
+#ifndef LIB_FREIVALDS_H
+#define LIB_FREIVALDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* scale factors used by the drivers to quantize weights, inputs and biases */
+#define LINEAR_WEIGHT_SCALE 100
+#define LINEAR_INPUT_SCALE 100
+#define LINEAR_BIAS_SCALE 10000
+
+/* Mersenne prime 2^61 - 1: the product of two reduced elements fits in 128
+ * bits and reduction needs only shifts and adds */
+#define FREIVALDS_P ((UINT64_C(1) << 61) - 1)
+
+struct linear_veri_key_struct {
+    int rows;
+    int cols;
+    uint64_t *r;  /* secret challenge, one element per output row */
+    uint64_t *rw; /* r^T W mod p, one element per input column */
+    uint64_t rb;  /* r^T b mod p */
+};
+typedef struct linear_veri_key_struct linear_veri_key_t[1];
+
+void linear_veri_key_init(linear_veri_key_t key, int rows, int cols);
+void linear_veri_key_clear(linear_veri_key_t key);
+int linear_veri_key_generate(linear_veri_key_t key, const float *weight, const float *bias);
+bool linear_veri_key_check(const linear_veri_key_t key, const int *input, size_t input_stride,
+                           const int *output, size_t output_stride);
+
+#endif /* LIB_FREIVALDS_H */
@@ -0,0 +1,48 @@
+/*
+ * Reader of the IDX files the MNIST images are distributed in.
+ *
+ * An IDX file is a 4-byte magic (two zero bytes, the element type and the
+ * number of dimensions), one big-endian 32-bit size per dimension and the
+ * elements, row-major. Only unsigned-byte files are read. The file is mapped
+ * read-only and the items are used in place: idx_item is a view of an image,
+ * or of a batch of consecutive images, without any copy. idx_to_float turns
+ * pixels into the pipeline's fixed-point inputs when a batch is loaded.
+ */
+
+#ifndef LIB_IDX_H
+#define LIB_IDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* environment variable naming the images file to use instead of the default */
+#define IDX_IMAGES_ENV "VHSS_IMAGES"
+
+#define IDX_MAX_DIMS 4
+
+/* pixels are kept with 2 decimals, as in mnist_images.txt */
+#define IDX_PIXEL_SCALE 100
+
+struct idx_struct {
+    void *map;
+    size_t map_size;
+    const uint8_t *data; /* first element of the first item */
+    int dims;
+    int shape[IDX_MAX_DIMS];
+    int count;        /* items: the size of the first dimension */
+    size_t item_size; /* elements per item: the product of the other sizes */
+};
+typedef struct idx_struct idx_t[1];
+
+const char *idx_images_path(const char *fallback);
+int idx_open(idx_t idx, const char *filename);
+void idx_close(idx_t idx);
+
+void idx_to_float(const uint8_t *pixels, size_t n, int scale, float *out);
+
+/* item i, followed by the items after it */
+static inline const uint8_t *idx_item(const idx_t idx, size_t i) {
+    return idx->data + i * idx->item_size;
+}
+
+#endif /* LIB_IDX_H */
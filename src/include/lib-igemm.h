@@ -0,0 +1,62 @@
+/*
+ * INT8 GEMM for the quantized plaintext model.
+ *
+ * Weights are quantized symmetrically per output channel (one scale per row)
+ * and activations per tensor, both to [-127, 127]. Products are accumulated
+ * exactly in int32; the epilogue rescales the accumulators, adds the float
+ * bias, applies the optional ReLU and either requantizes the result to the
+ * int8 input of the next layer or writes it out as float.
+ */
+
+#ifndef LIB_IGEMM_H
+#define LIB_IGEMM_H
+
+#include <lib-thpool.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* environment variable restricting the microkernel to "avx2" or "generic",
+ * so that the slower kernels can be tested on a CPU with a faster one */
+#define IGEMM_KERNEL_ENV "VHSS_IGEMM_KERNEL"
+
+/* images and output features computed together by the microkernel */
+#define IGEMM_MR 6
+#define IGEMM_NR 16
+
+/* int8 rows, weights and activations alike, are padded with zeros to a
+ * multiple of IGEMM_ALIGN columns */
+#define IGEMM_ALIGN 32
+
+struct imatrix_struct {
+    int rows;
+    int cols;
+    int ld;        /* cols rounded up to IGEMM_ALIGN */
+    int panels;    /* rows rounded up to IGEMM_NR, divided by IGEMM_NR */
+    int8_t *data;  /* panels x ld/4 x IGEMM_NR x 4 (four consecutive columns
+                      of a row together), 64-byte aligned, zero padded */
+    float *scale;  /* per row: weight = data * scale; padded like bias */
+    float *bias;   /* panels * IGEMM_NR entries, zero padded */
+    int32_t *sums; /* per row: sum of data, for the VNNI kernel */
+};
+typedef struct imatrix_struct imatrix_t[1];
+
+int imatrix_init(imatrix_t w, int rows, int cols);
+void imatrix_clear(imatrix_t w);
+void imatrix_quantize(imatrix_t w, const float *weight, const float *bias);
+void imatrix_load(imatrix_t w, const int8_t *weight, const float *scale, const float *bias);
+
+static inline size_t igemm_ld(int cols) {
+    return ((size_t)cols + IGEMM_ALIGN - 1) / IGEMM_ALIGN * IGEMM_ALIGN;
+}
+
+float igemm_scale(const float *x, size_t x_stride, int cols, size_t n);
+void igemm_quantize(const float *x, size_t x_stride, int cols, float scale, int8_t *q, size_t q_stride,
+                    size_t n);
+
+void igemm_layer_s8(thpool_t pool, const imatrix_t w, bool relu, const int8_t *x, float x_scale,
+                    size_t x_stride, int8_t *y, float y_scale, size_t y_stride, size_t n);
+void igemm_layer_f32(thpool_t pool, const imatrix_t w, bool relu, const int8_t *x, float x_scale,
+                     size_t x_stride, float *y, size_t y_stride, size_t n);
+
+#endif /* LIB_IGEMM_H */
@@ -0,0 +1,70 @@
+/*
+ * Allocation counters and a steady-state leak detector.
+ *
+ * Heap allocations are counted by malloc wrappers, linked in with
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free and
+ * --wrap=posix_memalign, so only the calls made by the objects of the program
+ * are seen, not those inside libc or other shared libraries. GMP allocations are counted separately by
+ * memory functions chained in front of the ones already installed, the arena
+ * ones included, so they are seen whether their limbs come from the heap or
+ * from an arena.
+ *
+ * Counts and bytes are kept per thread, for the profiler phases; the bytes
+ * live on the heap are kept both per thread and for the whole process. A leak
+ * detector compares those of the calling thread around each unit of
+ * steady-state work, a neuron for the secure path, so that what other threads
+ * allocate and free meanwhile, such as the verifier threads, is not charged
+ * to the unit: once past its warm-up, memory that keeps growing over the
+ * units is flagged, and so are GMP values left uncleared, which an arena
+ * would otherwise hide. Memory a unit allocates and another thread frees
+ * counts as growth of the unit.
+ */
+
+#ifndef LIB_MEMSTAT_H
+#define LIB_MEMSTAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* environment variable turning the per-phase memory report on */
+#define MEMSTAT_ENV "VHSS_MEMSTAT"
+
+/* units run before growth is taken as a leak */
+#define LEAK_WARMUP 100
+/* growth over the steady state below this is taken as noise, in bytes */
+#define LEAK_TOLERANCE (64 * 1024)
+
+/* allocations made by a thread since it started */
+struct memstat_struct {
+    uint64_t allocs, frees, bytes;          /* heap */
+    int64_t heap_live; /* bytes allocated by the thread and not freed by it */
+    uint64_t gmp_allocs, gmp_frees, gmp_bytes;
+    int64_t gmp_live; /* bytes of GMP values not freed yet */
+};
+typedef struct memstat_struct memstat_t[1];
+
+struct leak_detector_struct {
+    uint64_t units, warmup;
+    int64_t heap_begin, gmp_begin; /* at the beginning of the current unit */
+    int64_t heap_growth, gmp_growth; /* over the steady state */
+    uint64_t growing_units; /* steady units that ended with more memory */
+};
+typedef struct leak_detector_struct leak_detector_t[1];
+
+bool memstat_enabled(void);
+void memstat_gmp_install(void);
+void memstat_thread(memstat_t stats);
+void memstat_pause(void);
+void memstat_resume(void);
+int64_t memstat_heap_live(void);
+long memstat_peak_rss(void);
+long memstat_rss(void);
+
+void leak_detector_init(leak_detector_t detector, uint64_t warmup);
+void leak_detector_begin(leak_detector_t detector);
+void leak_detector_end(leak_detector_t detector);
+bool leak_detector_leaking(const leak_detector_t detector);
+void leak_detector_report(FILE *stream, const char *unit, const leak_detector_t detector);
+
+#endif /* LIB_MEMSTAT_H */
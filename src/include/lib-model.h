@@ -0,0 +1,90 @@
+/*
+ * Parameters of a fully connected network, as exported by the training
+ * script.
+ *
+ * For every layer N the parameter file holds a "Shape of weight N:
+ * torch.Size([rows, cols])" header, a caption line and the rows x cols
+ * weights, then a "Shape of bia N: torch.Size([rows])" header, a caption line
+ * and the biases. The depth and the widths of the network are taken from
+ * these headers, so the drivers run any stack of layers without rebuilding.
+ *
+ * model_write stores a model in a binary container that model_read maps
+ * read-only, so the tensors are used in place and the page cache is shared
+ * by every process running the same model. The file starts with a
+ * model_file_header_struct, followed by one model_file_tensor_struct per
+ * tensor and by the tensor data at MODEL_FILE_ALIGN-byte aligned offsets,
+ * all little-endian. Tensors are row-major and named "weight.N" and
+ * "bias.N" (fp32), "weight.N.s16" (weights times its scale, rounded) and
+ * "weight.N.s8" with "weight.N.s8.scale" (per-row scales, weight = value *
+ * scale).
+ */
+
+#ifndef LIB_MODEL_H
+#define LIB_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* environment variable naming the model file to use instead of the default */
+#define MODEL_FILE_ENV "VHSS_MODEL"
+
+#define MODEL_FILE_MAGIC "VHSSMDL1"
+#define MODEL_FILE_ALIGN 64
+#define MODEL_NAME_MAX 32
+
+typedef enum { model_f32 = 0, model_s16 = 1, model_s8 = 2 } model_dtype_t;
+
+struct model_file_header_struct {
+    char magic[8]; /* MODEL_FILE_MAGIC */
+    uint32_t num_tensors;
+    uint32_t reserved;
+    uint64_t size; /* of the whole file */
+    uint8_t padding[40];
+};
+
+struct model_file_tensor_struct {
+    char name[MODEL_NAME_MAX]; /* NUL terminated */
+    uint32_t dtype;            /* model_dtype_t */
+    uint32_t rows;
+    uint32_t cols; /* 1 for vectors */
+    float scale;   /* integer tensors: units per 1.0, 0 when per row */
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct model_layer_struct {
+    int rows;            /* output features */
+    int cols;            /* input features: the output features of the previous layer */
+    const float *weight; /* rows x cols, row-major */
+    const float *bias;   /* rows */
+    /* pre-quantized weights, NULL when the model does not carry them */
+    const int16_t *weight_s16; /* rows x cols, weight * scale_s16 */
+    float scale_s16;
+    const int8_t *weight_s8; /* rows x cols, weight / scale_s8[row] */
+    const float *scale_s8;   /* rows */
+};
+
+struct model_struct {
+    int num_layers;
+    struct model_layer_struct *layers;
+    void *map; /* mapped binary file holding the tensors, NULL when they are owned */
+    size_t map_size;
+};
+typedef struct model_struct model_t[1];
+
+const char *model_default_path(const char *fallback);
+int model_read(model_t model, const char *filename);
+int model_write(const model_t model, const char *filename);
+void model_clear(model_t model);
+int model_max_width(const model_t model);
+
+/* features of the network input and output */
+static inline int model_inputs(const model_t model) {
+    return model->layers[0].cols;
+}
+
+static inline int model_outputs(const model_t model) {
+    return model->layers[model->num_layers - 1].rows;
+}
+
+#endif /* LIB_MODEL_H */
@@ -0,0 +1,72 @@
+/*
+ * Hardware event counters of the calling thread, or of the calling thread and
+ * the threads it starts afterwards, through Linux perf_event_open.
+ *
+ * A perf group opens cycles, instructions, last-level cache misses, branch
+ * misses and dTLB misses as one group, so that they are scheduled together
+ * and their ratios are meaningful. Any event the CPU, the kernel or its
+ * perf_event_paranoid setting does not allow is left out of the group and
+ * reported as not available; when none can be opened, or on other systems,
+ * every read gives zero counts marked as such and the callers go on without
+ * counters.
+ *
+ * An inherited group is copied into every thread created after it is opened,
+ * and a read sums the copies, so it counts the work a thread fans out to a
+ * pool started later. perf_counting brackets any code and adds the events it
+ * caused to a perf_values_t; the sampling macros of lib-timing count each
+ * sample by themselves once given a group with set_sampling_counters.
+ */
+
+#ifndef LIB_PERF_H
+#define LIB_PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* environment variable turning counters on where they are optional */
+#define PERF_COUNTERS_ENV "VHSS_PERF"
+
+typedef enum {
+    perf_cycles = 0,
+    perf_instructions,
+    perf_llc_misses,
+    perf_branch_misses,
+    perf_dtlb_misses,
+    PERF_COUNTERS
+} perf_counter_t;
+
+struct perf_group_struct {
+    int leader;             /* fd of the group leader, -1 when nothing could be opened */
+    int fd[PERF_COUNTERS];  /* -1 for the events not available */
+    uint64_t id[PERF_COUNTERS];
+    int num_open;
+};
+typedef struct perf_group_struct perf_group_t[1];
+
+struct perf_values_struct {
+    uint64_t count[PERF_COUNTERS];
+    bool available[PERF_COUNTERS];
+};
+typedef struct perf_values_struct perf_values_t[1];
+
+#define perf_counting(GROUP, VALUES, CODE)                                     \
+    {                                                                          \
+        perf_values_t perf_before, perf_after;                                 \
+        perf_group_read(GROUP, perf_before);                                   \
+        {CODE};                                                                \
+        perf_group_read(GROUP, perf_after);                                    \
+        perf_values_add_delta(VALUES, perf_before, perf_after);                \
+    }
+
+bool perf_enabled(void);
+int perf_group_open(perf_group_t group, bool inherit);
+void perf_group_close(perf_group_t group);
+void perf_group_read(const perf_group_t group, perf_values_t values);
+void perf_values_clear(perf_values_t values);
+void perf_values_add_delta(perf_values_t values, const perf_values_t before, const perf_values_t after);
+const char *perf_counter_name(perf_counter_t counter);
+void fprintf_perf(FILE *stream, const char *name, const perf_values_t values, double runs, const char *suffix);
+void fprintf_perf_json(FILE *stream, const perf_values_t values, double runs);
+
+#endif /* LIB_PERF_H */
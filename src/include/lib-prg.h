@@ -0,0 +1,52 @@
+/*
+ * Counter-mode pseudo-random generator based on the ChaCha20 block function.
+ *
+ * A generator is just a 256-bit key: word i of stream s is word i % 16 of
+ * the ChaCha20 block with nonce s and counter i / 16. Any range of any
+ * stream can therefore be produced independently, which lets threads share
+ * the work by counter range and get the same words whatever the split.
+ *
+ * A prg_stream_t reads one stream front to back for draws of unknown size,
+ * such as the encryption randomness and the sharing masks, generating it a
+ * few blocks at a time. prg_local gives each thread a stream of its own under
+ * a process key taken once from the OS, so parallel draws neither share a
+ * state nor take a lock.
+ */
+
+#ifndef LIB_PRG_H
+#define LIB_PRG_H
+
+#include <gmp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PRG_SEED_BYTES 32
+#define PRG_BLOCK_WORDS 16
+/* words a stream generates at once, eight blocks for the AVX2 path */
+#define PRG_BUFFER_WORDS (8 * PRG_BLOCK_WORDS)
+
+struct prg_struct {
+    uint32_t key[8];
+};
+typedef struct prg_struct prg_t[1];
+
+struct prg_stream_struct {
+    prg_t prg;
+    uint64_t stream;
+    uint64_t offset; /* first word of the stream not in the buffer yet */
+    uint32_t buffer[PRG_BUFFER_WORDS];
+    size_t used; /* bytes of the buffer already handed out */
+};
+typedef struct prg_stream_struct prg_stream_t[1];
+
+void prg_init(prg_t prg, const uint8_t seed[PRG_SEED_BYTES]);
+int prg_init_os(prg_t prg, uint8_t seed[PRG_SEED_BYTES]);
+void prg_words(const prg_t prg, uint64_t stream, uint64_t offset, uint32_t *out, size_t count);
+
+void prg_stream_init(prg_stream_t rng, const prg_t prg, uint64_t stream);
+void prg_stream_bytes(prg_stream_t rng, uint8_t *out, size_t count);
+void mpz_prg_urandomb(mpz_t rop, prg_stream_t rng, mp_bitcnt_t bits);
+void mpz_prg_urandomm(mpz_t rop, prg_stream_t rng, const mpz_t n);
+struct prg_stream_struct *prg_local(void);
+
+#endif /* LIB_PRG_H */
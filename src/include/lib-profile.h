@@ -0,0 +1,109 @@
+/*
+ * Phase profiler of the secure inference.
+ *
+ * The phases are those of the scheme, so the profiler lives apart from
+ * lib-timing, whose TSC, thread clocks and statistics it is built on.
+ *
+ * profile_begin and profile_end bracket a phase of the scheme. The time of a
+ * run is taken from the TSC, read last at the beginning and first at the end.
+ * The coarse phases, run once or once per layer (keygen, split, linear), also
+ * read get_thread_times around it for the process and thread CPU time of the
+ * run, from which they report their parallel efficiency. Those clocks are
+ * system calls, so the per-neuron phases skip them and report the TSC time
+ * alone. With $VHSS_MEMSTAT set a
+ * phase also reports the heap and GMP allocations its runs made, as counted
+ * by lib-memstat, and how far they pushed the peak resident set.
+ *
+ * Phases nest: a phase begun inside another one is reported below it, with
+ * its time also counted in the total of its parent and left out of the
+ * parent's self time. Every thread records into its own fixed-size
+ * accumulators, which profile_report and profile_report_json merge once the
+ * threads are done, so checks running on the verifier threads are profiled
+ * with the rest and a run of any length profiles in constant memory. The mean,
+ * deviation and extremes of a phase are exact, its median is estimated from
+ * a sample of PROFILE_RESERVOIR runs per thread.
+ *
+ * With $VHSS_PERF set every thread also opens a lib-perf counter group, and
+ * each phase gets the hardware events that occurred inside it. The coarse
+ * phases of the main thread hand their work to the pool workers, so they read
+ * instead a group that profile_init opens with inheritance: it also counts
+ * every thread started after it, and a read sums them all, the whole process
+ * as with the process CPU time. profile_init must therefore come before the
+ * pools are started. Reading a group is a system call at both ends of the
+ * phase, so counters are meant for phases well above a microsecond.
+ */
+
+#ifndef LIB_PROFILE_H
+#define LIB_PROFILE_H
+
+#include <stdio.h>
+#include <lib-memstat.h>
+#include <lib-perf.h>
+#include <lib-timing.h>
+
+/* environment variable naming a file the JSON report is written to */
+#define PROFILE_JSON_ENV "VHSS_PROFILE"
+
+/* deepest nesting of phases on a thread */
+#define PROFILE_MAX_DEPTH 8
+
+/* runs of a phase kept per thread for its median */
+#define PROFILE_RESERVOIR 1024
+
+typedef enum {
+    phase_keygen = 0,
+    phase_split, /* the client's additive shares of a layer's inputs and biases */
+    phase_share, /* the HSS share of a neuron */
+    phase_linear,
+    phase_hss_evaluate,
+    phase_prob_gen,
+    phase_verify,
+    phase_decode,
+    phase_rescale,
+    PROFILE_PHASES
+} profile_phase_t;
+
+/* allocations of a phase, all runs together */
+struct profile_memory_struct {
+    uint64_t allocs, bytes, gmp_allocs, gmp_bytes;
+    long rss_growth; /* KiB the peak resident set grew during the runs */
+    long peak_rss;   /* KiB, the highest peak seen at the end of a run */
+};
+
+/* merged view of a phase over all threads, times in the unit asked for */
+struct profile_summary_struct {
+    profile_phase_t phase;
+    int parent; /* enclosing phase, -1 for a top-level one */
+    int depth;
+    int threads; /* threads that ran the phase */
+    elapsed_time_t total, self;
+    elapsed_time_t thread_cpu; /* CPU time of the threads running the phase, -1 if not read */
+    elapsed_time_t cpu;        /* process CPU time of the main thread runs, -1 if none */
+    double efficiency;         /* cpu / wall / profile_init threads, -1 if none */
+    stats_t stats; /* over the single runs of the phase */
+    perf_values_t counters; /* events inside the phase, all runs together */
+    struct profile_memory_struct memory;
+};
+
+#define profile_phase(PHASE, CODE)                                             \
+    {                                                                          \
+        profile_begin(PHASE);                                                  \
+        {CODE};                                                                \
+        profile_end(PHASE);                                                    \
+    }
+
+void profile_init(int threads);
+bool profile_counting(void);
+bool profile_measuring_memory(void);
+void profile_clear(void);
+void profile_begin(profile_phase_t phase);
+void profile_end(profile_phase_t phase);
+const char *profile_phase_name(profile_phase_t phase);
+const char *profile_json_path(void);
+
+int profile_summarize(struct profile_summary_struct summary[PROFILE_PHASES], enum time_unit unit);
+elapsed_time_t profile_total(enum time_unit unit);
+void profile_report(FILE *stream, enum time_unit unit);
+void profile_report_json(FILE *stream, enum time_unit unit);
+
+#endif /* LIB_PROFILE_H */
@@ -0,0 +1,59 @@
+/*
+ * Quantized GEMM for the share-side linear layers.
+ *
+ * Weights are quantized once per model into a packed int16 matrix; the
+ * product with the int32 activation shares is computed in the ring Z_2^32
+ * (wrapping arithmetic), using pmaddwd-style int16 pair products with int32
+ * accumulation. Activations wider than 16 bits are split into two signed
+ * int16 limbs, so the result is exact modulo 2^32 whatever the share values.
+ */
+
+#ifndef LIB_QGEMM_H
+#define LIB_QGEMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lib-prg.h>
+#include <lib-thpool.h>
+
+/* environment variable restricting the microkernel to "generic", so that it
+ * can be tested on a CPU with AVX2 */
+#define QGEMM_KERNEL_ENV "VHSS_QGEMM_KERNEL"
+
+/* rows computed together by the microkernel and images per packed panel */
+#define QGEMM_MR 4
+#define QGEMM_NR 16
+
+struct qmatrix_struct {
+    int rows;
+    int cols;
+    int ld;        /* int16 elements between rows: cols rounded up to 64 bytes */
+    int16_t *data; /* 64-byte aligned, zero padded up to a multiple of QGEMM_MR rows */
+};
+typedef struct qmatrix_struct qmatrix_t[1];
+
+int qmatrix_init(qmatrix_t q, int rows, int cols);
+void qmatrix_clear(qmatrix_t q);
+void qmatrix_quantize(qmatrix_t q, const float *weight, int scale);
+void qmatrix_load(qmatrix_t q, const int16_t *weight);
+
+/* one product y = w x + bias, see qgemm_s32 for the layout of x and y; when
+ * x_prg is set, x is not read and image j of the input is words
+ * [j * w->cols, (j + 1) * w->cols) of stream x_stream, expanded on the fly */
+struct qgemm_job_struct {
+    const struct qmatrix_struct *w;
+    const int32_t *bias;
+    const int32_t *x;
+    size_t x_k_stride, x_n_stride;
+    const struct prg_struct *x_prg;
+    uint64_t x_stream;
+    int32_t *y;
+    size_t y_m_stride, y_n_stride;
+    size_t n;
+};
+
+void qgemm_s32_run(thpool_t pool, const struct qgemm_job_struct *jobs, int num_jobs);
+void qgemm_s32(const qmatrix_t w, const int32_t *bias, const int32_t *x, size_t x_k_stride,
+               size_t x_n_stride, int32_t *y, size_t y_m_stride, size_t y_n_stride, size_t n);
+
+#endif /* LIB_QGEMM_H */
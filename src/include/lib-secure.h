@@ -0,0 +1,60 @@
+/*
+ * Linear layers of the secure drivers.
+ *
+ * The client quantizes its inputs and shares them over Z_2^32, both servers
+ * evaluate their share of the layer on the int16 GEMM, and the client
+ * reconstructs the outputs and checks them with the Freivalds key of the
+ * layer. A batch is held as one MNISTData per party; the per-layer state
+ * derived from the model (quantized weights and biases, verification key)
+ * is kept in one SecureLayer per layer for the whole run.
+ */
+
+#ifndef LIB_SECURE_H
+#define LIB_SECURE_H
+
+#include <lib-freivalds.h>
+#include <lib-model.h>
+#include <lib-prg.h>
+#include <lib-qgemm.h>
+#include <lib-tensor.h>
+#include <lib-thpool.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* a batch of images as held by one party, one row per image */
+typedef struct {
+    tensor_t data;        /* activations */
+    tensor_t temp;        /* quantized layer inputs */
+    tensor_t result_data; /* layer outputs */
+    bool seeded;          /* temp is left implicit: it is stream `stream` of `seed` */
+    prg_t seed;
+    uint64_t stream;
+    int num_images;
+    int image_size; /* features per image in the current layer */
+} MNISTData;
+
+/* the per-layer state of the secure path, derived once from the model */
+typedef struct {
+    linear_veri_key_t veri_key; /* generated once per model and layer */
+    qmatrix_t qweight;          /* quantized once and shared by both servers */
+    int32_t *qbia;
+    int32_t *qbia_1;
+    int32_t *qbia_2;
+} SecureLayer;
+
+MNISTData *create_mnist_data(int num_images, int image_size, int width, bool with_activations, bool with_inputs);
+int resize_mnist_data(MNISTData *mnist, int num_images);
+void free_mnist_data(MNISTData *mnist);
+
+SecureLayer *create_secure_layers(const model_t model);
+void free_secure_layers(SecureLayer *layers, int num_layers);
+
+void linear_split(thpool_t pool, const prg_t prg, uint64_t stream, MNISTData *original_data, MNISTData *share1,
+                  MNISTData *share2);
+void bia_quantize(const float *bias, int bias_size, int32_t *quantized);
+void bia_split(const prg_t prg, uint64_t stream, const int32_t *bias, int bias_size, int32_t *share1,
+               int32_t *share2);
+void linear_evaluate(thpool_t pool, MNISTData *share1, MNISTData *share2, qmatrix_t weight, const int32_t *bias1,
+                     const int32_t *bias2);
+
+#endif /* LIB_SECURE_H */
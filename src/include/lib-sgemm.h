@@ -0,0 +1,44 @@
+/*
+ * Cache-blocked FP32 GEMM for the plaintext reference models.
+ *
+ * A layer computes y = act(W x + b) for a batch of images stored one per
+ * row. The weights are packed once per model into panels of SGEMM_NR output
+ * features; each task packs a block of images into SGEMM_MR-image panels and
+ * runs a SGEMM_MR x SGEMM_NR FMA microkernel over them (AVX2/FMA when the
+ * CPU has it, portable C otherwise). The bias and the activation are applied
+ * to each tile as it is written back, so a layer is a single pass.
+ */
+
+#ifndef LIB_SGEMM_H
+#define LIB_SGEMM_H
+
+#include <lib-thpool.h>
+#include <stddef.h>
+
+/* images and output features computed together by the microkernel */
+#define SGEMM_MR 6
+#define SGEMM_NR 16
+
+typedef enum {
+    sgemm_identity,
+    sgemm_relu,
+    sgemm_square_plus /* x^2 + x on 2-decimal fixed point, as in the secure model */
+} sgemm_activation_t;
+
+struct smatrix_struct {
+    int rows;
+    int cols;
+    int panels;  /* rows rounded up to SGEMM_NR, divided by SGEMM_NR */
+    float *data; /* panels x cols x SGEMM_NR, 64-byte aligned, zero padded */
+    float *bias; /* panels * SGEMM_NR entries, zero padded */
+};
+typedef struct smatrix_struct smatrix_t[1];
+
+int smatrix_init(smatrix_t w, int rows, int cols);
+void smatrix_clear(smatrix_t w);
+void smatrix_pack(smatrix_t w, const float *weight, const float *bias);
+
+void sgemm_layer(thpool_t pool, const smatrix_t w, sgemm_activation_t activation, const float *x,
+                 size_t x_stride, float *y, size_t y_stride, size_t n);
+
+#endif /* LIB_SGEMM_H */
@@ -0,0 +1,30 @@
+/*
+ * Additive secret sharing over the ring Z_2^32.
+ *
+ * A value x is split as x = share1 + share2 (mod 2^32), with share1 drawn
+ * uniformly from a counter-mode PRG stream: element (r, c) of a rows x cols
+ * matrix uses word r * cols + c of the stream, so the shares only depend on
+ * the key and the stream, not on how the rows are spread over threads.
+ * Since share1 is fully determined by the 32-byte seed and the stream, it
+ * can be handed over as the seed alone and regenerated where it is used.
+ */
+
+#ifndef LIB_SHARE_H
+#define LIB_SHARE_H
+
+#include <lib-prg.h>
+#include <lib-thpool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* streams of the drivers' generator: layer inputs of each batch of images,
+ * below 2^32, and layer biases, shared once per run */
+#define SHARE_STREAM_INPUT(batch, layer) (((uint64_t)(batch) << 16) | (uint64_t)(layer))
+#define SHARE_STREAM_BIAS(layer) ((UINT64_C(1) << 32) | (uint64_t)(layer))
+
+void ring_share(thpool_t pool, const prg_t prg, uint64_t stream, const int32_t *x, size_t x_stride,
+                int32_t *share1, size_t share1_stride, int32_t *share2, size_t share2_stride, int rows,
+                int cols);
+void ring_reconstruct(const int32_t *share1, const int32_t *share2, int32_t *x, size_t count);
+
+#endif /* LIB_SHARE_H */
@@ -0,0 +1,76 @@
+/*
+ * Batched image input with bounded memory.
+ *
+ * An image stream hands out the images of an IDX file or of a text images
+ * file (one image per line, '#' lines skipped) a batch at a time. A
+ * background thread loads the next batch into the second of two buffers while
+ * the caller works on the current one, so reading overlaps compute and the
+ * memory in use is two batches whatever the size of the dataset.
+ *
+ * The labels of the images are read along with them from the text labels
+ * files, a batch at a time as well.
+ *
+ * The drivers record the completion time of each batch in a batch_times_t and
+ * report the per-image latency percentiles from it: every image of a batch
+ * waits for the whole batch, so a run in a single batch has one latency.
+ */
+
+#ifndef LIB_STREAM_H
+#define LIB_STREAM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <lib-idx.h>
+
+/* environment variable selecting streaming mode and its batch size */
+#define IMAGE_STREAM_BATCH_ENV "VHSS_BATCH"
+
+struct image_stream_struct {
+    idx_t idx;  /* source when the file is an IDX file */
+    FILE *file; /* source otherwise */
+    char *line;
+    size_t line_size;
+    int pixels; /* per image */
+    int batch;  /* images per batch */
+    int left;   /* images still to load */
+    int loaded; /* images loaded so far */
+    float *buffer[2];
+    int count[2]; /* images in each buffer, 0 at the end, -1 on error */
+    bool full[2];
+    int current; /* buffer handed out last, -1 before the first batch */
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t filled, emptied;
+    pthread_t thread;
+};
+typedef struct image_stream_struct image_stream_t[1];
+
+int image_stream_default_batch(void);
+int image_stream_open(image_stream_t stream, const char *filename, int pixels, int batch, int limit);
+int image_stream_next(image_stream_t stream, const float **images);
+void image_stream_close(image_stream_t stream);
+
+FILE *image_labels_open(const char *filename);
+int image_labels_next(FILE *file, int *labels, int n);
+
+struct batch_time_struct {
+    double time; /* s */
+    int count;   /* images of the batch */
+};
+
+struct batch_times_struct {
+    struct batch_time_struct *batches;
+    int size, capacity;
+    int images;
+    double total; /* s */
+};
+typedef struct batch_times_struct batch_times_t[1];
+
+void batch_times_init(batch_times_t times);
+int batch_times_add(batch_times_t times, double time, int count);
+double batch_times_percentile(batch_times_t times, double q);
+void batch_times_report(FILE *out, batch_times_t times);
+void batch_times_clear(batch_times_t times);
+
+#endif /* LIB_STREAM_H */
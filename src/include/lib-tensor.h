@@ -0,0 +1,40 @@
+/*
+ * Batch-major activation tensors.
+ *
+ * A tensor holds one row per image. Rows are padded to a multiple of 64
+ * bytes, so each image starts on its own cache line and stride elements
+ * separate two consecutive images. Elements are 4 bytes wide and read
+ * either as float or as int32_t. The buffers are sized for the widest layer
+ * and reused by every layer of a batch.
+ */
+
+#ifndef LIB_TENSOR_H
+#define LIB_TENSOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TENSOR_ALIGN 64
+
+struct tensor_struct {
+    int rows;      /* images the buffer can hold */
+    int cols;      /* features per image, i.e. the widest layer */
+    size_t stride; /* elements between two images: cols rounded up to TENSOR_ALIGN bytes */
+    void *data;
+};
+typedef struct tensor_struct tensor_t[1];
+
+int tensor_init(tensor_t t, int rows, int cols);
+void tensor_clear(tensor_t t);
+int tensor_resize(tensor_t t, int rows);
+void tensor_swap(tensor_t a, tensor_t b);
+
+static inline float *tensor_f32(const tensor_t t, int row) {
+    return (float *)t->data + (size_t)row * t->stride;
+}
+
+static inline int32_t *tensor_s32(const tensor_t t, int row) {
+    return (int32_t *)t->data + (size_t)row * t->stride;
+}
+
+#endif /* LIB_TENSOR_H */
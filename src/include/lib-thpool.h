@@ -0,0 +1,50 @@
+/*
+ * Lightweight fork-join thread pool.
+ *
+ * thpool_run hands out the indices of a batch of tasks to the pool workers
+ * and to the calling thread, and returns once all of them are done. Tasks
+ * are claimed one at a time from a shared counter, so uneven tasks balance
+ * themselves. A pool runs one batch at a time and must be driven by a single
+ * thread.
+ */
+
+#ifndef LIB_THPOOL_H
+#define LIB_THPOOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* environment variable overriding the default number of threads */
+#define THPOOL_THREADS_ENV "VHSS_THREADS"
+
+/* runs task index of a batch; worker is in [0, thpool_size()) and can be
+ * used to pick per-thread scratch memory */
+typedef void (*thpool_task_fn)(void *arg, size_t index, int worker);
+
+struct thpool_struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start, finish;
+    pthread_t *threads;
+    int num_threads; /* workers besides the calling thread */
+    unsigned long generation;
+    int pending; /* workers still inside the current batch */
+    bool stopping;
+    thpool_task_fn fn;
+    void *arg;
+    size_t count;
+    size_t next; /* next unclaimed task, updated atomically */
+};
+typedef struct thpool_struct thpool_t[1];
+
+int thpool_default_threads(void);
+int thpool_init(thpool_t pool, int num_threads);
+void thpool_clear(thpool_t pool);
+void thpool_run(thpool_t pool, thpool_task_fn fn, void *arg, size_t count);
+
+/* threads taking part in a batch; a NULL pool runs everything on the caller */
+static inline int thpool_size(const thpool_t pool) {
+    return pool != NULL ? pool->num_threads + 1 : 1;
+}
+
+#endif /* LIB_THPOOL_H */
@@ -29,6 +29,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include <lib-perf.h>
 
 #if defined(__MACH__)
 #include <CoreServices/CoreServices.h>
@@ -54,11 +55,28 @@
 /* degli ID fittizi per i clock nativi su Windows */
 #define CLOCK_QPC_WIN_ID 90
 #define CLOCK_PROCESS_TIME_WIN_ID 91
+#define CLOCK_THREAD_TIME_WIN_ID 92
 #endif /* defined(_WIN32) || defined(__CYGWIN__) */
 
 /* ID fittizio per usare il metodo POSIX getrusage */
 #define CLOCK_GETRUSAGE_ID 100
 
+/* i clock usati per rilevare insieme il tempo reale, il tempo di CPU del
+ * processo (somma su tutti i thread) e quello del solo thread chiamante */
+#if defined(__MACH__)
+#define CLOCK_WALL_ID CLOCK_ABSTIME_MAC_ID
+#define CLOCK_PROCESS_ID CLOCK_GETRUSAGE_ID
+#define CLOCK_THREAD_ID CLOCK_THREAD_CPUTIME_ID
+#elif defined(_WIN32) || defined(__CYGWIN__)
+#define CLOCK_WALL_ID CLOCK_QPC_WIN_ID
+#define CLOCK_PROCESS_ID CLOCK_PROCESS_TIME_WIN_ID
+#define CLOCK_THREAD_ID CLOCK_THREAD_TIME_WIN_ID
+#else
+#define CLOCK_WALL_ID CLOCK_MONOTONIC
+#define CLOCK_PROCESS_ID CLOCK_PROCESS_CPUTIME_ID
+#define CLOCK_THREAD_ID CLOCK_THREAD_CPUTIME_ID
+#endif
+
 /* le unità di tempo utilizzabili nei report statistici */
 enum time_unit { tu_nanos = 0, tu_micros, tu_millis, tu_sec };
 
@@ -84,14 +102,47 @@ struct stats_struct {
 typedef struct stats_struct *stats_ptr;
 typedef struct stats_struct stats_t[1];
 
+/* un rilevamento contemporaneo dei tre clock CLOCK_WALL_ID, CLOCK_PROCESS_ID e
+ * CLOCK_THREAD_ID */
+struct thread_times_struct {
+    struct timespec wall, process, thread;
+};
+typedef struct thread_times_struct thread_times_t[1];
+
+/* i tempi (ns) trascorsi tra due rilevamenti dei tre clock */
+struct elapsed_times_struct {
+    elapsed_time_t wall, process, thread;
+};
+typedef struct elapsed_times_struct elapsed_times_t[1];
+
+/* le macro di campionamento con clock cycles e timestamp contano anche gli
+ * eventi hardware di ogni campione nel gruppo lib-perf impostato con
+ * set_sampling_counters sul thread chiamante: i contatori sono letti prima e
+ * dopo l'intervallo cronometrato, che non include così le loro system call, e
+ * vi contano solo CODE, non CLEAN né il resto del ciclo */
+
+/* macro per effettuare un test singolo rilevando tempo reale, tempo di CPU del
+ * processo e del thread chiamante */
+#define perform_oneshot_thread_times_sampling(ELAPSED_TIMES, CODE)             \
+    {                                                                          \
+        thread_times_t tt_before, tt_after;                                    \
+        get_thread_times(tt_before);                                           \
+        {CODE};                                                                \
+        get_thread_times(tt_after);                                            \
+        get_elapsed_times(ELAPSED_TIMES, tt_before, tt_after);                 \
+    }
+
 /* macro per effettuare un test singolo usando il metodo basato sui clock cycles
  */
 #define perform_oneshot_clock_cycles_sampling(ELAPSED_TIME, UNIT, CODE)        \
     {                                                                          \
         clock_cycles_t cc_before, cc_after;                                    \
+        perf_values_t pc_before;                                               \
+        sampling_counters_before(pc_before);                                   \
         cc_before = get_clock_cycles_before();                                 \
         {CODE};                                                                \
         cc_after = get_clock_cycles_after();                                   \
+        sampling_counters_after(pc_before);                                    \
         ELAPSED_TIME = et_to(                                                  \
             get_elapsed_time_from_cpu_cycles(cc_before, cc_after), UNIT);      \
     }
@@ -100,9 +151,12 @@ typedef struct stats_struct stats_t[1];
 #define perform_oneshot_timestamp_sampling(ELAPSED_TIME, UNIT, CODE)           \
     {                                                                          \
         timestamp_t ts_before, ts_after;                                       \
+        perf_values_t pc_before;                                               \
+        sampling_counters_before(pc_before);                                   \
         get_timestamp(ts_before);                                              \
         {CODE};                                                                \
         get_timestamp(ts_after);                                               \
+        sampling_counters_after(pc_before);                                    \
         ELAPSED_TIME =                                                         \
             et_to(get_elapsed_time_from_timestamp(ts_before, ts_after), UNIT); \
     }
@@ -115,6 +169,7 @@ typedef struct stats_struct stats_t[1];
         assert(STATS != NULL);                                                 \
         assert(NUM_SAMPLES > 0);                                               \
         timestamp_t ts_before, ts_after;                                       \
+        perf_values_t pc_before;                                               \
         elapsed_time_t *vector_samples =                                       \
             (VECTOR != NULL ? VECTOR                                           \
                             : (elapsed_time_t *)calloc(                        \
@@ -122,9 +177,11 @@ typedef struct stats_struct stats_t[1];
         assert(vector_samples);                                                \
         for (size_t vector_index = 0; vector_index < NUM_SAMPLES;              \
              vector_index++) {                                                 \
+            sampling_counters_before(pc_before);                               \
             get_timestamp(ts_before);                                          \
             {CODE};                                                            \
             get_timestamp(ts_after);                                           \
+            sampling_counters_after(pc_before);                                \
             vector_samples[vector_index] = et_to(                              \
                 get_elapsed_time_from_timestamp(ts_before, ts_after), UNIT);   \
             if ((vector_index + 1) < NUM_SAMPLES) {                            \
@@ -144,6 +201,7 @@ typedef struct stats_struct stats_t[1];
         assert(STATS != NULL);                                                 \
         assert(NUM_SAMPLES > 0);                                               \
         clock_cycles_t cc_before, cc_after;                                    \
+        perf_values_t pc_before;                                               \
         elapsed_time_t *vector_samples =                                       \
             (VECTOR != NULL ? VECTOR                                           \
                             : (elapsed_time_t *)calloc(                        \
@@ -151,9 +209,11 @@ typedef struct stats_struct stats_t[1];
         assert(vector_samples);                                                \
         for (size_t vector_index = 0; vector_index < NUM_SAMPLES;              \
              vector_index++) {                                                 \
+            sampling_counters_before(pc_before);                               \
             cc_before = get_clock_cycles_before();                             \
             {CODE};                                                            \
             cc_after = get_clock_cycles_after();                               \
+            sampling_counters_after(pc_before);                                \
             vector_samples[vector_index] = et_to(                              \
                 get_elapsed_time_from_cpu_cycles(cc_before, cc_after), UNIT);  \
             if ((vector_index + 1) < NUM_SAMPLES) {                            \
@@ -174,6 +234,7 @@ typedef struct stats_struct stats_t[1];
         assert(PERIOD >= 0);                                                   \
         assert(MAX_SAMPLES > 0);                                               \
         timestamp_t ts_before, ts_after;                                       \
+        perf_values_t pc_before;                                               \
         timestamp_t ts_begin;                                                  \
         elapsed_time_t *vector_samples =                                       \
             (elapsed_time_t *)calloc(MAX_SAMPLES, sizeof(elapsed_time_t));     \
@@ -181,9 +242,11 @@ typedef struct stats_struct stats_t[1];
         size_t vector_index;                                                   \
         get_timestamp(ts_begin);                                               \
         for (vector_index = 0; vector_index < MAX_SAMPLES; vector_index++) {   \
+            sampling_counters_before(pc_before);                               \
             get_timestamp(ts_before);                                          \
             {CODE};                                                            \
             get_timestamp(ts_after);                                           \
+            sampling_counters_after(pc_before);                                \
             vector_samples[vector_index] = et_to(                              \
                 get_elapsed_time_from_timestamp(ts_before, ts_after), UNIT);   \
             if (et_to(get_elapsed_time_from_timestamp(ts_begin, ts_after),     \
@@ -208,6 +271,7 @@ typedef struct stats_struct stats_t[1];
         assert(PERIOD >= 0);                                                   \
         assert(MAX_SAMPLES > 0);                                               \
         clock_cycles_t cc_before, cc_after;                                    \
+        perf_values_t pc_before;                                               \
         clock_cycles_t cc_begin;                                               \
         elapsed_time_t *vector_samples =                                       \
             (elapsed_time_t *)calloc(MAX_SAMPLES, sizeof(elapsed_time_t));     \
@@ -215,8 +279,11 @@ typedef struct stats_struct stats_t[1];
         size_t vector_index;                                                   \
         cc_begin = get_clock_cycles_before();                                  \
         for (vector_index = 0; vector_index < MAX_SAMPLES; vector_index++) {   \
+            sampling_counters_before(pc_before);                               \
             cc_before = get_clock_cycles_before();                             \
-            {CODE} cc_after = get_clock_cycles_after();                        \
+            {CODE};                                                            \
+            cc_after = get_clock_cycles_after();                               \
+            sampling_counters_after(pc_before);                                \
             vector_samples[vector_index] = et_to(                              \
                 get_elapsed_time_from_cpu_cycles(cc_before, cc_after), UNIT);  \
             if (et_to(get_elapsed_time_from_cpu_cycles(cc_begin, cc_after),    \
@@ -240,6 +307,11 @@ typedef struct stats_struct stats_t[1];
     fprintf_short_stats(stdout, NAME, STATS, SUFFIX)
 
 void get_timestamp(timestamp_t ts);
+void get_timestamp_from(clockid_t clock, timestamp_t ts);
+void get_thread_times(thread_times_t times);
+void get_elapsed_times(elapsed_times_t elapsed, thread_times_t before,
+                       thread_times_t after);
+double get_parallel_efficiency(const elapsed_times_t elapsed, int threads);
 elapsed_time_t get_timestamp_resolution();
 elapsed_time_t get_elapsed_time_from_timestamp(timestamp_t before,
                                                timestamp_t after);
@@ -249,6 +321,9 @@ clock_cycles_t rdtscp();
 clock_cycles_t rdtscp_cpuid();
 extern clock_cycles_t (*get_clock_cycles_before)();
 extern clock_cycles_t (*get_clock_cycles_after)();
+void set_sampling_counters(perf_group_t group, perf_values_t values);
+void sampling_counters_before(perf_values_t before);
+void sampling_counters_after(const perf_values_t before);
 void set_stats_kernel_cuts(float lower, float upper);
 void set_clock_cycles_per_ns(double ratio);
 elapsed_time_t get_clock_cycles_per_ns();
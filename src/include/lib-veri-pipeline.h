@@ -0,0 +1,53 @@
+/*
+ * Asynchronous verification pipeline: checks are queued as records and run by
+ * a pool of worker threads while inference goes on speculatively. The first
+ * failing record aborts the pipeline; later records are dropped unchecked.
+ */
+
+#ifndef LIB_VERI_PIPELINE_H
+#define LIB_VERI_PIPELINE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* runs the check of a record, returns true if it passes */
+typedef bool (*veri_check_fn)(void *data);
+/* releases the memory held by a record */
+typedef void (*veri_release_fn)(void *data);
+
+struct veri_record_struct {
+    int layer;
+    veri_check_fn check;
+    veri_release_fn release;
+    void *data;
+    struct veri_record_struct *next;
+};
+
+struct veri_pipeline_struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full, idle;
+    pthread_t *workers;
+    int num_workers;
+    size_t capacity, queued, running;
+    struct veri_record_struct *head, *tail;
+    struct veri_record_struct *spare; /* processed records, reused by submit */
+    bool stopping;
+    bool failed;
+    int failed_layer;
+    size_t checked;
+};
+typedef struct veri_pipeline_struct veri_pipeline_t[1];
+
+int veri_pipeline_init(veri_pipeline_t pipeline, int num_workers, size_t capacity);
+void veri_pipeline_clear(veri_pipeline_t pipeline);
+void veri_pipeline_submit(veri_pipeline_t pipeline, int layer, veri_check_fn check,
+                          veri_release_fn release, void *data);
+bool veri_pipeline_drain(veri_pipeline_t pipeline);
+
+/* cheap test used by the inference loop to stop as soon as a check failed */
+static inline bool veri_pipeline_failed(const veri_pipeline_t pipeline) {
+    return __atomic_load_n(&pipeline->failed, __ATOMIC_ACQUIRE);
+}
+
+#endif /* LIB_VERI_PIPELINE_H */
@@ -240,18 +240,19 @@ void prs_generate_keys(prs_keys_t *keys, unsigned int k, unsigned int n_bits, gm
  * @param ciphertext
  * @param keys
  * @param plaintext
- * @param prng
+ * @param rng stream x is drawn from, prg_local() of the calling thread
  */
-void prs_encrypt(prs_ciphertext_t ciphertext, unsigned int k, mpz_t y, mpz_t n, mpz_t k_2, prs_plaintext_t plaintext, gmp_randstate_t prng, unsigned int base_size){
+void prs_encrypt(prs_ciphertext_t ciphertext, unsigned int k, mpz_t y, mpz_t n, mpz_t k_2, prs_plaintext_t plaintext, prg_stream_t rng, unsigned int base_size){
     mpz_t x, y_m;
     assert(base_size > 0);
     assert(base_size <= k);
     mpz_inits(x, y_m, NULL);
-    mpz_urandomb(x, prng, base_size);
+    mpz_prg_urandomb(x, rng, base_size);
     mpz_powm(y_m, y, plaintext->m, n);
     mpz_powm(x, x,k_2, n);
     mpz_mul(ciphertext->c, x, y_m);
     mpz_mod(ciphertext->c, ciphertext->c, n);
+    mpz_clears(x, y_m, NULL);
 }
 /**
  * Decrypt(sk, c) Given c ∈ Zn* and the private key sk = {p}, the algorithm first computes
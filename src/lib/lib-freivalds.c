@@ -0,0 +1,93 @@
+/*
+ * Freivalds verification of the linear layers y = W x + b.
+ *
+ * The verifier keeps a secret r and checks r^T y == (r^T W) x + r^T b for
+ * every image. All arithmetic is done modulo p = 2^61 - 1, so nothing can
+ * overflow whatever the size of the accumulated values; a wrong output
+ * passes the check with probability at most 1/p.
+ */
+
+#include <lib-freivalds.h>
+#include <lib-misc.h>
+#include <math.h>
+#include <stdlib.h>
+
+/* reduces a 128-bit value modulo 2^61 - 1 */
+static inline uint64_t field_reduce(unsigned __int128 x) {
+    uint64_t s = ((uint64_t)x & FREIVALDS_P) + (uint64_t)(x >> 61);
+    s = (s & FREIVALDS_P) + (s >> 61);
+    return s >= FREIVALDS_P ? s - FREIVALDS_P : s;
+}
+
+static inline uint64_t field_add(uint64_t a, uint64_t b) {
+    uint64_t s = a + b;
+    return s >= FREIVALDS_P ? s - FREIVALDS_P : s;
+}
+
+static inline uint64_t field_mul(uint64_t a, uint64_t b) {
+    return field_reduce((unsigned __int128)a * b);
+}
+
+/* maps a (possibly negative) integer into the field */
+static inline uint64_t field_from_int(int64_t v) {
+    return v >= 0 ? (uint64_t)v % FREIVALDS_P : FREIVALDS_P - (uint64_t)(-v) % FREIVALDS_P;
+}
+
+void linear_veri_key_init(linear_veri_key_t key, int rows, int cols) {
+    assert(key);
+    assert(rows > 0 && cols > 0);
+    key->rows = rows;
+    key->cols = cols;
+    key->r = (uint64_t *)calloc(rows, sizeof(uint64_t));
+    key->rw = (uint64_t *)calloc(cols, sizeof(uint64_t));
+    key->rb = 0;
+    assert(key->r && key->rw);
+}
+
+void linear_veri_key_clear(linear_veri_key_t key) {
+    assert(key);
+    free(key->r);
+    free(key->rw);
+    key->r = key->rw = NULL;
+}
+
+/* draws the secret challenge from the OS entropy pool and folds it into the
+ * quantized weights and biases of the layer; weight is rows x cols row-major */
+int linear_veri_key_generate(linear_veri_key_t key, const float *weight, const float *bias) {
+    assert(key && key->r && key->rw);
+    assert(weight && bias);
+
+    if (extract_randseed_os_rng((uint8_t *)key->r, key->rows * sizeof(uint64_t) * 8) < 0)
+        return -1;
+    for (int i = 0; i < key->rows; i++)
+        key->r[i] = field_reduce(key->r[i]);
+
+    for (int j = 0; j < key->cols; j++)
+        key->rw[j] = 0;
+    key->rb = 0;
+    for (int i = 0; i < key->rows; i++) {
+        const float *row = weight + (size_t)i * key->cols;
+        for (int j = 0; j < key->cols; j++) {
+            uint64_t w = field_from_int((int)roundf(row[j] * LINEAR_WEIGHT_SCALE));
+            key->rw[j] = field_add(key->rw[j], field_mul(key->r[i], w));
+        }
+        uint64_t b = field_from_int((int)roundf(bias[i] * LINEAR_BIAS_SCALE));
+        key->rb = field_add(key->rb, field_mul(key->r[i], b));
+    }
+
+    return 0;
+}
+
+/* checks one image: input holds the cols quantized inputs and output the rows
+ * reconstructed outputs, each with the given element stride */
+bool linear_veri_key_check(const linear_veri_key_t key, const int *input, size_t input_stride,
+                           const int *output, size_t output_stride) {
+    uint64_t expected = key->rb, actual = 0;
+
+    for (int j = 0; j < key->cols; j++)
+        expected = field_add(expected, field_mul(key->rw[j], field_from_int(input[j * input_stride])));
+    for (int i = 0; i < key->rows; i++)
+        actual = field_add(actual, field_mul(key->r[i], field_from_int(output[i * output_stride])));
+
+    return expected == actual;
+}
@@ -0,0 +1,248 @@
+/*
+ * ChaCha20 in counter mode (original 64-bit counter / 64-bit nonce layout).
+ * Eight blocks are computed at once with AVX2 when the CPU has it.
+ */
+
+#include <lib-prg.h>
+#include <lib-misc.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRG_X86
+#endif
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d)                                              \
+    a += b, d ^= a, d = ROTL32(d, 16);                                         \
+    c += d, b ^= c, b = ROTL32(b, 12);                                         \
+    a += b, d ^= a, d = ROTL32(d, 8);                                          \
+    c += d, b ^= c, b = ROTL32(b, 7);
+
+static const uint32_t chacha20_sigma[4] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+
+static inline uint32_t load_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void chacha20_block(const uint32_t key[8], uint64_t stream, uint64_t counter, uint32_t out[16]) {
+    uint32_t in[16], x[16];
+
+    memcpy(in, chacha20_sigma, sizeof(chacha20_sigma));
+    memcpy(in + 4, key, 8 * sizeof(uint32_t));
+    in[12] = (uint32_t)counter;
+    in[13] = (uint32_t)(counter >> 32);
+    in[14] = (uint32_t)stream;
+    in[15] = (uint32_t)(stream >> 32);
+    memcpy(x, in, sizeof(in));
+
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12])
+        QUARTER_ROUND(x[1], x[5], x[9], x[13])
+        QUARTER_ROUND(x[2], x[6], x[10], x[14])
+        QUARTER_ROUND(x[3], x[7], x[11], x[15])
+        QUARTER_ROUND(x[0], x[5], x[10], x[15])
+        QUARTER_ROUND(x[1], x[6], x[11], x[12])
+        QUARTER_ROUND(x[2], x[7], x[8], x[13])
+        QUARTER_ROUND(x[3], x[4], x[9], x[14])
+    }
+    for (int i = 0; i < 16; i++)
+        out[i] = x[i] + in[i];
+}
+
+#if defined(PRG_X86)
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define QUARTER_ROUND256(a, b, c, d)                                           \
+    a = _mm256_add_epi32(a, b), d = _mm256_xor_si256(d, a), d = ROTL256(d, 16); \
+    c = _mm256_add_epi32(c, d), b = _mm256_xor_si256(b, c), b = ROTL256(b, 12); \
+    a = _mm256_add_epi32(a, b), d = _mm256_xor_si256(d, a), d = ROTL256(d, 8);  \
+    c = _mm256_add_epi32(c, d), b = _mm256_xor_si256(b, c), b = ROTL256(b, 7);
+
+/* eight consecutive blocks, one per lane */
+__attribute__((target("avx2"))) static void
+chacha20_blocks8_avx2(const uint32_t key[8], uint64_t stream, uint64_t counter, uint32_t out[8 * 16]) {
+    __m256i in[16], x[16];
+    uint32_t lanes[16][8];
+
+    for (int i = 0; i < 4; i++)
+        in[i] = _mm256_set1_epi32((int32_t)chacha20_sigma[i]);
+    for (int i = 0; i < 8; i++)
+        in[4 + i] = _mm256_set1_epi32((int32_t)key[i]);
+    uint32_t lo[8], hi[8];
+    for (int j = 0; j < 8; j++) {
+        lo[j] = (uint32_t)(counter + j);
+        hi[j] = (uint32_t)((counter + j) >> 32);
+    }
+    in[12] = _mm256_loadu_si256((const __m256i *)lo);
+    in[13] = _mm256_loadu_si256((const __m256i *)hi);
+    in[14] = _mm256_set1_epi32((int32_t)(uint32_t)stream);
+    in[15] = _mm256_set1_epi32((int32_t)(uint32_t)(stream >> 32));
+    for (int i = 0; i < 16; i++)
+        x[i] = in[i];
+
+    for (int i = 0; i < 10; i++) {
+        QUARTER_ROUND256(x[0], x[4], x[8], x[12])
+        QUARTER_ROUND256(x[1], x[5], x[9], x[13])
+        QUARTER_ROUND256(x[2], x[6], x[10], x[14])
+        QUARTER_ROUND256(x[3], x[7], x[11], x[15])
+        QUARTER_ROUND256(x[0], x[5], x[10], x[15])
+        QUARTER_ROUND256(x[1], x[6], x[11], x[12])
+        QUARTER_ROUND256(x[2], x[7], x[8], x[13])
+        QUARTER_ROUND256(x[3], x[4], x[9], x[14])
+    }
+    for (int i = 0; i < 16; i++)
+        _mm256_storeu_si256((__m256i *)lanes[i], _mm256_add_epi32(x[i], in[i]));
+
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 16; i++)
+            out[j * 16 + i] = lanes[i][j];
+}
+#endif /* PRG_X86 */
+
+/* blocks [counter, counter + nblocks) of a stream, written contiguously */
+static void chacha20_blocks(const uint32_t key[8], uint64_t stream, uint64_t counter, uint32_t *out,
+                            size_t nblocks) {
+#if defined(PRG_X86)
+    if (nblocks >= 8 && __builtin_cpu_supports("avx2")) {
+        for (; nblocks >= 8; nblocks -= 8, counter += 8, out += 8 * PRG_BLOCK_WORDS)
+            chacha20_blocks8_avx2(key, stream, counter, out);
+    }
+#endif
+    for (; nblocks > 0; nblocks--, counter++, out += PRG_BLOCK_WORDS)
+        chacha20_block(key, stream, counter, out);
+}
+
+void prg_init(prg_t prg, const uint8_t seed[PRG_SEED_BYTES]) {
+    assert(prg && seed);
+    for (int i = 0; i < 8; i++)
+        prg->key[i] = load_le32(seed + 4 * i);
+}
+
+/* keys the generator from the OS entropy pool; the seed is also returned
+ * when the caller has to hand it over to another party */
+int prg_init_os(prg_t prg, uint8_t seed[PRG_SEED_BYTES]) {
+    uint8_t buffer[PRG_SEED_BYTES];
+    uint8_t *key = seed != NULL ? seed : buffer;
+
+    if (extract_randseed_os_rng(key, PRG_SEED_BYTES * 8) < 0)
+        return -1;
+    prg_init(prg, key);
+    return 0;
+}
+
+/* words [offset, offset + count) of a stream */
+void prg_words(const prg_t prg, uint64_t stream, uint64_t offset, uint32_t *out, size_t count) {
+    uint32_t block[PRG_BLOCK_WORDS];
+    uint64_t counter = offset / PRG_BLOCK_WORDS;
+    size_t skip = offset % PRG_BLOCK_WORDS;
+
+    if (skip != 0 && count > 0) {
+        size_t n = PRG_BLOCK_WORDS - skip < count ? PRG_BLOCK_WORDS - skip : count;
+        chacha20_block(prg->key, stream, counter++, block);
+        memcpy(out, block + skip, n * sizeof(uint32_t));
+        out += n;
+        count -= n;
+    }
+
+    size_t full = count / PRG_BLOCK_WORDS;
+    chacha20_blocks(prg->key, stream, counter, out, full);
+    counter += full;
+    out += full * PRG_BLOCK_WORDS;
+    count -= full * PRG_BLOCK_WORDS;
+
+    if (count > 0) {
+        chacha20_block(prg->key, stream, counter, block);
+        memcpy(out, block, count * sizeof(uint32_t));
+    }
+}
+
+void prg_stream_init(prg_stream_t rng, const prg_t prg, uint64_t stream) {
+    assert(rng && prg);
+    memcpy(rng->prg, prg, sizeof(struct prg_struct));
+    rng->stream = stream;
+    rng->offset = 0;
+    rng->used = sizeof(rng->buffer);
+}
+
+/* the next count bytes of the stream */
+void prg_stream_bytes(prg_stream_t rng, uint8_t *out, size_t count) {
+    assert(rng && (out || count == 0));
+    while (count > 0) {
+        if (rng->used == sizeof(rng->buffer)) {
+            chacha20_blocks(rng->prg->key, rng->stream, rng->offset / PRG_BLOCK_WORDS, rng->buffer,
+                            PRG_BUFFER_WORDS / PRG_BLOCK_WORDS);
+            rng->offset += PRG_BUFFER_WORDS;
+            rng->used = 0;
+        }
+        size_t n = sizeof(rng->buffer) - rng->used < count ? sizeof(rng->buffer) - rng->used : count;
+        memcpy(out, (uint8_t *)rng->buffer + rng->used, n);
+        rng->used += n;
+        out += n;
+        count -= n;
+    }
+}
+
+/* uniform in [0, 2^bits), as mpz_urandomb; the limbs are written in place */
+void mpz_prg_urandomb(mpz_t rop, prg_stream_t rng, mp_bitcnt_t bits) {
+    mp_size_t limbs = (mp_size_t)((bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS);
+    if (limbs == 0) {
+        mpz_set_ui(rop, 0);
+        return;
+    }
+    mp_limb_t *data = mpz_limbs_write(rop, limbs);
+    prg_stream_bytes(rng, (uint8_t *)data, limbs * sizeof(mp_limb_t));
+    if (bits % GMP_NUMB_BITS != 0)
+        data[limbs - 1] &= ((mp_limb_t)1 << bits % GMP_NUMB_BITS) - 1;
+    mpz_limbs_finish(rop, limbs);
+}
+
+/* uniform in [0, |n|), as mpz_urandomm, by rejection: under two draws on
+ * average */
+void mpz_prg_urandomm(mpz_t rop, prg_stream_t rng, const mpz_t n) {
+    assert(mpz_sgn(n) != 0);
+    mpz_t draw;
+    mp_bitcnt_t bits = mpz_sizeinbase(n, 2);
+    if (rop != n) {
+        do
+            mpz_prg_urandomb(rop, rng, bits);
+        while (mpz_cmpabs(rop, n) >= 0);
+        return;
+    }
+    mpz_init(draw);
+    do
+        mpz_prg_urandomb(draw, rng, bits);
+    while (mpz_cmpabs(draw, n) >= 0);
+    mpz_swap(rop, draw);
+    mpz_clear(draw);
+}
+
+static pthread_once_t prg_local_once = PTHREAD_ONCE_INIT;
+static prg_t prg_local_key;
+static uint64_t prg_local_streams = 0; /* streams handed out, updated atomically */
+static __thread struct prg_stream_struct prg_local_stream;
+static __thread bool prg_local_ready = false;
+
+static void prg_local_seed(void) {
+    if (prg_init_os(prg_local_key, NULL) < 0) {
+        fprintf(stderr, "cannot seed the generator from the OS\n");
+        abort();
+    }
+}
+
+/* the stream of the calling thread: one OS seed for the process, then a
+ * different nonce for each thread */
+struct prg_stream_struct *prg_local(void) {
+    if (!prg_local_ready) {
+        pthread_once(&prg_local_once, prg_local_seed);
+        prg_stream_init(&prg_local_stream, prg_local_key,
+                        __atomic_fetch_add(&prg_local_streams, 1, __ATOMIC_RELAXED));
+        prg_local_ready = true;
+    }
+    return &prg_local_stream;
+}
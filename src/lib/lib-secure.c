@@ -0,0 +1,149 @@
+/*
+ * Linear layers of the secure drivers.
+ */
+
+#include <lib-secure.h>
+#include <lib-share.h>
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+void free_mnist_data(MNISTData *mnist) {
+    if (mnist == NULL)
+        return;
+    tensor_clear(mnist->data);
+    tensor_clear(mnist->temp);
+    tensor_clear(mnist->result_data);
+    free(mnist);
+}
+
+/* allocates the buffers of a batch of image_size inputs, all sized for the
+ * widest layer; the servers only hold shares and need no activations, and a
+ * server with seed-compressed shares does not store its inputs either */
+MNISTData *create_mnist_data(int num_images, int image_size, int width, bool with_activations, bool with_inputs) {
+    MNISTData *mnist = (MNISTData *)malloc(sizeof(MNISTData));
+    if (mnist == NULL)
+        return NULL;
+
+    mnist->image_size = image_size;
+    mnist->num_images = num_images;
+    mnist->seeded = false;
+    mnist->stream = 0;
+    int data_status = tensor_init(mnist->data, num_images, with_activations ? width : 0);
+    int temp_status = tensor_init(mnist->temp, num_images, with_inputs ? width : 0);
+    int result_status = tensor_init(mnist->result_data, num_images, width);
+    if (data_status < 0 || temp_status < 0 || result_status < 0) {
+        free_mnist_data(mnist);
+        return NULL;
+    }
+    return mnist;
+}
+
+int resize_mnist_data(MNISTData *mnist, int num_images) {
+    assert(mnist);
+    if (tensor_resize(mnist->data, num_images) < 0 || tensor_resize(mnist->temp, num_images) < 0 ||
+        tensor_resize(mnist->result_data, num_images) < 0)
+        return -1;
+    mnist->num_images = num_images;
+    return 0;
+}
+
+/* NULL if a key cannot be drawn or memory runs out; what was allocated by
+ * then is released */
+SecureLayer *create_secure_layers(const model_t model) {
+    /* zeroed, so that the layers not reached yet can be cleared as well */
+    SecureLayer *layers = (SecureLayer *)calloc(model->num_layers, sizeof(SecureLayer));
+    if (layers == NULL)
+        return NULL;
+    for (int l = 0; l < model->num_layers; l++) {
+        const struct model_layer_struct *layer = &model->layers[l];
+        SecureLayer *secure = &layers[l];
+        linear_veri_key_init(secure->veri_key, layer->rows, layer->cols);
+        secure->qbia = (int32_t *)malloc(layer->rows * sizeof(int32_t));
+        secure->qbia_1 = (int32_t *)malloc(layer->rows * sizeof(int32_t));
+        secure->qbia_2 = (int32_t *)malloc(layer->rows * sizeof(int32_t));
+        if (linear_veri_key_generate(secure->veri_key, layer->weight, layer->bias) < 0 ||
+            qmatrix_init(secure->qweight, layer->rows, layer->cols) < 0 || secure->qbia == NULL ||
+            secure->qbia_1 == NULL || secure->qbia_2 == NULL) {
+            free_secure_layers(layers, model->num_layers);
+            return NULL;
+        }
+        if (layer->weight_s16 != NULL && layer->scale_s16 == LINEAR_WEIGHT_SCALE)
+            qmatrix_load(secure->qweight, layer->weight_s16); /* pre-quantized by model-convert */
+        else
+            qmatrix_quantize(secure->qweight, layer->weight, LINEAR_WEIGHT_SCALE);
+        bia_quantize(layer->bias, layer->rows, secure->qbia);
+    }
+    return layers;
+}
+
+void free_secure_layers(SecureLayer *layers, int num_layers) {
+    if (layers == NULL)
+        return;
+    for (int l = 0; l < num_layers; l++) {
+        linear_veri_key_clear(layers[l].veri_key);
+        qmatrix_clear(layers[l].qweight);
+        free(layers[l].qbia);
+        free(layers[l].qbia_1);
+        free(layers[l].qbia_2);
+    }
+    free(layers);
+}
+
+/* the client quantizes its inputs and shares them over Z_2^32; stream must
+ * be distinct for every call made with the same generator */
+void linear_split(thpool_t pool, const prg_t prg, uint64_t stream, MNISTData *original_data, MNISTData *share1,
+                  MNISTData *share2) {
+    for (int img = 0; img < original_data->num_images; img++) {
+        const float *input = tensor_f32(original_data->data, img);
+        int32_t *client = tensor_s32(original_data->temp, img); /* kept by the client for verification */
+        for (int i = 0; i < original_data->image_size; i++)
+            client[i] = (int32_t)roundf(input[i] * LINEAR_INPUT_SCALE);
+    }
+    /* a seeded server 1 regenerates its shares from the stream, only server 2's are stored */
+    share1->stream = stream;
+    ring_share(pool, prg, stream, tensor_s32(original_data->temp, 0), original_data->temp->stride,
+               share1->seeded ? NULL : tensor_s32(share1->temp, 0), share1->temp->stride,
+               tensor_s32(share2->temp, 0), share2->temp->stride, original_data->num_images,
+               original_data->image_size);
+
+    share1->image_size = share2->image_size = original_data->image_size;
+    share1->num_images = share2->num_images = original_data->num_images;
+}
+
+/* the biases are quantized once per model, in the fixed point of the layer outputs */
+void bia_quantize(const float *bias, int bias_size, int32_t *quantized) {
+    for (int i = 0; i < bias_size; i++)
+        quantized[i] = (int32_t)roundf(bias[i] * LINEAR_BIAS_SCALE);
+}
+
+/* shares the quantized biases over the same ring as the inputs */
+void bia_split(const prg_t prg, uint64_t stream, const int32_t *bias, int bias_size, int32_t *share1,
+               int32_t *share2) {
+    ring_share(NULL, prg, stream, bias, bias_size, share1, bias_size, share2, bias_size, 1, bias_size);
+}
+
+/* both servers evaluate their share of the layer concurrently on the pool; the
+ * two products are fused so that each weight tile is read once for both shares */
+void linear_evaluate(thpool_t pool, MNISTData *share1, MNISTData *share2, qmatrix_t weight, const int32_t *bias1,
+                     const int32_t *bias2) {
+    MNISTData *shares[2] = {share1, share2};
+    const int32_t *biases[2] = {bias1, bias2};
+    struct qgemm_job_struct jobs[2];
+
+    for (int s = 0; s < 2; s++) {
+        jobs[s].w = weight;
+        jobs[s].bias = biases[s]; /* added in the GEMM epilogue */
+        jobs[s].x = shares[s]->seeded ? NULL : tensor_s32(shares[s]->temp, 0);
+        jobs[s].x_k_stride = 1;
+        jobs[s].x_n_stride = shares[s]->temp->stride;
+        jobs[s].x_prg = shares[s]->seeded ? shares[s]->seed : NULL; /* expanded inside the kernel */
+        jobs[s].x_stream = shares[s]->stream;
+        jobs[s].y = tensor_s32(shares[s]->result_data, 0);
+        jobs[s].y_m_stride = 1;
+        jobs[s].y_n_stride = shares[s]->result_data->stride;
+        jobs[s].n = shares[s]->num_images;
+    }
+    qgemm_s32_run(pool, jobs, 2);
+    share1->image_size = share2->image_size = weight->rows;
+}
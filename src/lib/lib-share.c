@@ -0,0 +1,64 @@
+/*
+ * Additive secret sharing over the ring Z_2^32.
+ */
+
+#include <lib-share.h>
+#include <assert.h>
+#include <stdlib.h>
+
+/* rows shared by one task of the pool */
+#define SHARE_TASK_ROWS 16
+
+struct ring_share_job_struct {
+    const struct prg_struct *prg;
+    uint64_t stream;
+    const int32_t *x;
+    size_t x_stride;
+    int32_t *share1, *share2;
+    size_t share1_stride, share2_stride;
+    int rows, cols;
+};
+
+static void ring_share_task(void *arg, size_t index, int worker) {
+    const struct ring_share_job_struct *job = arg;
+    int first = (int)index * SHARE_TASK_ROWS;
+    int last = first + SHARE_TASK_ROWS < job->rows ? first + SHARE_TASK_ROWS : job->rows;
+    uint32_t *implicit = NULL;
+    (void)worker;
+
+    /* a seed-compressed first share is only expanded to compute the second */
+    if (job->share1 == NULL) {
+        implicit = (uint32_t *)malloc(job->cols * sizeof(uint32_t));
+        assert(implicit);
+    }
+
+    for (int r = first; r < last; r++) {
+        const int32_t *x = job->x + (size_t)r * job->x_stride;
+        uint32_t *share1 = implicit != NULL ? implicit : (uint32_t *)(job->share1 + (size_t)r * job->share1_stride);
+        int32_t *share2 = job->share2 + (size_t)r * job->share2_stride;
+
+        prg_words(job->prg, job->stream, (uint64_t)r * job->cols, share1, job->cols);
+        for (int c = 0; c < job->cols; c++)
+            share2[c] = (int32_t)((uint32_t)x[c] - share1[c]);
+    }
+
+    free(implicit);
+}
+
+/* splits the rows x cols matrix x (rows of x_stride elements) into two
+ * shares using the given stream of the PRG; share1 may be NULL when the
+ * first share is left implicit in the PRG seed (seed-compressed shares) */
+void ring_share(thpool_t pool, const prg_t prg, uint64_t stream, const int32_t *x, size_t x_stride,
+                int32_t *share1, size_t share1_stride, int32_t *share2, size_t share2_stride, int rows,
+                int cols) {
+    struct ring_share_job_struct job = {prg, stream, x, x_stride, share1, share2,
+                                        share1_stride, share2_stride, rows, cols};
+    assert(prg && x && share2);
+    thpool_run(pool, ring_share_task, &job, (rows + SHARE_TASK_ROWS - 1) / SHARE_TASK_ROWS);
+}
+
+/* x = share1 + share2 (mod 2^32) */
+void ring_reconstruct(const int32_t *share1, const int32_t *share2, int32_t *x, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        x[i] = (int32_t)((uint32_t)share1[i] + (uint32_t)share2[i]);
+}
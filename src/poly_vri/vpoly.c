@@ -1,20 +1,22 @@
+#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <../prf/acef.h>
 #include <lib-2k-prs.h>
 #include <../demo.h>
 
-uint8_t* get_delta(uint8_t* key, mpz_t input)
+static __thread prf_buffer_t delta_input;
+
+// delta holds SEC_PARAM bytes
+void get_delta(uint8_t* delta, uint8_t* key, mpz_t input)
 {
-    uint8_t* delta = (uint8_t*)malloc(sizeof(uint8_t) * SEC_PARAM);
     size_t input_size;
     size_t byte_count = (mpz_sizeinbase(input, 2) + 7) / 8;
-    uint8_t* input_bytes = (uint8_t*)malloc(sizeof(uint8_t) * byte_count);
+    uint8_t* input_bytes = prf_buffer_reserve(&delta_input, byte_count);
+    assert(input_bytes);
     mpz_export(input_bytes, &input_size, 1, sizeof(uint8_t), 0, 0, input);
 
     hmac(delta, input_bytes, input_size, key);
-
-    free(input_bytes);
-    return delta;
 }
 
 void prob_gen(uint8_t* delta, uint8_t* k1_byte, uint8_t* k2_byte, mpz_t sigma, mpz_t alpha, mpz_t g, mpz_t n_prime, mpz_t r, mpz_t c)
@@ -30,7 +32,7 @@ void prob_gen(uint8_t* delta, uint8_t* k1_byte, uint8_t* k2_byte, mpz_t sigma, m
     return;
 }
 
-void verify(mpz_t c, mpz_t sigma, mpz_t r, mpz_t alpha, mpz_t a, mpz_t y, prs_ciphertext_t ct)
+bool verify(mpz_t c, mpz_t sigma, mpz_t r, mpz_t alpha, mpz_t a, mpz_t y, prs_ciphertext_t ct)
 {
     mpz_t temp1, temp2, alpha_prime;
     mpz_inits(temp1, temp2, alpha_prime, NULL);
@@ -48,7 +50,8 @@ void verify(mpz_t c, mpz_t sigma, mpz_t r, mpz_t alpha, mpz_t a, mpz_t y, prs_ci
     mpz_mul(temp1, temp1, temp2);
     mpz_mod(temp1, temp1, N);
 
-    if(mpz_cmp(temp1, sigma) == 0)
+    bool passed = mpz_cmp(temp1, sigma) == 0;
+    if(passed)
     {
         //gmp_printf("Verification value: %Zd\n\n", sigma);
         //printf("passes verification!\n\n");
@@ -61,5 +64,5 @@ void verify(mpz_t c, mpz_t sigma, mpz_t r, mpz_t alpha, mpz_t a, mpz_t y, prs_ci
     //total_time += get_time_elapsed(start, end);
 
     mpz_clears(temp1, temp2, alpha_prime, NULL);
-    return;
+    return passed;
 }
\ No newline at end of file
@@ -1,27 +1,17 @@
+#include <assert.h>
 #include <stdint.h>
 #include <gmp.h>
 #include <relic/relic.h>
 #include <relic/relic_md.h>
 #include <../demo.h>
+#include "acef.h"
 
-#define BLOCK_SIZE 64
-#define HASH_LEN 32
-#define SEC_PARAM 32
-
-uint8_t* generate_seed(gmp_randstate_t prng, mpz_t seed)
+// the key is drawn as bytes and seed is their big-endian value
+uint8_t* generate_seed(prg_stream_t rng, mpz_t seed)
 {
-    //gettimeofday(&start, NULL);
-    mpz_urandomb(seed, prng, BLOCK_SIZE * 8);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
     uint8_t *bytes = (uint8_t *)malloc(sizeof(uint8_t) * BLOCK_SIZE);
-    size_t count;
-    mpz_export(bytes, &count, 1, sizeof(uint8_t), 0, 0, seed);
-    if (count < BLOCK_SIZE)
-    {
-        memmove(bytes + (BLOCK_SIZE - count), bytes, count);
-        memset(bytes, 0, BLOCK_SIZE - count);
-    }
+    prg_stream_bytes(rng, bytes, BLOCK_SIZE);
+    mpz_import(seed, BLOCK_SIZE, 1, sizeof(uint8_t), 0, 0, bytes);
     return bytes;
 }
 
@@ -41,14 +31,32 @@ void concatenate(uint8_t *out, int size_out, uint8_t *in1, int size1, uint8_t *i
     return;
 }
 
+// the variable-sized scratch of hmac and f_prime, kept by each thread across calls
+static __thread prf_buffer_t hmac_input, expanded;
+
+uint8_t *prf_buffer_reserve(prf_buffer_t *buffer, size_t size)
+{
+    if (buffer->size < size)
+    {
+        uint8_t *data = (uint8_t *)realloc(buffer->data, size);
+        if (!data)
+        {
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->size = size;
+    }
+    return buffer->data;
+}
+
 void hmac(uint8_t *output, uint8_t *input, int input_size, uint8_t *key)
 {
     //if (core_init() != RLC_OK)
     //
     //    return;
     //}
-    uint8_t *k_o = malloc(sizeof(uint8_t) * BLOCK_SIZE);
-    uint8_t *k_i = malloc(sizeof(uint8_t) * BLOCK_SIZE);
+    uint8_t k_o[BLOCK_SIZE];
+    uint8_t k_i[BLOCK_SIZE];
     uint8_t opad = (uint8_t)0x5c;
     uint8_t ipad = (uint8_t)0x36;
 
@@ -61,8 +69,9 @@ void hmac(uint8_t *output, uint8_t *input, int input_size, uint8_t *key)
     //gettimeofday(&end, NULL);
     //total_time += get_time_elapsed(start, end);
 
-    uint8_t *inner_input = malloc(sizeof(uint8_t) * (input_size + BLOCK_SIZE));
-    uint8_t *outer_input = malloc(sizeof(uint8_t) * (HASH_LEN + BLOCK_SIZE));
+    uint8_t *inner_input = prf_buffer_reserve(&hmac_input, input_size + BLOCK_SIZE);
+    uint8_t outer_input[HASH_LEN + BLOCK_SIZE];
+    assert(inner_input);
     //gettimeofday(&start, NULL);
     concatenate(inner_input, input_size + BLOCK_SIZE, k_i, BLOCK_SIZE, input, input_size);
     //core_init();
@@ -74,9 +83,6 @@ void hmac(uint8_t *output, uint8_t *input, int input_size, uint8_t *key)
     //core_clean();
     //gettimeofday(&end, NULL);
     //total_time += get_time_elapsed(start, end);
-
-    free(k_o);
-    free(k_i);
     return;
 }
 
@@ -87,8 +93,8 @@ void expand(uint8_t *output, uint8_t *input, int byte_number)
     int over_byte = byte_number % HASH_LEN;
     //gettimeofday(&end, NULL);
     //total_time += get_time_elapsed(start, end);
-    uint8_t *hashed_in = malloc(sizeof(uint8_t) * HASH_LEN);
-    uint8_t *conc_in = malloc(sizeof(uint8_t) * (HASH_LEN + 1));
+    uint8_t hashed_in[HASH_LEN];
+    uint8_t conc_in[HASH_LEN + 1];
 
     for (int i = 0; i < HASH_LEN; ++i)
     {
@@ -121,37 +127,31 @@ void expand(uint8_t *output, uint8_t *input, int byte_number)
             output[hash_num * HASH_LEN + j] = hashed_in[j];
         }
     }
-
-    free(hashed_in);
-    free(conc_in);
     return;
 }
 
 void f_prime(uint8_t *key, uint8_t *input, int input_size, mpz_t output, mpz_t n_prime)
 {
-    uint8_t *hash_msg = (uint8_t*)malloc(sizeof(uint8_t) * HASH_LEN);
+    uint8_t hash_msg[HASH_LEN];
     hmac(hash_msg, input, input_size, key);
 
     size_t bit_size = mpz_sizeinbase(n_prime, 2); //p'q'
     int exp_len = bit_size + (int)(bit_size / 2);
     int byte_size = exp_len / 8 + 1 * (exp_len % 8 != 0);
-    uint8_t *exp_msg = (uint8_t*)malloc(sizeof(uint8_t) * byte_size);
+    uint8_t *exp_msg = prf_buffer_reserve(&expanded, byte_size);
+    assert(exp_msg);
     expand(exp_msg, hash_msg, byte_size);
     mpz_import(output, byte_size, 1, sizeof(uint8_t), 0, 0, exp_msg);
     //gettimeofday(&start, NULL);
     mpz_mod(output, output, n_prime);
     //gettimeofday(&end, NULL);
     //total_time += get_time_elapsed(start, end);
-
-    free(hash_msg);
-    free(exp_msg);
     return;
 }
 
 void f(uint8_t* delta, int index, uint8_t* k1_byte, uint8_t* k2_byte, mpz_t output, mpz_t g, mpz_t n_prime)
 {
-    uint8_t* index_bytes = (uint8_t*)malloc(sizeof(uint8_t) * 1);
-    index_bytes[0] = (uint8_t)index;
+    uint8_t index_bytes[1] = {(uint8_t)index};
     mpz_t b, v, mul;
     mpz_inits(b, v, mul, NULL);
 
@@ -165,7 +165,6 @@ void f(uint8_t* delta, int index, uint8_t* k1_byte, uint8_t* k2_byte, mpz_t outp
     //gettimeofday(&end, NULL);
     //total_time += get_time_elapsed(start, end);
 
-    free(index_bytes);
     mpz_clears(b, v, mul, NULL);
     return;
 }
\ No newline at end of file
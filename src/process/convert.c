@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <lib-freivalds.h>
+#include <lib-igemm.h>
+#include <lib-model.h>
+#include <lib-qgemm.h>
+
+#define DEFAULT_INPUT "/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt"
+#define DEFAULT_OUTPUT "/home/ashlynsun/vhss-to-fnn/data/model_parameters.bin"
+
+// the weights x100 of the secure path, rounded exactly as qmatrix_quantize does
+int16_t *quantize_s16(const struct model_layer_struct *layer)
+{
+    qmatrix_t q;
+    int16_t *weight = (int16_t *)malloc((size_t)layer->rows * layer->cols * sizeof(int16_t));
+    if (!weight || qmatrix_init(q, layer->rows, layer->cols) < 0)
+    {
+        free(weight);
+        return NULL;
+    }
+    qmatrix_quantize(q, layer->weight, LINEAR_WEIGHT_SCALE);
+    for (int i = 0; i < layer->rows; i++)
+    {
+        memcpy(weight + (size_t)i * layer->cols, q->data + (size_t)i * q->ld, layer->cols * sizeof(int16_t));
+    }
+    qmatrix_clear(q);
+    return weight;
+}
+
+// per-row int8 weights, rounded exactly as imatrix_quantize does
+int quantize_s8(const struct model_layer_struct *layer, int8_t **weight, float **scale)
+{
+    size_t ld = igemm_ld(layer->cols);
+    int8_t *row = (int8_t *)malloc(ld);
+    *weight = (int8_t *)malloc((size_t)layer->rows * layer->cols);
+    *scale = (float *)malloc(layer->rows * sizeof(float));
+    if (!row || !*weight || !*scale)
+    {
+        free(row);
+        return -1;
+    }
+    for (int i = 0; i < layer->rows; i++)
+    {
+        const float *values = layer->weight + (size_t)i * layer->cols;
+        (*scale)[i] = igemm_scale(values, 0, layer->cols, 1);
+        igemm_quantize(values, 0, layer->cols, (*scale)[i], row, ld, 1);
+        memcpy(*weight + (size_t)i * layer->cols, row, layer->cols);
+    }
+    free(row);
+    return 0;
+}
+
+// converts model_parameters.txt to the binary container read in place by the drivers
+int main(int argc, char *argv[])
+{
+    const char *input = argc > 1 ? argv[1] : DEFAULT_INPUT;
+    const char *output = argc > 2 ? argv[2] : DEFAULT_OUTPUT;
+
+    model_t model;
+    if (model_read(model, input) < 0)
+    {
+        printf("Failed to read model parameters from %s\n", input);
+        return 1;
+    }
+
+    if (model->map != NULL)
+    {
+        printf("Error: %s already is a binary model\n", input);
+        model_clear(model);
+        return 1;
+    }
+
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        struct model_layer_struct *layer = &model->layers[l];
+        int8_t *weight_s8 = NULL;
+        float *scale_s8 = NULL;
+        layer->weight_s16 = quantize_s16(layer);
+        layer->scale_s16 = LINEAR_WEIGHT_SCALE;
+        int status = quantize_s8(layer, &weight_s8, &scale_s8);
+        layer->weight_s8 = weight_s8;
+        layer->scale_s8 = scale_s8;
+        if (!layer->weight_s16 || status < 0)
+        {
+            printf("Error: Weight memory allocation failure\n");
+            return 1;
+        }
+        printf("Layer %d: %d x %d, with int16 and int8 weights\n", l + 1, layer->rows, layer->cols);
+    }
+
+    if (model_write(model, output) < 0)
+    {
+        printf("Failed to write %s\n", output);
+        model_clear(model);
+        return 1;
+    }
+    printf("Wrote %s\n", output);
+
+    model_clear(model);
+    return 0;
+}
@@ -9,389 +9,157 @@
 #include "../poly_vri/fri.h"
 #include "../prf/acef.h"
 #include "../poly_vri/vpoly.h"
-#include <sys/time.h>
+#include <lib-arena.h>
+#include <lib-idx.h>
+#include <lib-memstat.h>
+#include <lib-model.h>
+#include <lib-profile.h>
+#include <lib-thpool.h>
+#include <lib-secure.h>
+#include <lib-share.h>
+#include <lib-stream.h>
+#include <lib-veri-pipeline.h>
 
 #define INITIAL_IMAGE_SIZE 784 // 28*28 pixels
-#define MAX_LINE_LENGTH 4096
-#define MAX_IMAGES 10000
-#define WEIGHT1_ROWS 512
-#define WEIGHT1_COLS 784
-#define WEIGHT2_ROWS 512
-#define WEIGHT2_COLS 512
-#define WEIGHT3_COLS 512
-#define WEIGHT3_ROWS 10
-
-struct timeval start, end;
-double total_time = 0.0;
-
-// all mnist data is stored in this struct
+#define VERIFIER_THREADS 2
+#define VERIFIER_QUEUE_CAPACITY 1024
+#define SEED_COMPRESSED_SHARES true // server 1 gets a PRG seed instead of its input shares
+
+// snapshot of one linear layer queued for verification, one image per row
 typedef struct
 {
-    float (*data)[MAX_IMAGES]; // pointer to a two-dimensional array
-    int (*temp)[MAX_IMAGES];
-    int (*result_data)[MAX_IMAGES];
+    struct linear_veri_key_struct *key;
     int num_images;
-    int image_size; // pixels per image
-} MNISTData;
-
-double get_time_elapsed(struct timeval start, struct timeval end)
-{
-    return ((end.tv_sec - start.tv_sec) * 1000000u + end.tv_usec - start.tv_usec) / 1.e6;
-}
+    int *input;  // num_images x key->cols quantized inputs
+    int *output; // num_images x key->rows reconstructed outputs
+} LinearVeriRecord;
 
-void skip_header(FILE *file)
+bool linear_veri_check(void *data)
 {
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, sizeof(line), file))
+    LinearVeriRecord *record = (LinearVeriRecord *)data;
+    bool passed = true;
+    profile_begin(phase_verify);
+    for (int img = 0; passed && img < record->num_images; img++)
     {
-        if (line[0] != '#')
+        if (!linear_veri_key_check(record->key, record->input + img * record->key->cols, 1,
+                                   record->output + img * record->key->rows, 1))
         {
-            fseek(file, -strlen(line), SEEK_CUR); // Go back to the beginning of the line
-            break;
+            printf("False at image %d\n", img);
+            passed = false;
         }
     }
+    profile_end(phase_verify);
+    return passed;
 }
 
-MNISTData *read_mnist_images(const char *filename)
+void linear_veri_release(void *data)
 {
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the file %s\n", filename);
-        return NULL;
-    }
-
-    MNISTData *mnist = (MNISTData *)malloc(sizeof(MNISTData));
-    if (!mnist)
-    {
-        printf("Error: Memory allocation failure\n");
-        fclose(file);
-        return NULL;
-    }
-
-    mnist->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
-    mnist->num_images = 0;
-    mnist->data = (float(*)[MAX_IMAGES])malloc(INITIAL_IMAGE_SIZE * MAX_IMAGES * sizeof(float));
-    mnist->temp = (int(*)[MAX_IMAGES])malloc(INITIAL_IMAGE_SIZE * MAX_IMAGES * sizeof(int));
-    mnist->result_data = (int(*)[MAX_IMAGES])malloc(INITIAL_IMAGE_SIZE * MAX_IMAGES * sizeof(int));
-    if (!mnist->data)
-    {
-        printf("Error: Image data memory allocation failure\n");
-        free(mnist);
-        fclose(file);
-        return NULL;
-    }
-
-    skip_header(file); // change the position of file pointer to the beginning of the image data
-
-    char line[MAX_LINE_LENGTH]; // 4096
-    int image_index = 0;
-    char *token;
-
-    while (fgets(line, sizeof(line), file) && image_index < MAX_IMAGES)
-    {
-        token = strtok(line, " \n");
-        int pixel_index = 0;
-
-        while (token != NULL && pixel_index < INITIAL_IMAGE_SIZE)
-        {
-            mnist->data[pixel_index][image_index] = atof(token);
-            token = strtok(NULL, " \n");
-            pixel_index++;
-        }
-
-        if (pixel_index == INITIAL_IMAGE_SIZE)
-        {
-            image_index++;
-        }
-    }
-
-    mnist->num_images = image_index;
-    fclose(file);
-
-    // If the actual number of images is less than MAX_IMAGES, readjust the memory size
-    if (mnist->num_images < MAX_IMAGES)
-    {
-        float(*temp)[MAX_IMAGES] = (float(*)[MAX_IMAGES])realloc(mnist->data,
-                                                                 mnist->num_images * INITIAL_IMAGE_SIZE * sizeof(float));
-        if (temp)
-        {
-            mnist->data = temp;
-        }
-    }
-
-    return mnist;
+    LinearVeriRecord *record = (LinearVeriRecord *)data;
+    free(record->input);
+    free(record->output);
+    free(record);
 }
 
-void free_mnist_data(MNISTData *mnist)
+// copies the layer inputs and outputs so that inference can move on while the check runs
+void linear_veri_submit(veri_pipeline_t pipeline, int layer, MNISTData *input_data, linear_veri_key_t key)
 {
-    if (mnist)
+    LinearVeriRecord *record = (LinearVeriRecord *)malloc(sizeof(LinearVeriRecord));
+    record->key = key;
+    record->num_images = input_data->num_images;
+    record->input = (int *)malloc(input_data->num_images * key->cols * sizeof(int));
+    record->output = (int *)malloc(input_data->num_images * key->rows * sizeof(int));
+    for (int img = 0; img < input_data->num_images; img++)
     {
-        free(mnist->data);
-        free(mnist->result_data);
-        free(mnist);
+        memcpy(record->input + img * key->cols, tensor_s32(input_data->temp, img), key->cols * sizeof(int));
+        memcpy(record->output + img * key->rows, tensor_s32(input_data->result_data, img), key->rows * sizeof(int));
     }
+    veri_pipeline_submit(pipeline, layer, linear_veri_check, linear_veri_release, record);
 }
 
-void read_weight(const char *filename, int weight_rows, int weight_cols, float (*weight)[weight_cols], int weight_index)
+// snapshot of one server's HSS evaluation queued for verification
+typedef struct HSSVeriRecord
 {
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    int row = 0, col = 0;
-    int weight_found = 0;
-    char weight_header[32];
-
-    snprintf(weight_header, sizeof(weight_header), "Shape of weight %d:", weight_index);
-
-    while (fgets(line, sizeof(line), file))
-    {
-        if (strstr(line, weight_header) != NULL)
-        {
-            weight_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
-        }
-
-        if (weight_found)
-        {
-            char *token = strtok(line, " \n");
-            while (token != NULL)
-            {
-                if (row < weight_rows && col < weight_cols)
-                {
-                    weight[row][col] = atof(token);
-                    col++;
-                    if (col == weight_cols)
-                    {
-                        col = 0;
-                        row++;
-                        break;
-                    }
-                }
-                token = strtok(NULL, " \n");
-            }
-            if (row == weight_rows)
-            {
-                break;
-            }
-        }
-    }
+    mpz_t c, sigma, r, a;
+    prs_ciphertext_t ct;
+    mpz_ptr alpha, y; // shared for the whole run
+    struct HSSVeriRecord *next; // in the spare list once checked
+} HSSVeriRecord;
 
-    fclose(file);
-}
+// checked records keep their limbs and are filled again by the next submissions
+static HSSVeriRecord *spare_records = NULL;
+static pthread_mutex_t spare_records_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void read_bias(const char *filename, float *bias, int bias_size, int bias_index)
+bool hss_veri_check(void *data)
 {
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    int index = 0;
-    int bias_found = 0;
-    char bias_header[32];
-
-    // Construct the weight identifier
-    snprintf(bias_header, sizeof(bias_header), "Shape of bia %d:", bias_index);
-
-    while (fgets(line, sizeof(line), file))
-    {
-        if (strstr(line, bias_header) != NULL)
-        {
-            bias_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
-        }
-
-        if (bias_found)
-        {
-            char *token = strtok(line, " \n");
-            while (token != NULL && index < bias_size)
-            {
-                bias[index] = atof(token);
-                index++;
-                token = strtok(NULL, " \n");
-            }
-            if (index == bias_size)
-            {
-                break;
-            }
-        }
-    }
-
-    fclose(file);
+    HSSVeriRecord *record = (HSSVeriRecord *)data;
+    bool passed;
+    profile_begin(phase_verify);
+    // the temporaries of verify live in the arena of the verifier thread
+    arena_scope(arena_local(), {
+        passed = verify(record->c, record->sigma, record->r, record->alpha, record->a, record->y, record->ct);
+    });
+    profile_end(phase_verify);
+    return passed;
 }
 
-int *read_labels(const char *filename)
+void hss_veri_release(void *data)
 {
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the labels file %s\n", filename);
-        return NULL;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    // skip
-    fgets(line, sizeof(line), file);
-    fgets(line, sizeof(line), file);
-    fgets(line, sizeof(line), file);
-
-    int *labels = (int *)malloc(MAX_IMAGES * sizeof(int));
-    if (!labels)
-    {
-        fclose(file);
-        return NULL;
-    }
-
-    int num_labels = 0;
-    while (fgets(line, sizeof(line), file) && num_labels < MAX_IMAGES)
-    {
-        if (strlen(line) > 0)
-        {
-            labels[num_labels] = atoi(line);
-            num_labels++;
-        }
-    }
-
-    fclose(file);
-    return labels;
+    HSSVeriRecord *record = (HSSVeriRecord *)data;
+    pthread_mutex_lock(&spare_records_lock);
+    record->next = spare_records;
+    spare_records = record;
+    pthread_mutex_unlock(&spare_records_lock);
 }
 
-void linear_split(MNISTData *original_data, MNISTData *share1, MNISTData *share2)
+void free_hss_veri_records(void)
 {
-    srand(time(NULL));
-    for (int i = 0; i < original_data->image_size; i++)
+    while (spare_records)
     {
-        for (int j = 0; j < original_data->num_images; j++)
-        {
-            int enlarged_value = (int)roundf(original_data->data[i][j] * 100);
-            gettimeofday(&start, NULL);
-            share1->temp[i][j] = rand() % (2 * abs(enlarged_value) + 1) - abs(enlarged_value);
-            share2->temp[i][j] = enlarged_value - share1->temp[i][j];
-            gettimeofday(&end, NULL);
-            total_time += get_time_elapsed(start, end);
-        }
+        HSSVeriRecord *record = spare_records;
+        spare_records = record->next;
+        mpz_clears(record->c, record->sigma, record->r, record->a, NULL);
+        prs_ciphertext_clear(record->ct);
+        free(record);
     }
-
-    share1->image_size = original_data->image_size, share1->num_images = original_data->num_images;
-    share2->image_size = original_data->image_size, share2->num_images = original_data->num_images;
-
-    return;
 }
 
-void bia_split(float *bias, int bias_size, float *share1, float *share2)
+void hss_veri_submit(veri_pipeline_t pipeline, int layer, mpz_t c, mpz_t sigma, mpz_t r, mpz_t alpha, mpz_t a, mpz_t y, prs_ciphertext_t ct)
 {
-    srand(time(NULL));
-    for (int i = 0; i < bias_size; i++)
+    pthread_mutex_lock(&spare_records_lock);
+    HSSVeriRecord *record = spare_records;
+    if (record)
     {
-        gettimeofday(&start, NULL);
-        float random_factor = ((float)rand() / (float)RAND_MAX * 2 - 1);
-        share1[i] = roundf((random_factor * bias[i]) * 10000) / 10000;
-        share2[i] = roundf((bias[i] - share1[i]) * 10000) / 10000;
-        gettimeofday(&end, NULL);
-        total_time += get_time_elapsed(start, end);
+        spare_records = record->next;
     }
+    pthread_mutex_unlock(&spare_records_lock);
 
-    return;
-}
-
-void linear_evaluate(MNISTData *input_data, int weight_rows, int weight_cols, float (*weight)[weight_cols], float *bias)
-{
-    for (int img = 0; img < input_data->num_images; img++)
-    {
-        for (int i = 0; i < weight_rows; i++)
+    // the record outlives the neuron and is read by another thread: its limbs must come from the heap
+    arena_heap({
+        if (!record)
         {
-            input_data->result_data[i][img] = (int)roundf(bias[i] * 10000);
-            for (int j = 0; j < weight_cols; j++)
-            {
-                input_data->result_data[i][img] += (int)roundf(weight[i][j] * 100) * input_data->temp[j][img];
-            }
+            record = (HSSVeriRecord *)malloc(sizeof(HSSVeriRecord));
+            mpz_inits(record->c, record->sigma, record->r, record->a, NULL);
+            prs_ciphertext_init(record->ct);
         }
-    }
-    input_data->image_size = weight_rows;
-    return;
+        mpz_set(record->c, c);
+        mpz_set(record->sigma, sigma);
+        mpz_set(record->r, r);
+        mpz_set(record->a, a);
+        mpz_set(record->ct->c, ct->c);
+    });
+    record->alpha = alpha;
+    record->y = y;
+    veri_pipeline_submit(pipeline, layer, hss_veri_check, hss_veri_release, record);
 }
 
-bool linear_veri(MNISTData *input_data, int weight_rows, int weight_cols, float (*weight)[weight_cols], float *bias)
+// true once any queued check failed: the speculative run is then abandoned
+bool inference_aborted(veri_pipeline_t pipeline)
 {
-    int r = 1;
-    int *x = (int *)malloc(input_data->num_images * sizeof(int));
-    int *true_output = (int *)malloc(weight_rows * sizeof(int));
-    int *real_output = (int *)malloc(weight_rows * sizeof(int));
-
-    if (!x || !true_output || !real_output)
+    if (!veri_pipeline_failed(pipeline))
     {
-        printf("Memory allocation failed\n");
-        free(x);
-        free(true_output);
-        free(real_output);
         return false;
     }
-
-    x[0] = 1;
-    for (int i = 1; i < input_data->num_images; i++)
-    {
-        x[i] = x[i - 1] * r;
-    }
-
-    for (int i = 0; i < weight_rows; i++)
-    {
-        true_output[i] = 0, real_output[i] = 0;
-        //gettimeofday(&start, NULL);
-        for (int k = 0; k < input_data->num_images; k++)
-        {
-            true_output[i] += (int)roundf(bias[i] * 10000) * x[k];
-        }
-        for (int k = 0; k < input_data->num_images; k++)
-        {
-            real_output[i] += input_data->result_data[i][k] * x[k];
-        }
-        //gettimeofday(&end, NULL);
-        //total_time += get_time_elapsed(start, end);
-
-        for (int k = 0; k < weight_cols; k++)
-        {
-            int temp = 0;
-            //gettimeofday(&start, NULL);
-            for (int j = 0; j < input_data->num_images; j++)
-            {
-                temp += (int)roundf(input_data->data[k][j] * 100) * x[j];
-            }
-            true_output[i] += (int)roundf(weight[i][k] * 100) * temp;
-            //gettimeofday(&end, NULL);
-            //total_time += get_time_elapsed(start, end);
-        }
-    }
-
-    //gettimeofday(&start, NULL);
-    for (int i = 0; i < weight_rows; i++)
-    {
-        if (true_output[i] != real_output[i])
-        {
-            printf("False at %d\n", i);
-            printf("True: %d, Real: %d\n", true_output[i], real_output[i]);
-            free(x);
-            free(true_output);
-            free(real_output);
-            return false;
-        }
-    }
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
-
-    free(x);
-    free(true_output);
-    free(real_output);
+    printf("Verification at layer %d failed, inference aborted\n", pipeline->failed_layer);
     return true;
 }
 
@@ -411,7 +179,7 @@ bool poly_veri(mpz_t input, mpz_t output, int *coefficient, int *degree)
     free(precode);
 }
 
-int process_rounded_val(float rounded_val, prs_keys_t *keys, uint8_t *k1, uint8_t *k2, mpz_t alpha)
+int process_rounded_val(float rounded_val, prs_keys_t *keys, uint8_t *k1, uint8_t *k2, mpz_t alpha, veri_pipeline_t pipeline, int layer)
 {
     if (rounded_val == 0.0f || rounded_val == -0.0f)
     {
@@ -443,13 +211,12 @@ int process_rounded_val(float rounded_val, prs_keys_t *keys, uint8_t *k1, uint8_
     mpz_set_si(input->m, (int)roundf(rounded_val * 100));
 
     // Sharing
-    gettimeofday(&start, NULL);
+    profile_begin(phase_share);
     share(input, keys[0]->y, enc_share, ss);
-    gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
+    profile_end(phase_share);
 
     // evaluation
-    mpz_inits(co_1, co_2, NULL);
+    profile_begin(phase_hss_evaluate);
     for (int i = 0; i < server_number; i++)
     {
         for (int j = 0; j < server_number; j++)
@@ -460,11 +227,11 @@ int process_rounded_val(float rounded_val, prs_keys_t *keys, uint8_t *k1, uint8_
             }
         }
         mpz_set(eval_parts[i], enc_share[i]->c);
-        //gettimeofday(&start, NULL);
-        uint8_t* delta = get_delta(k1, ss[i]->m);
+        profile_begin(phase_prob_gen);
+        uint8_t delta[SEC_PARAM];
+        get_delta(delta, k1, ss[i]->m);
         prob_gen(delta, k1, k2, sigma_1, alpha, keys[0]->g, keys[0]->n_prime, r, eval_parts[i]);
-        //gettimeofday(&end, NULL);
-        //total_time += get_time_elapsed(start, end);
+        profile_end(phase_prob_gen);
         mpz_powm_ui(co_2, eval_parts[1 - i], 2, k_2); // co_2 = eval_parts[1-i]^2 mod k_2
         mpz_mul_ui(co_1, eval_parts[1 - i], 50);      // co_1 = 50 * eval_parts[1-i]
         mpz_add(co_2, co_2, co_1);                    // co_2 = co_2 + co_1
@@ -473,24 +240,20 @@ int process_rounded_val(float rounded_val, prs_keys_t *keys, uint8_t *k1, uint8_
         mpz_add_ui(co_1, co_1, 50);
         mpz_mod(co_1, co_1, k_2);
         mpz_set(pt->m, co_2);
-        prs_encrypt(ct, MESSAGE_BITS, keys[0]->y, N, k_2, pt, prng, 48);
+        prs_encrypt(ct, MESSAGE_BITS, keys[0]->y, N, k_2, pt, prg_local(), 48);
         mpz_set_ui(sigma->c, 1);
         evaluate(s[i], eval_parts[i], ct);
         evaluate(sigma, sigma_1, ct);
-        //gettimeofday(&start, NULL);
-        verify(s[i]->c, sigma->c, r, alpha, co_1, keys[0]->y, ct);
-        //gettimeofday(&end, NULL);
-        //total_time += get_time_elapsed(start, end);
-        free(delta);
+        hss_veri_submit(pipeline, layer, s[i]->c, sigma->c, r, alpha, co_1, keys[0]->y, ct);
     }
+    profile_end(phase_hss_evaluate);
 
     // decode
     prs_plaintext_t dec_res;
     prs_plaintext_init(dec_res);
-    gettimeofday(&start, NULL);
+    profile_begin(phase_decode);
     decode(s, keys[0]->p, keys[0]->d, dec_res);
-    gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
+    profile_end(phase_decode);
     if (mpz_cmp_si(dec_res->m, 20000) > 0)
     {
         mpz_sub(dec_res->m, dec_res->m, keys[0]->k_2);
@@ -516,12 +279,9 @@ int process_rounded_val(float rounded_val, prs_keys_t *keys, uint8_t *k1, uint8_
 void get_phi(mpz_t p, mpz_t q, mpz_t phi){
     mpz_t p_1, q_1;
     mpz_inits(p_1, q_1, NULL);
-    //gettimeofday(&start, NULL);
     mpz_sub_ui(p_1, p, 1);
     mpz_sub_ui(q_1, q, 1);
     mpz_mul(phi, p_1, q_1);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
     mpz_clears(p_1, q_1, NULL);
     return;
 }
@@ -531,15 +291,12 @@ void get_random_star(mpz_t N, mpz_t alpha)
     mpz_t gcd;
     mpz_init(gcd);
 
-    //gettimeofday(&start, NULL);
     do
     {
         mpz_urandomm(alpha, prng, N); // [0,N-1]
         mpz_add_ui(alpha, alpha, 1); // [1,N]
         mpz_gcd(gcd, alpha, N);
     } while (mpz_cmp_ui(gcd, 1) != 0);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
 
     mpz_clear(gcd);
     return;
@@ -547,6 +304,10 @@ void get_random_star(mpz_t N, mpz_t alpha)
 
 int main()
 {
+    profile_init(thpool_default_threads());
+    // GMP allocates from the arena of the neuron being processed, from the heap elsewhere
+    arena_gmp_install();
+    memstat_gmp_install();
     gmp_randinit_default(prng);                // prng means its state & init
     gmp_randseed_os_rng(prng, prng_sec_level); // seed setting
 
@@ -554,229 +315,256 @@ int main()
     prs_keys_t *keys = (prs_keys_t *)malloc(sizeof(prs_keys_t));
     prs_keys_init(keys);
 
-    gettimeofday(&start, NULL);
+    profile_begin(phase_keygen);
     prs_generate_keys(keys, MESSAGE_BITS, DEFAULT_MOD_BITS, prng);
-    gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
     mpz_inits(N, k_2, NULL);
     mpz_set(N, keys[0]->n);
     mpz_set(k_2, keys[0]->k_2);
+    // reused by every neuron; sized up front so that their limbs never come from a neuron's arena
+    mpz_init2(co_1, 2 * DEFAULT_MOD_BITS);
+    mpz_init2(co_2, 2 * DEFAULT_MOD_BITS);
 
     mpz_t k1, k2;
     mpz_inits(k1, k2, NULL);
-    //gettimeofday(&start, NULL);
-    uint8_t* k1_bytes = generate_seed(prng, k1);
-    uint8_t* k2_bytes = generate_seed(prng, k2);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
+    uint8_t* k1_bytes = generate_seed(prg_local(), k1);
+    uint8_t* k2_bytes = generate_seed(prg_local(), k2);
 
     mpz_t alpha, phi_N;
     mpz_inits(alpha, phi_N, NULL);
-    //gettimeofday(&start, NULL);
     get_phi(keys[0]->p, keys[0]->q, phi_N);
     get_random_star(phi_N, alpha);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
+    profile_end(phase_keygen);
 
-    MNISTData *mnist = read_mnist_images("/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt");
-    if (!mnist)
+    model_t model;
+    if (model_read(model, model_default_path("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt")) < 0)
     {
-        printf("Failed to read MNIST data\n");
+        printf("Failed to read model parameters\n");
         return 1;
     }
-    mnist->num_images = 1;
-
-    float weight1[WEIGHT1_ROWS][WEIGHT1_COLS];
-    float bia1[WEIGHT1_ROWS], bia1_1[WEIGHT1_ROWS], bia1_2[WEIGHT1_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT1_ROWS, WEIGHT1_COLS, weight1, 1);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia1, WEIGHT1_ROWS, 1);
-
-    float weight2[WEIGHT2_ROWS][WEIGHT2_COLS];
-    float bia2[WEIGHT2_ROWS], bia2_1[WEIGHT2_ROWS], bia2_2[WEIGHT2_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT2_ROWS, WEIGHT2_COLS, weight2, 2);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia2, WEIGHT2_ROWS, 2);
-
-    float weight3[WEIGHT3_ROWS][WEIGHT3_COLS];
-    float bia3[WEIGHT3_ROWS], bia3_1[WEIGHT3_ROWS], bia3_2[WEIGHT3_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT3_ROWS, WEIGHT3_COLS, weight3, 3);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia3, WEIGHT3_ROWS, 3);
-
-    MNISTData *linear_data_1 = (MNISTData *)malloc(sizeof(MNISTData));
-    linear_data_1->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
-    linear_data_1->num_images = mnist->num_images;
-    linear_data_1->data = (float(*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(float));
-    linear_data_1->temp = (int(*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-    linear_data_1->result_data = (int(*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-
-    MNISTData *linear_data_2 = (MNISTData *)malloc(sizeof(MNISTData));
-    linear_data_2->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
-    linear_data_2->num_images = mnist->num_images;
-    linear_data_2->data = (float(*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(float));
-    linear_data_2->temp = (int(*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-    linear_data_2->result_data = (int(*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-
-    //gettimeofday(&start, NULL);
-    linear_split(mnist, linear_data_1, linear_data_2);
-    bia_split(bia1, WEIGHT1_ROWS, bia1_1, bia1_2);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
-
-    linear_evaluate(linear_data_1, WEIGHT1_ROWS, WEIGHT1_COLS, weight1, bia1_1);
-    linear_evaluate(linear_data_2, WEIGHT1_ROWS, WEIGHT1_COLS, weight1, bia1_2);
-    gettimeofday(&start, NULL);
-    for (int img = 0; img < mnist->num_images; img++)
+    if (model_inputs(model) != INITIAL_IMAGE_SIZE)
     {
-        for (int i = 0; i < WEIGHT1_ROWS; i++)
-        {
-            mnist->result_data[i][img] = linear_data_1->result_data[i][img] + linear_data_2->result_data[i][img];
-        }
+        printf("Error: The model takes %d inputs, images have %d pixels\n", model_inputs(model), INITIAL_IMAGE_SIZE);
+        return 1;
     }
-    gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
-    if (!linear_veri(mnist, WEIGHT1_ROWS, WEIGHT1_COLS, weight1, bia1))
+    int width = model_max_width(model);
+
+    // every neuron is evaluated homomorphically, so a run takes a single batch:
+    // $VHSS_BATCH images, one if it is not set
+    int batch = image_stream_default_batch();
+    if (batch == 0)
     {
-        printf("Verification of first linear calculation failed\n");
-        return 1;
+        batch = 1;
     }
-    printf("Verification of first linear calculation passed\n\n");
-    mnist->image_size = WEIGHT1_ROWS;
-    for (int i = 0; i < mnist->image_size; i++)
+    MNISTData *mnist = NULL;
+    image_stream_t stream;
+    int count = -1;
+    if (image_stream_open(stream, idx_images_path("/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt"), INITIAL_IMAGE_SIZE, batch, batch) == 0)
     {
-        for (int j = 0; j < mnist->num_images; j++)
+        const float *images;
+        count = image_stream_next(stream, &images);
+        if (count > 0 && (mnist = create_mnist_data(count, INITIAL_IMAGE_SIZE, width, true, true)))
         {
-            printf("First: i = %d, j = %d\n\n", i, j);
-            gettimeofday(&start, NULL);
-            mnist->data[i][j] = (float)(mnist->result_data[i][j]) / 10000.0f;
-            float rounded_val = roundf(mnist->data[i][j] * 100) / 100; // Retain 2 decimals
-            gettimeofday(&end, NULL);
-            total_time += get_time_elapsed(start, end);
-            int processed_val = process_rounded_val(rounded_val, keys, k1_bytes, k2_bytes, alpha);
-            gettimeofday(&start, NULL);
-            if (processed_val == 0) {
-                mnist->data[i][j] = 0.0f;
-            } else {
-                mnist->data[i][j] = (float)processed_val / 10000.0f;
+            for (int img = 0; img < count; img++)
+            {
+                memcpy(tensor_f32(mnist->data, img), images + (size_t)img * INITIAL_IMAGE_SIZE,
+                       INITIAL_IMAGE_SIZE * sizeof(float));
             }
-            mnist->data[i][j] = roundf(mnist->data[i][j] * 100) / 100;
-            gettimeofday(&end, NULL);
-            total_time += get_time_elapsed(start, end);
         }
+        image_stream_close(stream);
+    }
+    if (count <= 0)
+    {
+        printf("Failed to read MNIST data\n");
+        return 1;
+    }
+    if (!mnist)
+    {
+        printf("Error: Memory allocation failure\n");
+        return 1;
     }
 
-    //gettimeofday(&start, NULL);
-    linear_split(mnist, linear_data_1, linear_data_2);
-    bia_split(bia2, WEIGHT2_ROWS, bia2_1, bia2_2);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
+    SecureLayer *layers = create_secure_layers(model);
+    if (!layers)
+    {
+        printf("Failed to prepare the secure layers\n");
+        return 1;
+    }
 
-    linear_evaluate(linear_data_1, WEIGHT2_ROWS, WEIGHT2_COLS, weight2, bia2_1);
-    linear_evaluate(linear_data_2, WEIGHT2_ROWS, WEIGHT2_COLS, weight2, bia2_2);
-    gettimeofday(&start, NULL);
-    for (int img = 0; img < mnist->num_images; img++)
+    // the share-side linear layers run on every core unless VHSS_THREADS says otherwise
+    thpool_t pool;
+    if (thpool_init(pool, thpool_default_threads()) < 0)
     {
-        for (int i = 0; i < WEIGHT2_ROWS; i++)
-        {
-            mnist->result_data[i][img] = linear_data_1->result_data[i][img] + linear_data_2->result_data[i][img];
-        }
+        printf("Failed to start the thread pool\n");
+        return 1;
     }
-    gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
 
-    if (!linear_veri(mnist, WEIGHT2_ROWS, WEIGHT2_COLS, weight2, bia2))
+    // the input shares of this run are drawn from a fresh ChaCha20 key, one stream per layer
+    prg_t share_prg;
+    uint8_t share_seed[PRG_SEED_BYTES];
+    if (prg_init_os(share_prg, share_seed) < 0)
     {
-        printf("Verification of second linear calculation failed\n");
+        printf("Failed to seed the share generator\n");
         return 1;
     }
-    printf("Verification of second linear calculation passed\n\n");
-    mnist->image_size = WEIGHT2_ROWS;
-    for (int i = 0; i < mnist->image_size; i++)
+
+    // checks run on their own workers while the next layer is being computed
+    veri_pipeline_t pipeline;
+    if (veri_pipeline_init(pipeline, VERIFIER_THREADS, VERIFIER_QUEUE_CAPACITY) < 0)
     {
-        for (int j = 0; j < mnist->num_images; j++)
-        {
-            printf("Second: i = %d, j = %d\n\n", i, j);
-            gettimeofday(&start, NULL);
-            mnist->data[i][j] = (float)(mnist->result_data[i][j]) / 10000.0f;
-            float rounded_val = roundf(mnist->data[i][j] * 100) / 100; // Retain 2 decimals
-            gettimeofday(&end, NULL);
-            total_time += get_time_elapsed(start, end);
-            int processed_val = process_rounded_val(rounded_val, keys, k1_bytes, k2_bytes, alpha);
-            gettimeofday(&start, NULL);
-            if (processed_val == 0)
-            {
-                mnist->data[i][j] = 0.0f;
-            }
-            else
-            {
-                mnist->data[i][j] = (float)processed_val / 10000.0f;
-            }
-            mnist->data[i][j] = roundf(mnist->data[i][j] * 100) / 100;
-            gettimeofday(&end, NULL);
-            total_time += get_time_elapsed(start, end);
-        }
+        printf("Failed to start the verification pipeline\n");
+        return 1;
     }
 
-    //gettimeofday(&start, NULL);
-    linear_split(mnist, linear_data_1, linear_data_2);
-    bia_split(bia3, WEIGHT3_ROWS, bia3_1, bia3_2);
-    //gettimeofday(&end, NULL);
-    //total_time += get_time_elapsed(start, end);
+    // the temporaries of the neuron being processed, rewound after each of them
+    arena_t arena;
+    arena_init(arena, ARENA_CHUNK_SIZE);
+    // memory left behind by a neuron once the run reached its steady state is a leak
+    leak_detector_t leaks;
+    leak_detector_init(leaks, LEAK_WARMUP);
 
-    linear_evaluate(linear_data_1, WEIGHT3_ROWS, WEIGHT3_COLS, weight3, bia3_1);
-    linear_evaluate(linear_data_2, WEIGHT3_ROWS, WEIGHT3_COLS, weight3, bia3_2);
-    gettimeofday(&start, NULL);
-    for (int img = 0; img < mnist->num_images; img++)
+    MNISTData *linear_data_1 = create_mnist_data(mnist->num_images, INITIAL_IMAGE_SIZE, width, false, !SEED_COMPRESSED_SHARES);
+
+    MNISTData *linear_data_2 = create_mnist_data(mnist->num_images, INITIAL_IMAGE_SIZE, width, false, true);
+    if (!linear_data_1 || !linear_data_2)
     {
-        for (int i = 0; i < WEIGHT3_ROWS; i++)
-        {
-            mnist->result_data[i][img] = linear_data_1->result_data[i][img] + linear_data_2->result_data[i][img];
-        }
+        printf("Error: Memory allocation failure\n");
+        return 1;
     }
-    gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
-    if (!linear_veri(mnist, WEIGHT3_ROWS, WEIGHT3_COLS, weight3, bia3))
+    if (SEED_COMPRESSED_SHARES)
     {
-        printf("Verification of third linear calculation failed\n");
-        return 1;
+        // server 1 only receives the 32-byte seed and expands its input shares itself
+        prg_init(linear_data_1->seed, share_seed);
+        linear_data_1->seeded = true;
     }
-    printf("Verification of third linear calculation passed\n\n");
-    mnist->image_size = WEIGHT3_ROWS;
-    for (int i = 0; i < mnist->image_size; i++)
+
+    // the latency of the batch runs from the client's shares to the last passed check
+    timestamp_t batch_start, batch_end;
+    get_timestamp_from(CLOCK_WALL_ID, batch_start);
+    for (int l = 0; l < model->num_layers; l++)
     {
+        const struct model_layer_struct *layer = &model->layers[l];
+        SecureLayer *secure = &layers[l];
+
+        profile_begin(phase_split);
+        linear_split(pool, share_prg, SHARE_STREAM_INPUT(0, l + 1), mnist, linear_data_1, linear_data_2);
+        bia_split(share_prg, SHARE_STREAM_BIAS(l + 1), secure->qbia, layer->rows, secure->qbia_1, secure->qbia_2);
+        profile_end(phase_split);
+
+        profile_begin(phase_linear);
+        linear_evaluate(pool, linear_data_1, linear_data_2, secure->qweight, secure->qbia_1, secure->qbia_2);
+        for (int img = 0; img < mnist->num_images; img++)
+        {
+            const int32_t *result1 = tensor_s32(linear_data_1->result_data, img);
+            const int32_t *result2 = tensor_s32(linear_data_2->result_data, img);
+            int32_t *result = tensor_s32(mnist->result_data, img);
+            ring_reconstruct(result1, result2, result, layer->rows);
+        }
+        profile_end(phase_linear);
+        linear_veri_submit(pipeline, l + 1, mnist, secure->veri_key);
+        mnist->image_size = layer->rows;
+
+        if (l == model->num_layers - 1)
+        {
+            for (int img = 0; img < mnist->num_images; img++)
+            {
+                const int32_t *result = tensor_s32(mnist->result_data, img);
+                float *activation = tensor_f32(mnist->result_data, img);
+                for (int i = 0; i < mnist->image_size; i++)
+                {
+                    activation[i] = (float)result[i] / 10000.0f;
+                }
+            }
+            tensor_swap(mnist->data, mnist->result_data);
+            break;
+        }
+
+        // the activations overwrite the layer outputs in place, then the buffers ping-pong
         for (int j = 0; j < mnist->num_images; j++)
         {
-            mnist->data[i][j] = (float)(mnist->result_data[i][j]) / 10000.0f;
+            const int32_t *result = tensor_s32(mnist->result_data, j);
+            float *activation = tensor_f32(mnist->result_data, j);
+            for (int i = 0; i < mnist->image_size; i++)
+            {
+                printf("Layer %d: i = %d, j = %d\n\n", l + 1, i, j);
+                if (inference_aborted(pipeline))
+                {
+                    veri_pipeline_clear(pipeline);
+                    return 1;
+                }
+                profile_begin(phase_rescale);
+                float value = (float)result[i] / 10000.0f;
+                float rounded_val = roundf(value * 100) / 100; // Retain 2 decimals
+                profile_end(phase_rescale);
+                // every temporary of the neuron is dropped at once when its arena scope ends
+                int processed_val;
+                leak_detector_begin(leaks);
+                arena_scope(arena, {
+                    processed_val = process_rounded_val(rounded_val, keys, k1_bytes, k2_bytes, alpha, pipeline, l + 1);
+                });
+                leak_detector_end(leaks);
+                profile_begin(phase_rescale);
+                if (processed_val == 0)
+                {
+                    value = 0.0f;
+                }
+                else
+                {
+                    value = (float)processed_val / 10000.0f;
+                }
+                activation[i] = roundf(value * 100) / 100;
+                profile_end(phase_rescale);
+            }
         }
+        tensor_swap(mnist->data, mnist->result_data);
     }
 
-    int *true_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/mnist_labels.txt");
-    if (!true_labels)
+    // the speculative results are only released once every queued check passed
+    if (!veri_pipeline_drain(pipeline))
     {
-        printf("Failed to read true labels\n");
-        free_mnist_data(mnist);
+        inference_aborted(pipeline);
+        veri_pipeline_clear(pipeline);
+        return 1;
+    }
+    get_timestamp_from(CLOCK_WALL_ID, batch_end);
+    printf("All %zu verification checks passed\n\n", pipeline->checked);
+    veri_pipeline_clear(pipeline);
+    batch_times_t batch_times;
+    batch_times_init(batch_times);
+    if (batch_times_add(batch_times, et_to(get_elapsed_time_from_timestamp(batch_start, batch_end), tu_sec), mnist->num_images) < 0)
+    {
+        printf("Error: Memory allocation failure\n");
         return 1;
     }
-    int *predicted_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/predicted_labels.txt");
-    if (!predicted_labels)
+
+    int *true_labels = (int *)malloc(mnist->num_images * sizeof(int));
+    int *predicted_labels = (int *)malloc(mnist->num_images * sizeof(int));
+    FILE *true_file = image_labels_open("/home/ashlynsun/vhss-to-fnn/data/mnist_labels.txt");
+    FILE *predicted_file = image_labels_open("/home/ashlynsun/vhss-to-fnn/data/predicted_labels.txt");
+    if (!true_file || !predicted_file || !true_labels || !predicted_labels ||
+        image_labels_next(true_file, true_labels, mnist->num_images) < mnist->num_images ||
+        image_labels_next(predicted_file, predicted_labels, mnist->num_images) < mnist->num_images)
     {
-        printf("Failed to read predicted labels\n");
+        printf("Failed to read labels\n");
         free_mnist_data(mnist);
-        free(true_labels);
         return 1;
     }
+    fclose(true_file);
+    fclose(predicted_file);
 
     int correct_predictions = 0;
     int aligned_predictions = 0;
 
     for (int img = 0; img < mnist->num_images; img++)
     {
-        float max_val = mnist->data[0][img];
+        const float *output = tensor_f32(mnist->data, img);
+        float max_val = output[0];
         int max_idx = 0;
 
-        for (int i = 1; i < 10; i++)
+        for (int i = 1; i < mnist->image_size; i++)
         {
-            if (mnist->data[i][img] > max_val)
+            if (output[i] > max_val)
             {
-                max_val = mnist->data[i][img];
+                max_val = output[i];
                 max_idx = i;
             }
         }
@@ -800,18 +588,44 @@ int main()
     printf("----------------------------------------\n");
     printf("Aligned prediction: %d\n", aligned_predictions);
     printf("Rate: %.2f%%\n", (float)aligned_predictions / mnist->num_images * 100);
-    printf("\nTotal time: %.3f ms\n", total_time * 1000);
-    printf("Amortized time per image: %.3f ms\n", total_time * 1000 / mnist->num_images);
+    batch_times_report(stdout, batch_times);
+    batch_times_clear(batch_times);
+
+    printf("\nPhases:\n");
+    profile_report(stdout, tu_millis);
+    printf("\nMemory: peak rss=%ld KiB, rss=%ld KiB, heap live=%lld bytes\n", memstat_peak_rss(), memstat_rss(),
+           (long long)memstat_heap_live());
+    leak_detector_report(stdout, "neuron", leaks);
+    const char *json_path = profile_json_path();
+    if (json_path)
+    {
+        FILE *json = fopen(json_path, "w");
+        if (!json)
+        {
+            printf("Error: Can't open the profile file %s\n", json_path);
+        }
+        else
+        {
+            profile_report_json(json, tu_millis);
+            fclose(json);
+        }
+    }
 
     // free memory
     free(true_labels);
     free(predicted_labels);
     free_mnist_data(mnist);
+    free_secure_layers(layers, model->num_layers);
+    model_clear(model);
+    thpool_clear(pool);
     free(k1_bytes);
     free(k2_bytes);
     gmp_randclear(prng);
     prs_keys_clear(keys);
     free(keys);
-    mpz_clears(alpha, phi_N, k_2, N, k1, k2, NULL);
+    free_hss_veri_records();
+    arena_clear(arena);
+    mpz_clears(alpha, phi_N, k_2, N, k1, k2, co_1, co_2, NULL);
+    profile_clear();
     return 0;
 }
\ No newline at end of file
@@ -4,533 +4,279 @@
 #include <math.h>
 #include <time.h>
 #include <stdbool.h>
+#include <lib-idx.h>
+#include <lib-model.h>
+#include <lib-thpool.h>
+#include <lib-secure.h>
+#include <lib-share.h>
+#include <lib-stream.h>
+#include <lib-timing.h>
 
 #define INITIAL_IMAGE_SIZE 784 // 28*28 pixels
-#define MAX_LINE_LENGTH 4096
 #define MAX_IMAGES 10000
-#define WEIGHT1_ROWS 512
-#define WEIGHT1_COLS 784
-#define WEIGHT2_ROWS 512
-#define WEIGHT2_COLS 512
-#define WEIGHT3_COLS 512
-#define WEIGHT3_ROWS 10
 
-// all mnist data is stored in this struct
-typedef struct
-{
-    float (*data)[MAX_IMAGES];     // pointer to a two-dimensional array
-    int (*temp)[MAX_IMAGES];
-    int (*result_data)[MAX_IMAGES];
-    int num_images;
-    int image_size; // pixels per image
-} MNISTData;
+#define IMAGES_FILE "/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt"
+#define TRUE_LABELS_FILE "/home/ashlynsun/vhss-to-fnn/data/mnist_labels.txt"
+#define PREDICTED_LABELS_FILE "/home/ashlynsun/vhss-to-fnn/data/predicted_labels.txt"
+#define SEED_COMPRESSED_SHARES true // server 1 gets a PRG seed instead of its input shares
 
-void skip_header(FILE *file)
+bool linear_veri(MNISTData *input_data, linear_veri_key_t key)
 {
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, sizeof(line), file))
+    for (int img = 0; img < input_data->num_images; img++)
     {
-        if (line[0] != '#')
+        if (!linear_veri_key_check(key, tensor_s32(input_data->temp, img), 1, tensor_s32(input_data->result_data, img), 1))
         {
-            fseek(file, -strlen(line), SEEK_CUR); // Go back to the beginning of the line
-            break;
+            printf("False at image %d\n", img);
+            return false;
         }
     }
+    return true;
 }
 
-MNISTData *read_mnist_images(const char *filename)
+// runs the secure linear layers over one batch, leaving the logits in mnist->data
+int forward(thpool_t pool, const model_t model, SecureLayer *layers, const prg_t share_prg, int batch_index,
+            MNISTData *mnist, MNISTData *linear_data_1, MNISTData *linear_data_2)
 {
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    for (int l = 0; l < model->num_layers; l++)
     {
-        printf("Error: Can't open the file %s\n", filename);
-        return NULL;
-    }
+        const struct model_layer_struct *layer = &model->layers[l];
+        SecureLayer *secure = &layers[l];
 
-    MNISTData *mnist = (MNISTData *)malloc(sizeof(MNISTData));
-    if (!mnist)
-    {
-        printf("Error: Memory allocation failure\n");
-        fclose(file);
-        return NULL;
-    }
+        // every batch gets its own input streams, the bias shares are the same for the whole run
+        linear_split(pool, share_prg, SHARE_STREAM_INPUT(batch_index, l + 1), mnist, linear_data_1, linear_data_2);
 
-    mnist->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
-    mnist->num_images = 0;
-    mnist->data = (float (*)[MAX_IMAGES])malloc(INITIAL_IMAGE_SIZE * MAX_IMAGES * sizeof(float));
-    mnist->temp = (int (*)[MAX_IMAGES])malloc(INITIAL_IMAGE_SIZE * MAX_IMAGES * sizeof(int));
-    mnist->result_data = (int (*)[MAX_IMAGES])malloc(INITIAL_IMAGE_SIZE * MAX_IMAGES * sizeof(int));
-    if (!mnist->data)
-    {
-        printf("Error: Image data memory allocation failure\n");
-        free(mnist);
-        fclose(file);
-        return NULL;
+        linear_evaluate(pool, linear_data_1, linear_data_2, secure->qweight, secure->qbia_1, secure->qbia_2);
+        for (int img = 0; img < mnist->num_images; img++)
+        {
+            const int32_t *result1 = tensor_s32(linear_data_1->result_data, img);
+            const int32_t *result2 = tensor_s32(linear_data_2->result_data, img);
+            int32_t *result = tensor_s32(mnist->result_data, img);
+            ring_reconstruct(result1, result2, result, layer->rows);
+        }
+        if(!linear_veri(mnist, secure->veri_key)){
+            printf("Verification of linear layer %d failed in batch %d\n", l + 1, batch_index);
+            return -1;
+        }
+        mnist->image_size = layer->rows;
+        // the activations overwrite the layer outputs in place, then the buffers ping-pong;
+        // the last layer keeps its logits
+        bool last = l == model->num_layers - 1;
+        for (int img = 0; img < mnist->num_images; img++)
+        {
+            const int32_t *result = tensor_s32(mnist->result_data, img);
+            float *activation = tensor_f32(mnist->result_data, img);
+            for (int i = 0; i < mnist->image_size; i++)
+            {
+                float value = (float)result[i] / 10000.0f;
+                if (!last)
+                {
+                    float rounded_val = roundf(value * 100) / 100; // Retain 2 decimals
+                    value = rounded_val * rounded_val + rounded_val;
+                    value = roundf(value * 100) / 100;
+                }
+                activation[i] = value;
+            }
+        }
+        tensor_swap(mnist->data, mnist->result_data);
     }
+    return 0;
+}
 
-    skip_header(file); // change the position of file pointer to the beginning of the image data
-
-    char line[MAX_LINE_LENGTH]; // 4096
-    int image_index = 0;
-    char *token;
-
-    while (fgets(line, sizeof(line), file) && image_index < MAX_IMAGES)
+void score_images(const MNISTData *mnist, const int *true_labels, const int *predicted_labels, int *correct_predictions, int *aligned_predictions)
+{
+    for (int img = 0; img < mnist->num_images; img++)
     {
-        token = strtok(line, " \n");
-        int pixel_index = 0;
+        const float *output = tensor_f32(mnist->data, img);
+        float max_val = output[0];
+        int max_idx = 0;
 
-        while (token != NULL && pixel_index < INITIAL_IMAGE_SIZE)
+        for (int i = 1; i < mnist->image_size; i++)
         {
-            mnist->data[pixel_index][image_index] = atof(token);
-            token = strtok(NULL, " \n");
-            pixel_index++;
+            if (output[i] > max_val)
+            {
+                max_val = output[i];
+                max_idx = i;
+            }
         }
 
-        if (pixel_index == INITIAL_IMAGE_SIZE)
+        if (max_idx == true_labels[img])
         {
-            image_index++;
+            (*correct_predictions)++;
         }
-    }
-
-    mnist->num_images = image_index;
-    fclose(file);
-
-    // If the actual number of images is less than MAX_IMAGES, readjust the memory size
-    if (mnist->num_images < MAX_IMAGES)
-    {
-        float (*temp)[MAX_IMAGES] = (float (*)[MAX_IMAGES])realloc(mnist->data,
-                                       mnist->num_images * INITIAL_IMAGE_SIZE * sizeof(float));
-        if (temp)
+        if (max_idx == predicted_labels[img])
         {
-            mnist->data = temp;
+            (*aligned_predictions)++;
         }
     }
-
-    return mnist;
 }
 
-void free_mnist_data(MNISTData *mnist)
+// reads, shares, evaluates and scores batch images at a time while the next batch loads;
+// the client and the two servers hold one batch each, whatever the number of images
+int run_stream(thpool_t pool, const model_t model, SecureLayer *layers, int batch)
 {
-    if (mnist)
+    int width = model_max_width(model);
+
+    // the input shares of this run are drawn from a fresh ChaCha20 key, one stream per batch and layer
+    prg_t share_prg;
+    uint8_t share_seed[PRG_SEED_BYTES];
+    if (prg_init_os(share_prg, share_seed) < 0)
     {
-        free(mnist->data);
-        free(mnist->result_data);
-        free(mnist);
+        printf("Failed to seed the share generator\n");
+        return 1;
     }
-}
 
-void read_weight(const char *filename, int weight_rows, int weight_cols, float (*weight)[weight_cols], int weight_index)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    image_stream_t stream;
+    if (image_stream_open(stream, idx_images_path(IMAGES_FILE), INITIAL_IMAGE_SIZE, batch, MAX_IMAGES) < 0)
     {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
+        printf("Failed to read MNIST data\n");
+        return 1;
     }
-
-    char line[MAX_LINE_LENGTH];
-    int row = 0, col = 0;
-    int weight_found = 0;
-    char weight_header[32];
-
-    snprintf(weight_header, sizeof(weight_header), "Shape of weight %d:", weight_index);
-
-    while (fgets(line, sizeof(line), file))
+    FILE *true_file = image_labels_open(TRUE_LABELS_FILE);
+    FILE *predicted_file = image_labels_open(PREDICTED_LABELS_FILE);
+    MNISTData *mnist = create_mnist_data(batch, INITIAL_IMAGE_SIZE, width, true, true);
+    MNISTData *linear_data_1 = create_mnist_data(batch, INITIAL_IMAGE_SIZE, width, false, !SEED_COMPRESSED_SHARES);
+    MNISTData *linear_data_2 = create_mnist_data(batch, INITIAL_IMAGE_SIZE, width, false, true);
+    int *true_labels = (int *)malloc(batch * sizeof(int));
+    int *predicted_labels = (int *)malloc(batch * sizeof(int));
+    batch_times_t batch_times;
+    batch_times_init(batch_times);
+    int status = -1;
+    if (!true_file || !predicted_file)
     {
-        if (strstr(line, weight_header) != NULL)
-        {
-            weight_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
-        }
-
-        if (weight_found)
-        {
-            char *token = strtok(line, " \n");
-            while (token != NULL)
-            {
-                if (row < weight_rows && col < weight_cols)
-                {
-                    weight[row][col] = atof(token);
-                    col++;
-                    if (col == weight_cols)
-                    {
-                        col = 0;
-                        row++;
-                        break;
-                    }
-                }
-                token = strtok(NULL, " \n");
-            }
-            if (row == weight_rows)
-            {
-                break;
-            }
-        }
+        printf("Failed to read labels\n");
     }
-
-    fclose(file);
-}
-
-void read_bias(const char *filename, float *bias, int bias_size, int bias_index)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    else if (!mnist || !linear_data_1 || !linear_data_2 || !true_labels || !predicted_labels)
     {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
+        printf("Error: Memory allocation failure\n");
     }
-
-    char line[MAX_LINE_LENGTH];
-    int index = 0;
-    int bias_found = 0;
-    char bias_header[32];
-
-    // Construct the weight identifier
-    snprintf(bias_header, sizeof(bias_header), "Shape of bia %d:", bias_index);
-
-    while (fgets(line, sizeof(line), file))
+    else
     {
-        if (strstr(line, bias_header) != NULL)
+        if (SEED_COMPRESSED_SHARES)
+        {
+            // server 1 only receives the 32-byte seed and expands its input shares itself
+            prg_init(linear_data_1->seed, share_seed);
+            linear_data_1->seeded = true;
+        }
+        for (int l = 0; l < model->num_layers; l++)
         {
-            bias_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
+            SecureLayer *secure = &layers[l];
+            bia_split(share_prg, SHARE_STREAM_BIAS(l + 1), secure->qbia, model->layers[l].rows, secure->qbia_1, secure->qbia_2);
         }
 
-        if (bias_found)
+        int num_batches = 0;
+        int correct_predictions = 0;
+        int aligned_predictions = 0;
+        const float *images;
+        int count;
+        while ((count = image_stream_next(stream, &images)) > 0)
         {
-            char *token = strtok(line, " \n");
-            while (token != NULL && index < bias_size)
+            if (image_labels_next(true_file, true_labels, count) < count ||
+                image_labels_next(predicted_file, predicted_labels, count) < count)
+            {
+                printf("Error: There are fewer labels than images\n");
+                break;
+            }
+            mnist->num_images = count;
+            mnist->image_size = INITIAL_IMAGE_SIZE;
+            for (int img = 0; img < count; img++)
             {
-                bias[index] = atof(token);
-                index++;
-                token = strtok(NULL, " \n");
+                memcpy(tensor_f32(mnist->data, img), images + (size_t)img * INITIAL_IMAGE_SIZE,
+                       INITIAL_IMAGE_SIZE * sizeof(float));
             }
-            if (index == bias_size)
+            // from the client's shares to the verified logits of the batch
+            timestamp_t start, end;
+            get_timestamp_from(CLOCK_WALL_ID, start);
+            if (forward(pool, model, layers, share_prg, num_batches++, mnist, linear_data_1, linear_data_2) < 0)
             {
                 break;
             }
+            get_timestamp_from(CLOCK_WALL_ID, end);
+            if (batch_times_add(batch_times, et_to(get_elapsed_time_from_timestamp(start, end), tu_sec), count) < 0)
+            {
+                printf("Error: Memory allocation failure\n");
+                break;
+            }
+            score_images(mnist, true_labels, predicted_labels, &correct_predictions, &aligned_predictions);
         }
-    }
-
-    fclose(file);
-}
-
-int *read_labels(const char *filename)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the labels file %s\n", filename);
-        return NULL;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    // skip
-    fgets(line, sizeof(line), file);
-    fgets(line, sizeof(line), file);
-    fgets(line, sizeof(line), file);
-
-    int *labels = (int *)malloc(MAX_IMAGES * sizeof(int));
-    if (!labels)
-    {
-        fclose(file);
-        return NULL;
-    }
-
-    int num_labels = 0;
-    while (fgets(line, sizeof(line), file) && num_labels < MAX_IMAGES)
-    {
-        if (strlen(line) > 0)
+        if (count < 0)
         {
-            labels[num_labels] = atoi(line);
-            num_labels++;
+            printf("Failed to read MNIST data\n");
         }
-    }
-
-    fclose(file);
-    return labels;
-}
-
-void linear_split(MNISTData *original_data, MNISTData *share1, MNISTData* share2) {
-    srand(time(NULL));
-
-    for(int i = 0; i < original_data->image_size; i++) {
-        for (int j = 0; j < original_data->num_images;j++){
-            int enlarged_value = (int)roundf(original_data->data[i][j] * 100);
-            share1->temp[i][j] = rand() % (2 * abs(enlarged_value) + 1) - abs(enlarged_value);
-            share2->temp[i][j] = enlarged_value - share1->temp[i][j];
-        }
-    }
-
-    share1->image_size = original_data->image_size, share1->num_images = original_data->num_images;
-    share2->image_size = original_data->image_size, share2->num_images = original_data->num_images;
-
-    return;
-}
-
-void bia_split(float *bias, int bias_size, float *share1, float *share2) {
-    srand(time(NULL));
-    for(int i=0; i<bias_size; i++){
-        float random_factor = ((float)rand()/(float)RAND_MAX * 2 - 1);
-        share1[i] = roundf((random_factor * bias[i]) * 10000) / 10000;
-        share2[i] = roundf((bias[i] - share1[i]) * 10000) / 10000;
-    }
-
-    return;
-}
-
-void linear_evaluate(MNISTData *input_data, int weight_rows, int weight_cols, float (*weight)[weight_cols], float *bias)
-{
-    for (int img = 0; img < input_data->num_images; img++)
-    {
-        for (int i = 0; i < weight_rows; i++)
+        else if (count == 0 && batch_times->images > 0)
         {
-            input_data->result_data[i][img] = (int)roundf(bias[i] * 10000);
-            for (int j = 0; j < weight_cols; j++)
+            int num_images = batch_times->images;
+            for (int l = 0; l < model->num_layers; l++)
             {
-                input_data->result_data[i][img] += (int)roundf(weight[i][j] * 100) * input_data->temp[j][img];
+                printf("Verification of linear layer %d passed\n\n", l + 1);
             }
+            printf("Total sample size: %d\n", num_images);
+            printf("\nCompare with true labels:\n");
+            printf("----------------------------------------\n");
+            printf("Correct prediction: %d\n", correct_predictions);
+            printf("Accuracy: %.2f%%\n", (float)correct_predictions / num_images * 100);
+            printf("\nCompare with original predicted labels:\n");
+            printf("----------------------------------------\n");
+            printf("Aligned prediction: %d\n", aligned_predictions);
+            printf("Rate: %.2f%%\n", (float)aligned_predictions / num_images * 100);
+            batch_times_report(stdout, batch_times);
+            status = 0;
         }
     }
-    input_data->image_size = weight_rows;
-    return;
-}
-
-bool linear_veri(MNISTData *input_data, int weight_rows, int weight_cols, float (*weight)[weight_cols], float *bias)
-{
-    int r = 1;
-    int *x = (int *)malloc(MAX_IMAGES * sizeof(int));
-    int *true_output = (int *)malloc(weight_rows * sizeof(int));
-    int *real_output = (int *)malloc(weight_rows * sizeof(int));
-
-    if (!x || !true_output || !real_output) {
-        printf("Memory allocation failed\n");
-        free(x);
-        free(true_output);
-        free(real_output);
-        return false;
-    }
-
-    x[0] = 1;
-    for(int i=1;i<MAX_IMAGES;i++){
-        x[i] = x[i-1]*r;
-    }
 
-    for (int i = 0; i < weight_rows; i++)
+    batch_times_clear(batch_times);
+    free(true_labels);
+    free(predicted_labels);
+    free_mnist_data(mnist);
+    free_mnist_data(linear_data_1);
+    free_mnist_data(linear_data_2);
+    if (true_file)
     {
-        true_output[i] = 0, real_output[i] = 0;
-        for(int k=0;k<MAX_IMAGES;k++){
-            true_output[i] += (int)roundf(bias[i] * 10000) * x[k];
-        }
-        for(int k=0;k<MAX_IMAGES;k++){
-            real_output[i] += input_data->result_data[i][k] * x[k];
-        }
-
-        for (int k = 0; k < weight_cols; k++)
-        {
-            int temp = 0;
-            for (int j = 0; j < input_data->num_images; j++)
-            {
-                temp += (int)roundf(input_data->data[k][j] * 100) * x[j];
-            }
-            true_output[i] += (int)roundf(weight[i][k] * 100) * temp;
-        }
+        fclose(true_file);
     }
-    for(int i=0;i<weight_rows;i++){
-        if(true_output[i] != real_output[i]){
-            printf("False at %d\n", i);
-            printf("True: %d, Real: %d\n", true_output[i], real_output[i]);
-            free(x);
-            free(true_output);
-            free(real_output);
-            return false;
-        }
+    if (predicted_file)
+    {
+        fclose(predicted_file);
     }
-
-    free(x);
-    free(true_output);
-    free(real_output);
-    return true;
+    image_stream_close(stream);
+    return status < 0 ? 1 : 0;
 }
 
 int main()
 {
-    MNISTData *mnist = read_mnist_images("/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt");
-    if (!mnist)
+    model_t model;
+    if (model_read(model, model_default_path("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt")) < 0)
     {
-        printf("Failed to read MNIST data\n");
+        printf("Failed to read model parameters\n");
         return 1;
     }
-
-    float weight1[WEIGHT1_ROWS][WEIGHT1_COLS];
-    float bia1[WEIGHT1_ROWS], bia1_1[WEIGHT1_ROWS], bia1_2[WEIGHT1_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT1_ROWS, WEIGHT1_COLS, weight1, 1);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia1, WEIGHT1_ROWS, 1);
-
-    float weight2[WEIGHT2_ROWS][WEIGHT2_COLS];
-    float bia2[WEIGHT2_ROWS], bia2_1[WEIGHT2_ROWS], bia2_2[WEIGHT2_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT2_ROWS, WEIGHT2_COLS, weight2, 2);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia2, WEIGHT2_ROWS, 2);
-
-    float weight3[WEIGHT3_ROWS][WEIGHT3_COLS];
-    float bia3[WEIGHT3_ROWS], bia3_1[WEIGHT3_ROWS], bia3_2[WEIGHT3_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT3_ROWS, WEIGHT3_COLS, weight3, 3);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia3, WEIGHT3_ROWS, 3);
-
-    MNISTData *linear_data_1 = (MNISTData *)malloc(sizeof(MNISTData));
-    linear_data_1->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
-    linear_data_1->num_images = MAX_IMAGES;
-    linear_data_1->data = (float (*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(float));
-    linear_data_1->temp = (int (*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-    linear_data_1->result_data = (int (*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-
-    MNISTData *linear_data_2 = (MNISTData *)malloc(sizeof(MNISTData));
-    linear_data_2->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
-    linear_data_2->num_images = MAX_IMAGES;
-    linear_data_2->data = (float (*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(float));
-    linear_data_2->temp = (int (*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-    linear_data_2->result_data = (int (*)[MAX_IMAGES])malloc(MAX_IMAGES * INITIAL_IMAGE_SIZE * sizeof(int));
-
-    linear_split(mnist, linear_data_1, linear_data_2);
-    bia_split(bia1, WEIGHT1_ROWS, bia1_1, bia1_2);
-
-    linear_evaluate(linear_data_1, WEIGHT1_ROWS, WEIGHT1_COLS, weight1, bia1_1);
-    linear_evaluate(linear_data_2, WEIGHT1_ROWS, WEIGHT1_COLS, weight1, bia1_2);
-    for(int img=0;img<mnist->num_images;img++){
-        for (int i = 0; i < WEIGHT1_ROWS; i++)
-        {
-            mnist->result_data[i][img] = linear_data_1->result_data[i][img] + linear_data_2->result_data[i][img];
-        }
-    }
-    if(!linear_veri(mnist, WEIGHT1_ROWS, WEIGHT1_COLS, weight1, bia1)){
-        printf("Verification of first linear calculation failed\n");
-        return 1;
-    }
-    printf("Verification of first linear calculation passed\n\n");
-    mnist->image_size = WEIGHT1_ROWS;
-    for (int i = 0; i < mnist->image_size; i++)
+    if (model_inputs(model) != INITIAL_IMAGE_SIZE)
     {
-        for (int j = 0; j < mnist->num_images; j++){
-            mnist->data[i][j] = (float)(mnist->result_data[i][j]) / 10000.0f;
-            float rounded_val = roundf(mnist->data[i][j] * 100) / 100; // Retain 2 decimals
-            mnist->data[i][j] = rounded_val * rounded_val + rounded_val;
-            mnist->data[i][j] = roundf(mnist->data[i][j] * 100) / 100;
-        }
-    }
-
-    linear_split(mnist, linear_data_1, linear_data_2);
-    bia_split(bia2, WEIGHT2_ROWS, bia2_1, bia2_2);
-
-    linear_evaluate(linear_data_1, WEIGHT2_ROWS, WEIGHT2_COLS, weight2, bia2_1);
-    linear_evaluate(linear_data_2, WEIGHT2_ROWS, WEIGHT2_COLS, weight2, bia2_2);
-    for (int img = 0; img < mnist->num_images; img++)
-    {
-        for (int i = 0; i < WEIGHT2_ROWS; i++)
-        {
-            mnist->result_data[i][img] = linear_data_1->result_data[i][img] + linear_data_2->result_data[i][img];
-        }
-    }
-    if(!linear_veri(mnist, WEIGHT2_ROWS, WEIGHT2_COLS, weight2, bia2)){
-        printf("Verification of second linear calculation failed\n");
+        printf("Error: The model takes %d inputs, images have %d pixels\n", model_inputs(model), INITIAL_IMAGE_SIZE);
         return 1;
     }
-    printf("Verification of second linear calculation passed\n\n");
-    mnist->image_size = WEIGHT2_ROWS;
-    for (int i = 0; i < mnist->image_size; i++)
-    {
-        for (int j = 0; j < mnist->num_images; j++)
-        {
-            mnist->data[i][j] = (float)(mnist->result_data[i][j]) / 10000.0f;
-            float rounded_val = roundf(mnist->data[i][j] * 100) / 100; // Retain 2 decimals
-            mnist->data[i][j] = rounded_val * rounded_val + rounded_val;
-            mnist->data[i][j] = roundf(mnist->data[i][j] * 100) / 100;
-        }
-    }
-
-    linear_split(mnist, linear_data_1, linear_data_2);
-    bia_split(bia3, WEIGHT3_ROWS, bia3_1, bia3_2);
 
-    linear_evaluate(linear_data_1, WEIGHT3_ROWS, WEIGHT3_COLS, weight3, bia3_1);
-    linear_evaluate(linear_data_2, WEIGHT3_ROWS, WEIGHT3_COLS, weight3, bia3_2);
-    for (int img = 0; img < mnist->num_images; img++)
+    SecureLayer *layers = create_secure_layers(model);
+    if (!layers)
     {
-        for (int i = 0; i < WEIGHT3_ROWS; i++)
-        {
-            mnist->result_data[i][img] = linear_data_1->result_data[i][img] + linear_data_2->result_data[i][img];
-        }
-    }
-    if(!linear_veri(mnist, WEIGHT3_ROWS, WEIGHT3_COLS, weight3, bia3)){
-        printf("Verification of third linear calculation failed\n");
+        printf("Failed to prepare the secure layers\n");
         return 1;
     }
-    printf("Verification of third linear calculation passed\n\n");
-    mnist->image_size = WEIGHT3_ROWS;
-    for (int i = 0; i < mnist->image_size; i++)
-    {
-        for (int j = 0; j < mnist->num_images; j++)
-        {
-            mnist->data[i][j] = (float)(mnist->result_data[i][j]) / 10000.0f;
-        }
-    }
 
-    int *true_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/mnist_labels.txt");
-    if (!true_labels)
+    // the share-side linear layers run on every core unless VHSS_THREADS says otherwise
+    thpool_t pool;
+    if (thpool_init(pool, thpool_default_threads()) < 0)
     {
-        printf("Failed to read true labels\n");
-        free_mnist_data(mnist);
+        printf("Failed to start the thread pool\n");
         return 1;
     }
-    int *predicted_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/predicted_labels.txt");
-    if (!predicted_labels)
-    {
-        printf("Failed to read predicted labels\n");
-        free_mnist_data(mnist);
-        free(true_labels);
-        return 1;
-    }
-
-    int correct_predictions = 0;
-    int aligned_predictions = 0;
-
-    for (int img = 0; img < mnist->num_images; img++)
-    {
-        float max_val = mnist->data[0][img];
-        int max_idx = 0;
-
-        for (int i = 1; i < 10; i++)
-        {
-            if (mnist->data[i][img] > max_val)
-            {
-                max_val = mnist->data[i][img];
-                max_idx = i;
-            }
-        }
-
-        if (max_idx == true_labels[img])
-        {
-            correct_predictions++;
-        }
-        if (max_idx == predicted_labels[img])
-        {
-            aligned_predictions++;
-        }
-    }
 
-    printf("Total sample size: %d\n", mnist->num_images);
-    printf("\nCompare with true labels:\n");
-    printf("----------------------------------------\n");
-    printf("Correct prediction: %d\n", correct_predictions);
-    printf("Accuracy: %.2f%%\n", (float)correct_predictions / mnist->num_images * 100);
-    printf("\nCompare with original predicted labels:\n");
-    printf("----------------------------------------\n");
-    printf("Aligned prediction: %d\n", aligned_predictions);
-    printf("Rate: %.2f%%\n", (float)aligned_predictions / mnist->num_images * 100);
+    // $VHSS_BATCH bounds the images held at once, all of them go in one batch otherwise
+    int batch = image_stream_default_batch();
+    int status = run_stream(pool, model, layers, batch > 0 ? batch : MAX_IMAGES);
 
     // 释放内存
-    free(true_labels);
-    free(predicted_labels);
-    free_mnist_data(mnist);
-    return 0;
-}
\ No newline at end of file
+    free_secure_layers(layers, model->num_layers);
+    model_clear(model);
+    thpool_clear(pool);
+    return status;
+}
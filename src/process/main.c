@@ -3,16 +3,20 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#include <lib-idx.h>
+#include <lib-model.h>
+#include <lib-sgemm.h>
+#include <lib-stream.h>
+#include <lib-thpool.h>
 
 #define INITIAL_IMAGE_SIZE 784       // 28*28 pixels
 #define MAX_LINE_LENGTH 4096
 #define MAX_IMAGES 10000
-#define WEIGHT1_ROWS 512
-#define WEIGHT1_COLS 784
-#define WEIGHT2_ROWS 512
-#define WEIGHT2_COLS 512
-#define WEIGHT3_COLS 512
-#define WEIGHT3_ROWS 10
+#define EVAL_IMAGES 5000 // images scored in a run
+
+#define IMAGES_FILE "/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt"
+#define TRUE_LABELS_FILE "/home/ashlynsun/vhss-to-fnn/data/mnist_labels.txt"
+#define PREDICTED_LABELS_FILE "/home/ashlynsun/vhss-to-fnn/data/predicted_labels.txt"
 
 // all mnist data is stored in this struct
 typedef struct
@@ -41,8 +45,48 @@ void skip_header(FILE *file)
     }
 }
 
+// the IDX images are converted straight from the mapped file
+MNISTData *read_idx_images(const idx_t idx)
+{
+    if (idx->item_size != INITIAL_IMAGE_SIZE)
+    {
+        printf("Error: The images have %zu pixels instead of %d\n", idx->item_size, INITIAL_IMAGE_SIZE);
+        return NULL;
+    }
+
+    MNISTData *mnist = (MNISTData *)malloc(sizeof(MNISTData));
+    if (!mnist)
+    {
+        printf("Error: Memory allocation failure\n");
+        return NULL;
+    }
+    mnist->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
+    mnist->num_images = idx->count < MAX_IMAGES ? idx->count : MAX_IMAGES;
+    mnist->data = (float *)malloc((size_t)mnist->num_images * INITIAL_IMAGE_SIZE * sizeof(float));
+    mnist->result_data = (float *)malloc((size_t)mnist->num_images * INITIAL_IMAGE_SIZE * sizeof(float));
+    if (!mnist->data || !mnist->result_data)
+    {
+        printf("Error: Image data memory allocation failure\n");
+        free(mnist->data);
+        free(mnist->result_data);
+        free(mnist);
+        return NULL;
+    }
+
+    idx_to_float(idx_item(idx, 0), (size_t)mnist->num_images * INITIAL_IMAGE_SIZE, IDX_PIXEL_SCALE, mnist->data);
+    return mnist;
+}
+
 MNISTData *read_mnist_images(const char *filename)
 {
+    idx_t idx;
+    if (idx_open(idx, filename) == 0)
+    {
+        MNISTData *mnist = read_idx_images(idx);
+        idx_close(idx);
+        return mnist;
+    }
+
     FILE *file = fopen(filename, "r");
     if (!file)
     {
@@ -121,104 +165,6 @@ void free_mnist_data(MNISTData *mnist)
     }
 }
 
-void read_weight(const char *filename, int weight_rows, int weight_cols, float (*weight)[weight_cols], int weight_index)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    int row = 0, col = 0;
-    int weight_found = 0;
-    char weight_header[32];
-
-    snprintf(weight_header, sizeof(weight_header), "Shape of weight %d:", weight_index);
-
-    while (fgets(line, sizeof(line), file))
-    {
-        if (strstr(line, weight_header) != NULL)
-        {
-            weight_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
-        }
-
-        if (weight_found)
-        {
-            char *token = strtok(line, " \n");
-            while (token != NULL)
-            {
-                if (row < weight_rows && col < weight_cols)
-                {
-                    weight[row][col] = atof(token);
-                    col++;
-                    if (col == weight_cols)
-                    {
-                        col = 0;
-                        row++;
-                        break;
-                    }
-                }
-                token = strtok(NULL, " \n");
-            }
-            if (row == weight_rows)
-            {
-                break;
-            }
-        }
-    }
-
-    fclose(file);
-}
-
-void read_bias(const char *filename, float *bias, int bias_size, int bias_index)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    int index = 0;
-    int bias_found = 0;
-    char bias_header[32];
-
-    // Construct the weight identifier
-    snprintf(bias_header, sizeof(bias_header), "Shape of bia %d:", bias_index);
-
-    while (fgets(line, sizeof(line), file))
-    {
-        if (strstr(line, bias_header) != NULL)
-        {
-            bias_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
-        }
-
-        if (bias_found)
-        {
-            char *token = strtok(line, " \n");
-            while (token != NULL && index < bias_size)
-            {
-                bias[index] = atof(token);
-                index++;
-                token = strtok(NULL, " \n");
-            }
-            if (index == bias_size)
-            {
-                break;
-            }
-        }
-    }
-
-    fclose(file);
-}
-
 int* read_labels(const char* filename) {
     FILE* file = fopen(filename, "r");
     if (!file) {
@@ -250,99 +196,138 @@ int* read_labels(const char* filename) {
     return labels;
 }
 
-int main()
+// sizes both buffers of the images kept for the widest layer of the model
+int reserve_mnist_data(MNISTData *mnist, int width)
 {
-    struct timeval start, end;
-    double total_time = 0.0;
-
-    MNISTData *mnist = read_mnist_images("/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt");
-    if (!mnist)
+    size_t count = (size_t)mnist->num_images * (width > INITIAL_IMAGE_SIZE ? width : INITIAL_IMAGE_SIZE);
+    float *data = (float *)realloc(mnist->data, count * sizeof(float));
+    if (!data)
     {
-        printf("Failed to read MNIST data\n");
-        return 1;
+        return -1;
     }
-    mnist->num_images = 5000;
+    mnist->data = data;
+    float *result_data = (float *)realloc(mnist->result_data, count * sizeof(float));
+    if (!result_data)
+    {
+        return -1;
+    }
+    mnist->result_data = result_data;
+    return 0;
+}
 
-    float weight1[WEIGHT1_ROWS][WEIGHT1_COLS];
-    float bia1[WEIGHT1_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT1_ROWS, WEIGHT1_COLS, weight1, 1);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia1, WEIGHT1_ROWS, 1);
+// the layer output becomes the input of the next layer
+void swap_mnist_buffers(MNISTData *mnist, int image_size)
+{
+    float *swap = mnist->data;
+    mnist->data = mnist->result_data;
+    mnist->result_data = swap;
+    mnist->image_size = image_size;
+}
 
-    float weight2[WEIGHT2_ROWS][WEIGHT2_COLS];
-    float bia2[WEIGHT2_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT2_ROWS, WEIGHT2_COLS, weight2, 2);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia2, WEIGHT2_ROWS, 2);
+// runs every layer on the images at input, the logits are left in mnist->data
+void forward(thpool_t pool, const model_t model, smatrix_t *sweights, const float *input, MNISTData *mnist)
+{
+    // x^2 + x on values rounded to 2 decimals, applied as each layer writes result_data
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        sgemm_activation_t activation = l + 1 < model->num_layers ? sgemm_square_plus : sgemm_identity;
+        sgemm_layer(pool, sweights[l], activation, l == 0 ? input : mnist->data, l == 0 ? INITIAL_IMAGE_SIZE : mnist->image_size,
+                    mnist->result_data, model->layers[l].rows, mnist->num_images);
+        swap_mnist_buffers(mnist, model->layers[l].rows);
+    }
+}
 
-    float weight3[WEIGHT3_ROWS][WEIGHT3_COLS];
-    float bia3[WEIGHT3_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT3_ROWS, WEIGHT3_COLS, weight3, 3);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia3, WEIGHT3_ROWS, 3);
+// adds the argmax predictions matching each set of labels to the counts
+void score_images(const MNISTData *mnist, const int *true_labels, const int *predicted_labels, int *correct_predictions,
+                  int *aligned_predictions)
+{
+    for (int img = 0; img < mnist->num_images; img++)
+    {
+        const float *logits = mnist->data + (size_t)img * mnist->image_size;
+        float max_val = logits[0];
+        int max_idx = 0;
 
-    gettimeofday(&start, NULL);
-    for(int img=0;img<mnist->num_images;img++){
-        for (int i = 0; i < WEIGHT1_ROWS; i++)
+        for (int i = 1; i < mnist->image_size; i++)
         {
-            mnist->result_data[img * WEIGHT1_ROWS + i] = bia1[i];
-            for (int j = 0; j < WEIGHT1_COLS; j++)
+            if (logits[i] > max_val)
             {
-                mnist->result_data[img * WEIGHT1_ROWS + i] += weight1[i][j] * mnist->data[img * INITIAL_IMAGE_SIZE + j];
+                max_val = logits[i];
+                max_idx = i;
             }
         }
-    }
-    mnist->image_size = 512;
-    for (int dp = 0; dp < mnist->image_size*mnist->num_images; dp++)
-    {
-        mnist->data[dp] = mnist->result_data[dp];
-        float rounded_val = roundf(mnist->data[dp] * 100) / 100; // Retain 2 decimals
-        mnist->data[dp] = rounded_val * rounded_val + rounded_val;
-        mnist->data[dp] = roundf(mnist->data[dp] * 100) / 100;
-    }
 
-    for(int img=0;img<mnist->num_images;img++){
-        for (int i = 0; i < WEIGHT2_ROWS; i++)
+        if (max_idx == true_labels[img])
         {
-            mnist->result_data[img * WEIGHT2_ROWS + i] = bia2[i];
-            for (int j = 0; j < WEIGHT2_COLS; j++)
-            {
-                mnist->result_data[img * WEIGHT2_ROWS + i] += weight2[i][j] * mnist->data[img * WEIGHT1_ROWS + j];
-            }
+            (*correct_predictions)++;
+        }
+        if (max_idx == predicted_labels[img])
+        {
+            (*aligned_predictions)++;
         }
     }
-    for (int dp = 0; dp < mnist->image_size * mnist->num_images; dp++)
+}
+
+void print_results(int num_images, int correct_predictions, int aligned_predictions, batch_times_t batch_times)
+{
+    printf("Total sample size: %d\n", num_images);
+    printf("\nCompare with true labels:\n");
+    printf("----------------------------------------\n");
+    printf("Correct prediction: %d\n", correct_predictions);
+    printf("Accuracy: %.2f%%\n", (float)correct_predictions / num_images * 100);
+    printf("\nCompare with original predicted labels:\n");
+    printf("----------------------------------------\n");
+    printf("Aligned prediction: %d\n", aligned_predictions);
+    printf("Rate: %.2f%%\n\n", (float)aligned_predictions / num_images * 100);
+
+    batch_times_report(stdout, batch_times);
+}
+
+// loads the evaluated images at once and runs them as one batch
+int run_batch(thpool_t pool, const model_t model, smatrix_t *sweights)
+{
+    struct timeval start, end;
+
+    MNISTData *mnist = read_mnist_images(idx_images_path(IMAGES_FILE));
+    if (!mnist)
     {
-        mnist->data[dp] = mnist->result_data[dp];
-        float rounded_val = roundf(mnist->data[dp] * 100) / 100;
-        mnist->data[dp] = rounded_val * rounded_val + rounded_val;
-        mnist->data[dp] = roundf(mnist->data[dp] * 100) / 100;
+        printf("Failed to read MNIST data\n");
+        return 1;
     }
-
-    for(int img=0;img<mnist->num_images;img++){
-        for (int i = 0; i < WEIGHT3_ROWS; i++)
-        {
-            mnist->result_data[img * WEIGHT3_ROWS + i] = bia3[i];
-            for (int j = 0; j < WEIGHT3_COLS; j++)
-            {
-                mnist->result_data[img * WEIGHT3_ROWS + i] += weight3[i][j] * mnist->data[img * WEIGHT2_ROWS + j];
-            }
-        }
+    if (mnist->num_images > EVAL_IMAGES)
+    {
+        mnist->num_images = EVAL_IMAGES;
     }
-    mnist->image_size = 10;
-    for (int dp = 0; dp < mnist->image_size * mnist->num_images; dp++)
+    if (reserve_mnist_data(mnist, model_max_width(model)) < 0)
     {
-        mnist->data[dp] = mnist->result_data[dp];
+        printf("Error: Image data memory allocation failure\n");
+        free_mnist_data(mnist);
+        return 1;
     }
+
+    // a single batch: every image waits for all of them
+    batch_times_t batch_times;
+    batch_times_init(batch_times);
+    gettimeofday(&start, NULL);
+    forward(pool, model, sweights, mnist->data, mnist);
     gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
+    if (batch_times_add(batch_times, get_time_elapsed(start, end), mnist->num_images) < 0)
+    {
+        printf("Error: Memory allocation failure\n");
+        free_mnist_data(mnist);
+        return 1;
+    }
 
-    int* true_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/mnist_labels.txt");
+    int* true_labels = read_labels(TRUE_LABELS_FILE);
     if (!true_labels) {
         printf("Failed to read true labels\n");
+        batch_times_clear(batch_times);
         free_mnist_data(mnist);
         return 1;
     }
-    int* predicted_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/predicted_labels.txt");
+    int* predicted_labels = read_labels(PREDICTED_LABELS_FILE);
     if (!predicted_labels) {
         printf("Failed to read predicted labels\n");
+        batch_times_clear(batch_times);
         free_mnist_data(mnist);
         free(true_labels);
         return 1;
@@ -350,42 +335,152 @@ int main()
 
     int correct_predictions = 0;
     int aligned_predictions = 0;
+    score_images(mnist, true_labels, predicted_labels, &correct_predictions, &aligned_predictions);
+    print_results(mnist->num_images, correct_predictions, aligned_predictions, batch_times);
 
-    for (int img = 0; img < mnist->num_images; img++) {
-        float max_val = mnist->data[img * 10];
-        int max_idx = 0;
+    batch_times_clear(batch_times);
+    free(true_labels);
+    free(predicted_labels);
+    free_mnist_data(mnist);
+    return 0;
+}
 
-        for (int i = 1; i < 10; i++) {
-            if (mnist->data[img * 10 + i] > max_val) {
-                max_val = mnist->data[img * 10 + i];
-                max_idx = i;
+// reads, runs and scores batch images at a time while the next batch loads, in constant memory
+int run_stream(thpool_t pool, const model_t model, smatrix_t *sweights, int batch)
+{
+    struct timeval start, end;
+
+    image_stream_t stream;
+    if (image_stream_open(stream, idx_images_path(IMAGES_FILE), INITIAL_IMAGE_SIZE, batch, EVAL_IMAGES) < 0)
+    {
+        printf("Failed to read MNIST data\n");
+        return 1;
+    }
+    FILE *true_file = image_labels_open(TRUE_LABELS_FILE);
+    FILE *predicted_file = image_labels_open(PREDICTED_LABELS_FILE);
+    MNISTData *mnist = (MNISTData *)calloc(1, sizeof(MNISTData));
+    int *true_labels = (int *)malloc(batch * sizeof(int));
+    int *predicted_labels = (int *)malloc(batch * sizeof(int));
+    batch_times_t batch_times;
+    batch_times_init(batch_times);
+    int status = -1;
+    if (mnist)
+    {
+        mnist->num_images = batch;
+    }
+    if (!true_file || !predicted_file)
+    {
+        printf("Failed to read labels\n");
+    }
+    else if (!mnist || !true_labels || !predicted_labels ||
+             reserve_mnist_data(mnist, model_max_width(model)) < 0)
+    {
+        printf("Error: Image data memory allocation failure\n");
+    }
+    else
+    {
+        int num_images = 0;
+        int correct_predictions = 0;
+        int aligned_predictions = 0;
+        const float *images;
+        int count;
+        while ((count = image_stream_next(stream, &images)) > 0)
+        {
+            if (image_labels_next(true_file, true_labels, count) < count ||
+                image_labels_next(predicted_file, predicted_labels, count) < count)
+            {
+                printf("Error: There are fewer labels than images\n");
+                break;
+            }
+            mnist->num_images = count;
+
+            gettimeofday(&start, NULL);
+            forward(pool, model, sweights, images, mnist);
+            gettimeofday(&end, NULL);
+            if (batch_times_add(batch_times, get_time_elapsed(start, end), count) < 0)
+            {
+                printf("Error: Memory allocation failure\n");
+                break;
             }
-        }
 
-        if (max_idx == true_labels[img]) {
-            correct_predictions++;
+            score_images(mnist, true_labels, predicted_labels, &correct_predictions, &aligned_predictions);
+            num_images += count;
         }
-        if(max_idx == predicted_labels[img]){
-            aligned_predictions++;
+        if (count < 0)
+        {
+            printf("Failed to read MNIST data\n");
+        }
+        else if (count == 0)
+        {
+            print_results(num_images, correct_predictions, aligned_predictions, batch_times);
+            status = 0;
         }
     }
 
-    printf("Total sample size: %d\n", mnist->num_images);
-    printf("\nCompare with true labels:\n");
-    printf("----------------------------------------\n");
-    printf("Correct prediction: %d\n", correct_predictions);
-    printf("Accuracy: %.2f%%\n", (float)correct_predictions / mnist->num_images * 100);
-    printf("\nCompare with original predicted labels:\n");
-    printf("----------------------------------------\n");
-    printf("Aligned prediction: %d\n", aligned_predictions);
-    printf("Rate: %.2f%%\n\n", (float)aligned_predictions / mnist->num_images * 100);
-
-    printf("\nTotal time: %.3f ms\n", total_time * 1000);
-    printf("Amortized time per image: %.3f ms\n", total_time * 1000 / mnist->num_images);
-
-    // 释放内存
     free(true_labels);
     free(predicted_labels);
+    batch_times_clear(batch_times);
     free_mnist_data(mnist);
-    return 0;
-}
\ No newline at end of file
+    if (true_file)
+    {
+        fclose(true_file);
+    }
+    if (predicted_file)
+    {
+        fclose(predicted_file);
+    }
+    image_stream_close(stream);
+    return status < 0 ? 1 : 0;
+}
+
+int main()
+{
+    model_t model;
+    if (model_read(model, model_default_path("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt")) < 0)
+    {
+        printf("Failed to read model parameters\n");
+        return 1;
+    }
+    if (model_inputs(model) != INITIAL_IMAGE_SIZE)
+    {
+        printf("Error: The model takes %d inputs, images have %d pixels\n", model_inputs(model), INITIAL_IMAGE_SIZE);
+        return 1;
+    }
+
+    smatrix_t *sweights = (smatrix_t *)malloc(model->num_layers * sizeof(smatrix_t));
+    if (!sweights)
+    {
+        printf("Error: Weight memory allocation failure\n");
+        return 1;
+    }
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        if (smatrix_init(sweights[l], model->layers[l].rows, model->layers[l].cols) < 0)
+        {
+            printf("Error: Weight memory allocation failure\n");
+            return 1;
+        }
+        smatrix_pack(sweights[l], model->layers[l].weight, model->layers[l].bias);
+    }
+
+    thpool_t pool;
+    if (thpool_init(pool, thpool_default_threads()) < 0)
+    {
+        printf("Error: Thread pool creation failure\n");
+        return 1;
+    }
+
+    // $VHSS_BATCH switches to streaming the images in batches of that size
+    int batch = image_stream_default_batch();
+    int status = batch > 0 ? run_stream(pool, model, sweights, batch) : run_batch(pool, model, sweights);
+
+    // 释放内存
+    thpool_clear(pool);
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        smatrix_clear(sweights[l]);
+    }
+    free(sweights);
+    model_clear(model);
+    return status;
+}
@@ -3,16 +3,18 @@
 #include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#include <lib-idx.h>
+#include <lib-model.h>
+#include <lib-sgemm.h>
+#include <lib-stream.h>
+#include <lib-thpool.h>
 
 #define INITIAL_IMAGE_SIZE 784 // 28*28 pixels
 #define MAX_LINE_LENGTH 4096
 #define MAX_IMAGES 10000
-#define WEIGHT1_ROWS 512
-#define WEIGHT1_COLS 784
-#define WEIGHT2_ROWS 512
-#define WEIGHT2_COLS 512
-#define WEIGHT3_COLS 512
-#define WEIGHT3_ROWS 10
+#define EVAL_IMAGES 5000 // images timed in a run
+
+#define IMAGES_FILE "/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt"
 
 // all mnist data is stored in this struct
 typedef struct
@@ -41,8 +43,48 @@ void skip_header(FILE *file)
     }
 }
 
+// the IDX images are converted straight from the mapped file
+MNISTData *read_idx_images(const idx_t idx)
+{
+    if (idx->item_size != INITIAL_IMAGE_SIZE)
+    {
+        printf("Error: The images have %zu pixels instead of %d\n", idx->item_size, INITIAL_IMAGE_SIZE);
+        return NULL;
+    }
+
+    MNISTData *mnist = (MNISTData *)malloc(sizeof(MNISTData));
+    if (!mnist)
+    {
+        printf("Error: Memory allocation failure\n");
+        return NULL;
+    }
+    mnist->image_size = INITIAL_IMAGE_SIZE; // 784 pixels
+    mnist->num_images = idx->count < MAX_IMAGES ? idx->count : MAX_IMAGES;
+    mnist->data = (float *)malloc((size_t)mnist->num_images * INITIAL_IMAGE_SIZE * sizeof(float));
+    mnist->result_data = (float *)malloc((size_t)mnist->num_images * INITIAL_IMAGE_SIZE * sizeof(float));
+    if (!mnist->data || !mnist->result_data)
+    {
+        printf("Error: Image data memory allocation failure\n");
+        free(mnist->data);
+        free(mnist->result_data);
+        free(mnist);
+        return NULL;
+    }
+
+    idx_to_float(idx_item(idx, 0), (size_t)mnist->num_images * INITIAL_IMAGE_SIZE, IDX_PIXEL_SCALE, mnist->data);
+    return mnist;
+}
+
 MNISTData *read_mnist_images(const char *filename)
 {
+    idx_t idx;
+    if (idx_open(idx, filename) == 0)
+    {
+        MNISTData *mnist = read_idx_images(idx);
+        idx_close(idx);
+        return mnist;
+    }
+
     FILE *file = fopen(filename, "r");
     if (!file)
     {
@@ -121,104 +163,6 @@ void free_mnist_data(MNISTData *mnist)
     }
 }
 
-void read_weight(const char *filename, int weight_rows, int weight_cols, float (*weight)[weight_cols], int weight_index)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    int row = 0, col = 0;
-    int weight_found = 0;
-    char weight_header[32];
-
-    snprintf(weight_header, sizeof(weight_header), "Shape of weight %d:", weight_index);
-
-    while (fgets(line, sizeof(line), file))
-    {
-        if (strstr(line, weight_header) != NULL)
-        {
-            weight_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
-        }
-
-        if (weight_found)
-        {
-            char *token = strtok(line, " \n");
-            while (token != NULL)
-            {
-                if (row < weight_rows && col < weight_cols)
-                {
-                    weight[row][col] = atof(token);
-                    col++;
-                    if (col == weight_cols)
-                    {
-                        col = 0;
-                        row++;
-                        break;
-                    }
-                }
-                token = strtok(NULL, " \n");
-            }
-            if (row == weight_rows)
-            {
-                break;
-            }
-        }
-    }
-
-    fclose(file);
-}
-
-void read_bias(const char *filename, float *bias, int bias_size, int bias_index)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        printf("Error: Can't open the file %s\n", filename);
-        return;
-    }
-
-    char line[MAX_LINE_LENGTH];
-    int index = 0;
-    int bias_found = 0;
-    char bias_header[32];
-
-    // Construct the weight identifier
-    snprintf(bias_header, sizeof(bias_header), "Shape of bia %d:", bias_index);
-
-    while (fgets(line, sizeof(line), file))
-    {
-        if (strstr(line, bias_header) != NULL)
-        {
-            bias_found = 1;
-            fgets(line, sizeof(line), file); // Skip the next line
-            continue;
-        }
-
-        if (bias_found)
-        {
-            char *token = strtok(line, " \n");
-            while (token != NULL && index < bias_size)
-            {
-                bias[index] = atof(token);
-                index++;
-                token = strtok(NULL, " \n");
-            }
-            if (index == bias_size)
-            {
-                break;
-            }
-        }
-    }
-
-    fclose(file);
-}
-
 int *read_labels(const char *filename)
 {
     FILE *file = fopen(filename, "r");
@@ -255,102 +199,198 @@ int *read_labels(const char *filename)
     return labels;
 }
 
-float relu(float x)
+// sizes both buffers of the images kept for the widest layer of the model
+int reserve_mnist_data(MNISTData *mnist, int width)
 {
-    return (x > 0) ? x : 0;
+    size_t count = (size_t)mnist->num_images * (width > INITIAL_IMAGE_SIZE ? width : INITIAL_IMAGE_SIZE);
+    float *data = (float *)realloc(mnist->data, count * sizeof(float));
+    if (!data)
+    {
+        return -1;
+    }
+    mnist->data = data;
+    float *result_data = (float *)realloc(mnist->result_data, count * sizeof(float));
+    if (!result_data)
+    {
+        return -1;
+    }
+    mnist->result_data = result_data;
+    return 0;
 }
 
-int main()
+// the layer output becomes the input of the next layer
+void swap_mnist_buffers(MNISTData *mnist, int image_size)
+{
+    float *swap = mnist->data;
+    mnist->data = mnist->result_data;
+    mnist->result_data = swap;
+    mnist->image_size = image_size;
+}
+
+// runs every layer on the images at input, the logits are left in mnist->data
+void forward(thpool_t pool, const model_t model, smatrix_t *sweights, const float *input, MNISTData *mnist)
+{
+    // each layer writes result_data with bias and activation applied, then the buffers swap roles
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        sgemm_activation_t activation = l + 1 < model->num_layers ? sgemm_relu : sgemm_identity;
+        sgemm_layer(pool, sweights[l], activation, l == 0 ? input : mnist->data, l == 0 ? INITIAL_IMAGE_SIZE : mnist->image_size,
+                    mnist->result_data, model->layers[l].rows, mnist->num_images);
+        swap_mnist_buffers(mnist, model->layers[l].rows);
+    }
+}
+
+// loads the evaluated images at once and runs them as one batch
+int run_batch(thpool_t pool, const model_t model, smatrix_t *sweights)
 {
     struct timeval start, end;
-    double total_time = 0.0;
 
-    MNISTData *mnist = read_mnist_images("/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt");
+    MNISTData *mnist = read_mnist_images(idx_images_path(IMAGES_FILE));
     if (!mnist)
     {
         printf("Failed to read MNIST data\n");
         return 1;
     }
-    mnist->num_images = 5000;
+    if (mnist->num_images > EVAL_IMAGES)
+    {
+        mnist->num_images = EVAL_IMAGES;
+    }
+    if (reserve_mnist_data(mnist, model_max_width(model)) < 0)
+    {
+        printf("Error: Image data memory allocation failure\n");
+        free_mnist_data(mnist);
+        return 1;
+    }
 
-    float weight1[WEIGHT1_ROWS][WEIGHT1_COLS];
-    float bia1[WEIGHT1_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT1_ROWS, WEIGHT1_COLS, weight1, 1);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia1, WEIGHT1_ROWS, 1);
+    // a single batch: every image waits for all of them
+    batch_times_t batch_times;
+    batch_times_init(batch_times);
+    gettimeofday(&start, NULL);
+    forward(pool, model, sweights, mnist->data, mnist);
+    gettimeofday(&end, NULL);
+    int status = batch_times_add(batch_times, get_time_elapsed(start, end), mnist->num_images);
+    if (status < 0)
+    {
+        printf("Error: Memory allocation failure\n");
+    }
+    else
+    {
+        printf("Total sample size: %d\n", mnist->num_images);
+        batch_times_report(stdout, batch_times);
+    }
 
-    float weight2[WEIGHT2_ROWS][WEIGHT2_COLS];
-    float bia2[WEIGHT2_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT2_ROWS, WEIGHT2_COLS, weight2, 2);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia2, WEIGHT2_ROWS, 2);
+    batch_times_clear(batch_times);
+    free_mnist_data(mnist);
+    return status < 0 ? 1 : 0;
+}
 
-    float weight3[WEIGHT3_ROWS][WEIGHT3_COLS];
-    float bia3[WEIGHT3_ROWS];
-    read_weight("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", WEIGHT3_ROWS, WEIGHT3_COLS, weight3, 3);
-    read_bias("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt", bia3, WEIGHT3_ROWS, 3);
+// reads and runs batch images at a time while the next batch loads, in constant memory
+int run_stream(thpool_t pool, const model_t model, smatrix_t *sweights, int batch)
+{
+    struct timeval start, end;
 
-    gettimeofday(&start, NULL);
-    for (int img = 0; img < mnist->num_images; img++)
+    image_stream_t stream;
+    if (image_stream_open(stream, idx_images_path(IMAGES_FILE), INITIAL_IMAGE_SIZE, batch, EVAL_IMAGES) < 0)
     {
-        for (int i = 0; i < WEIGHT1_ROWS; i++)
-        {
-            mnist->result_data[img * WEIGHT1_ROWS + i] = bia1[i];
-            for (int j = 0; j < WEIGHT1_COLS; j++)
-            {
-                mnist->result_data[img * WEIGHT1_ROWS + i] += weight1[i][j] * mnist->data[img * INITIAL_IMAGE_SIZE + j];
-            }
-        }
+        printf("Failed to read MNIST data\n");
+        return 1;
     }
-    mnist->image_size = 512;
-    for (int dp = 0; dp < mnist->image_size * mnist->num_images; dp++)
+    MNISTData *mnist = (MNISTData *)calloc(1, sizeof(MNISTData));
+    if (mnist)
     {
-        mnist->data[dp] = mnist->result_data[dp];
-        //float rounded_val = roundf(mnist->data[dp] * 100) / 100; // Retain 2 decimals
-        mnist->data[dp] = relu(mnist->data[dp]);
-        //mnist->data[dp] = roundf(mnist->data[dp] * 100) / 100;
+        mnist->num_images = batch;
+    }
+    if (!mnist || reserve_mnist_data(mnist, model_max_width(model)) < 0)
+    {
+        printf("Error: Image data memory allocation failure\n");
+        free_mnist_data(mnist);
+        image_stream_close(stream);
+        return 1;
     }
 
-    for (int img = 0; img < mnist->num_images; img++)
+    batch_times_t batch_times;
+    batch_times_init(batch_times);
+    const float *images;
+    int count;
+    int status = 0;
+    while ((count = image_stream_next(stream, &images)) > 0)
     {
-        for (int i = 0; i < WEIGHT2_ROWS; i++)
+        mnist->num_images = count;
+        gettimeofday(&start, NULL);
+        forward(pool, model, sweights, images, mnist);
+        gettimeofday(&end, NULL);
+        if (batch_times_add(batch_times, get_time_elapsed(start, end), count) < 0)
         {
-            mnist->result_data[img * WEIGHT2_ROWS + i] = bia2[i];
-            for (int j = 0; j < WEIGHT2_COLS; j++)
-            {
-                mnist->result_data[img * WEIGHT2_ROWS + i] += weight2[i][j] * mnist->data[img * WEIGHT1_ROWS + j];
-            }
+            printf("Error: Memory allocation failure\n");
+            status = -1;
+            break;
         }
     }
-    for (int dp = 0; dp < mnist->image_size * mnist->num_images; dp++)
+    if (count < 0)
+    {
+        printf("Failed to read MNIST data\n");
+        status = -1;
+    }
+    else if (status == 0)
+    {
+        printf("Total sample size: %d\n", batch_times->images);
+        batch_times_report(stdout, batch_times);
+    }
+
+    batch_times_clear(batch_times);
+    free_mnist_data(mnist);
+    image_stream_close(stream);
+    return status < 0 ? 1 : 0;
+}
+
+int main()
+{
+    model_t model;
+    if (model_read(model, model_default_path("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt")) < 0)
+    {
+        printf("Failed to read model parameters\n");
+        return 1;
+    }
+    if (model_inputs(model) != INITIAL_IMAGE_SIZE)
     {
-        mnist->data[dp] = mnist->result_data[dp];
-        //float rounded_val = roundf(mnist->data[dp] * 100) / 100;
-        mnist->data[dp] = relu(mnist->data[dp]);
-        //mnist->data[dp] = roundf(mnist->data[dp] * 100) / 100;
+        printf("Error: The model takes %d inputs, images have %d pixels\n", model_inputs(model), INITIAL_IMAGE_SIZE);
+        return 1;
     }
 
-    for (int img = 0; img < mnist->num_images; img++)
+    smatrix_t *sweights = (smatrix_t *)malloc(model->num_layers * sizeof(smatrix_t));
+    if (!sweights)
+    {
+        printf("Error: Weight memory allocation failure\n");
+        return 1;
+    }
+    for (int l = 0; l < model->num_layers; l++)
     {
-        for (int i = 0; i < WEIGHT3_ROWS; i++)
+        if (smatrix_init(sweights[l], model->layers[l].rows, model->layers[l].cols) < 0)
         {
-            mnist->result_data[img * WEIGHT3_ROWS + i] = bia3[i];
-            for (int j = 0; j < WEIGHT3_COLS; j++)
-            {
-                mnist->result_data[img * WEIGHT3_ROWS + i] += weight3[i][j] * mnist->data[img * WEIGHT2_ROWS + j];
-            }
+            printf("Error: Weight memory allocation failure\n");
+            return 1;
         }
+        smatrix_pack(sweights[l], model->layers[l].weight, model->layers[l].bias);
     }
-    mnist->image_size = 10;
-    for (int dp = 0; dp < mnist->image_size * mnist->num_images; dp++)
+
+    thpool_t pool;
+    if (thpool_init(pool, thpool_default_threads()) < 0)
     {
-        mnist->data[dp] = mnist->result_data[dp];
+        printf("Error: Thread pool creation failure\n");
+        return 1;
     }
-    gettimeofday(&end, NULL);
-    total_time += get_time_elapsed(start, end);
 
-    printf("\nTotal time: %.3f ms\n", total_time * 1000);
-    printf("Amortized time per image: %.3f ms\n", total_time * 1000 / mnist->num_images);
+    // $VHSS_BATCH switches to streaming the images in batches of that size
+    int batch = image_stream_default_batch();
+    int status = batch > 0 ? run_stream(pool, model, sweights, batch) : run_batch(pool, model, sweights);
 
     // 释放内存
-    free_mnist_data(mnist);
-    return 0;
-}
\ No newline at end of file
+    thpool_clear(pool);
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        smatrix_clear(sweights[l]);
+    }
+    free(sweights);
+    model_clear(model);
+    return status;
+}
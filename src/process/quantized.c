@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <lib-freivalds.h>
+#include <lib-idx.h>
+#include <lib-igemm.h>
+#include <lib-model.h>
+#include <lib-qgemm.h>
+#include <lib-sgemm.h>
+#include <lib-stream.h>
+#include <lib-thpool.h>
+
+#define INITIAL_IMAGE_SIZE 784 // 28*28 pixels
+#define EVAL_IMAGES 5000        // images scored, as in original.c
+#define CALIBRATION_IMAGES 1000 // images after the scored ones used to pick the activation scales
+#define READ_BATCH 1000         // images per batch of the stream the images are read through
+
+double get_time_elapsed(struct timeval start, struct timeval end)
+{
+    return ((end.tv_sec - start.tv_sec) * 1000000u + end.tv_usec - start.tv_usec) / 1.e6;
+}
+
+// at most limit images, IDX or text, gathered from an image stream into one array
+float *read_images(const char *filename, int limit, int *num_images)
+{
+    image_stream_t stream;
+    if (image_stream_open(stream, filename, INITIAL_IMAGE_SIZE, READ_BATCH, limit) < 0)
+    {
+        printf("Error: Can't open the file %s\n", filename);
+        return NULL;
+    }
+    float *images = (float *)malloc((size_t)limit * INITIAL_IMAGE_SIZE * sizeof(float));
+    if (!images)
+    {
+        printf("Error: Image data memory allocation failure\n");
+        image_stream_close(stream);
+        return NULL;
+    }
+
+    const float *batch;
+    int count = 0, n;
+    while ((n = image_stream_next(stream, &batch)) > 0)
+    {
+        memcpy(images + (size_t)count * INITIAL_IMAGE_SIZE, batch, (size_t)n * INITIAL_IMAGE_SIZE * sizeof(float));
+        count += n;
+    }
+    image_stream_close(stream);
+    if (n < 0 || count == 0)
+    {
+        free(images);
+        return NULL;
+    }
+    *num_images = count;
+    return images;
+}
+
+// the labels of the first n images, NULL unless all of them are there
+int *read_labels(const char *filename, int n)
+{
+    FILE *file = image_labels_open(filename);
+    if (!file)
+    {
+        printf("Error: Can't open the labels file %s\n", filename);
+        return NULL;
+    }
+    int *labels = (int *)malloc(n * sizeof(int));
+    if (labels && image_labels_next(file, labels, n) < n)
+    {
+        free(labels);
+        labels = NULL;
+    }
+    fclose(file);
+    return labels;
+}
+
+// the ReLU model of original.c in the three number formats compared here
+typedef struct
+{
+    int num_layers;
+    const struct model_layer_struct *layers; // shapes, from the parameter file
+    int width;                               // widest layer input or output
+    smatrix_t *sweight;                      // FP32 reference
+    qmatrix_t *qweight;                      // weights x100, as on the secure path
+    int32_t **qbia;                          // bias x10000
+    imatrix_t *iweight;                      // per-channel int8
+    float *input_scale;                      // int8 scale of the input of each layer
+} QuantizedModel;
+
+typedef struct
+{
+    int correct;
+    int aligned;
+    double time;
+} RunResult;
+
+int create_model(QuantizedModel *model, const model_t params)
+{
+    int num_layers = params->num_layers;
+    model->num_layers = num_layers;
+    model->layers = params->layers;
+    model->width = model_max_width(params);
+    model->sweight = (smatrix_t *)calloc(num_layers, sizeof(smatrix_t));
+    model->qweight = (qmatrix_t *)calloc(num_layers, sizeof(qmatrix_t));
+    model->qbia = (int32_t **)calloc(num_layers, sizeof(int32_t *));
+    model->iweight = (imatrix_t *)calloc(num_layers, sizeof(imatrix_t));
+    model->input_scale = (float *)calloc(num_layers, sizeof(float));
+    if (!model->sweight || !model->qweight || !model->qbia || !model->iweight || !model->input_scale)
+    {
+        printf("Error: Model memory allocation failure\n");
+        return -1;
+    }
+
+    for (int l = 0; l < num_layers; l++)
+    {
+        const struct model_layer_struct *layer = &params->layers[l];
+        if (smatrix_init(model->sweight[l], layer->rows, layer->cols) < 0 ||
+            qmatrix_init(model->qweight[l], layer->rows, layer->cols) < 0 ||
+            imatrix_init(model->iweight[l], layer->rows, layer->cols) < 0)
+        {
+            printf("Error: Weight memory allocation failure\n");
+            return -1;
+        }
+        model->qbia[l] = (int32_t *)malloc(layer->rows * sizeof(int32_t));
+        if (!model->qbia[l])
+        {
+            printf("Error: Bias memory allocation failure\n");
+            return -1;
+        }
+
+        smatrix_pack(model->sweight[l], layer->weight, layer->bias);
+        if (layer->weight_s16 != NULL && layer->scale_s16 == LINEAR_WEIGHT_SCALE)
+        {
+            qmatrix_load(model->qweight[l], layer->weight_s16); // pre-quantized by model-convert
+        }
+        else
+        {
+            qmatrix_quantize(model->qweight[l], layer->weight, LINEAR_WEIGHT_SCALE);
+        }
+        for (int i = 0; i < layer->rows; i++)
+        {
+            model->qbia[l][i] = (int32_t)roundf(layer->bias[i] * LINEAR_BIAS_SCALE);
+        }
+        if (layer->weight_s8 != NULL)
+        {
+            imatrix_load(model->iweight[l], layer->weight_s8, layer->scale_s8, layer->bias);
+        }
+        else
+        {
+            imatrix_quantize(model->iweight[l], layer->weight, layer->bias);
+        }
+    }
+    return 0;
+}
+
+void free_model(QuantizedModel *model)
+{
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        smatrix_clear(model->sweight[l]);
+        qmatrix_clear(model->qweight[l]);
+        imatrix_clear(model->iweight[l]);
+        free(model->qbia[l]);
+    }
+    free(model->sweight);
+    free(model->qweight);
+    free(model->qbia);
+    free(model->iweight);
+    free(model->input_scale);
+}
+
+// static int8 activation scales: the largest FP32 activation of each layer input over the calibration images
+int calibrate_model(thpool_t pool, QuantizedModel *model, const float *images, int num_images)
+{
+    float *input = (float *)malloc((size_t)num_images * model->width * sizeof(float));
+    float *output = (float *)malloc((size_t)num_images * model->width * sizeof(float));
+    if (!input || !output)
+    {
+        printf("Error: Calibration memory allocation failure\n");
+        free(input);
+        free(output);
+        return -1;
+    }
+
+    model->input_scale[0] = igemm_scale(images, model->layers[0].cols, model->layers[0].cols, num_images);
+    const float *x = images;
+    size_t x_stride = model->layers[0].cols;
+    for (int l = 1; l < model->num_layers; l++)
+    {
+        int rows = model->layers[l - 1].rows;
+        sgemm_layer(pool, model->sweight[l - 1], sgemm_relu, x, x_stride, output, rows, num_images);
+        model->input_scale[l] = igemm_scale(output, rows, rows, num_images);
+
+        float *swap = input;
+        input = output;
+        output = swap;
+        x = input;
+        x_stride = rows;
+    }
+
+    free(input);
+    free(output);
+    return 0;
+}
+
+// index of the largest logit of every image
+void predict_labels(const float *logits, int outputs, int num_images, int *labels)
+{
+    for (int img = 0; img < num_images; img++)
+    {
+        int max_idx = 0;
+        for (int i = 1; i < outputs; i++)
+        {
+            if (logits[(size_t)img * outputs + i] > logits[(size_t)img * outputs + max_idx])
+            {
+                max_idx = i;
+            }
+        }
+        labels[img] = max_idx;
+    }
+}
+
+// FP32 forward pass, the reference for both quantized paths
+double run_float(thpool_t pool, QuantizedModel *model, const float *images, int num_images, float *logits)
+{
+    struct timeval start, end;
+    float *hidden[2];
+    hidden[0] = (float *)malloc((size_t)num_images * model->width * sizeof(float));
+    hidden[1] = (float *)malloc((size_t)num_images * model->width * sizeof(float));
+    if (!hidden[0] || !hidden[1])
+    {
+        printf("Error: Activation memory allocation failure\n");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    const float *x = images;
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        const struct model_layer_struct *layer = &model->layers[l];
+        bool last = l == model->num_layers - 1;
+        float *y = last ? logits : hidden[l % 2];
+        sgemm_layer(pool, model->sweight[l], last ? sgemm_identity : sgemm_relu, x, layer->cols, y, layer->rows,
+                    num_images);
+        x = y;
+    }
+    gettimeofday(&end, NULL);
+
+    free(hidden[0]);
+    free(hidden[1]);
+    return get_time_elapsed(start, end);
+}
+
+// the x100 / x10000 fixed-point arithmetic of the secure path, computed in the clear
+double run_fixed_point(thpool_t pool, QuantizedModel *model, const float *images, int num_images, float *logits)
+{
+    struct timeval start, end;
+    int32_t *input = (int32_t *)malloc((size_t)num_images * model->width * sizeof(int32_t));
+    int32_t *output = (int32_t *)malloc((size_t)num_images * model->width * sizeof(int32_t));
+    if (!input || !output)
+    {
+        printf("Error: Activation memory allocation failure\n");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    for (size_t i = 0; i < (size_t)num_images * model->layers[0].cols; i++)
+    {
+        input[i] = (int32_t)roundf(images[i] * LINEAR_INPUT_SCALE);
+    }
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        const struct model_layer_struct *layer = &model->layers[l];
+        struct qgemm_job_struct job = {model->qweight[l], model->qbia[l], input, 1, layer->cols, NULL, 0,
+                                       output, 1, layer->rows, num_images};
+        qgemm_s32_run(pool, &job, 1);
+        for (size_t i = 0; i < (size_t)num_images * layer->rows; i++)
+        {
+            float value = (float)output[i] / 10000.0f;
+            if (l == model->num_layers - 1)
+            {
+                logits[i] = value;
+            }
+            else
+            {
+                input[i] = (int32_t)roundf((value > 0 ? value : 0) * LINEAR_INPUT_SCALE);
+            }
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    free(input);
+    free(output);
+    return get_time_elapsed(start, end);
+}
+
+// per-channel int8 weights, per-tensor int8 activations requantized between layers
+double run_int8(thpool_t pool, QuantizedModel *model, const float *images, int num_images, float *logits)
+{
+    struct timeval start, end;
+    int8_t *act[2];
+    act[0] = (int8_t *)malloc((size_t)num_images * igemm_ld(model->width));
+    act[1] = (int8_t *)malloc((size_t)num_images * igemm_ld(model->width));
+    if (!act[0] || !act[1])
+    {
+        printf("Error: Activation memory allocation failure\n");
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    int inputs = model->layers[0].cols;
+    igemm_quantize(images, inputs, inputs, model->input_scale[0], act[0], igemm_ld(inputs), num_images);
+    for (int l = 0; l < model->num_layers; l++)
+    {
+        const struct model_layer_struct *layer = &model->layers[l];
+        const int8_t *x = act[l % 2];
+        if (l == model->num_layers - 1)
+        {
+            igemm_layer_f32(pool, model->iweight[l], false, x, model->input_scale[l], igemm_ld(layer->cols), logits,
+                            layer->rows, num_images);
+        }
+        else
+        {
+            igemm_layer_s8(pool, model->iweight[l], true, x, model->input_scale[l], igemm_ld(layer->cols),
+                           act[(l + 1) % 2], model->input_scale[l + 1], igemm_ld(layer->rows), num_images);
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    free(act[0]);
+    free(act[1]);
+    return get_time_elapsed(start, end);
+}
+
+RunResult score_run(const float *logits, int outputs, int num_images, double time, const int *true_labels, const int *predicted_labels,
+                    int *labels)
+{
+    RunResult result = {0, 0, time};
+
+    predict_labels(logits, outputs, num_images, labels);
+    for (int img = 0; img < num_images; img++)
+    {
+        if (labels[img] == true_labels[img])
+        {
+            result.correct++;
+        }
+        if (labels[img] == predicted_labels[img])
+        {
+            result.aligned++;
+        }
+    }
+    return result;
+}
+
+void print_run(const char *name, RunResult run, const int *labels, RunResult reference, const int *reference_labels,
+               int num_images)
+{
+    int agreed = 0;
+    for (int img = 0; img < num_images; img++)
+    {
+        if (labels[img] == reference_labels[img])
+        {
+            agreed++;
+        }
+    }
+
+    printf("\n%s:\n", name);
+    printf("----------------------------------------\n");
+    printf("Correct prediction: %d\n", run.correct);
+    printf("Accuracy: %.2f%%\n", (float)run.correct / num_images * 100);
+    printf("Aligned prediction: %d\n", run.aligned);
+    printf("Rate: %.2f%%\n", (float)run.aligned / num_images * 100);
+    printf("Agreement with FP32: %.2f%%\n", (float)agreed / num_images * 100);
+    printf("Total time: %.3f ms\n", run.time * 1000);
+    printf("Amortized time per image: %.3f ms\n", run.time * 1000 / num_images);
+    printf("Speedup over FP32: %.2fx\n", reference.time / run.time);
+}
+
+int main()
+{
+    int num_loaded;
+    float *images = read_images(idx_images_path("/home/ashlynsun/vhss-to-fnn/data/mnist_images.txt"),
+                                EVAL_IMAGES + CALIBRATION_IMAGES, &num_loaded);
+    if (!images)
+    {
+        printf("Failed to read MNIST data\n");
+        return 1;
+    }
+    int num_images = num_loaded < EVAL_IMAGES ? num_loaded : EVAL_IMAGES;
+
+    model_t params;
+    if (model_read(params, model_default_path("/home/ashlynsun/vhss-to-fnn/data/model_parameters.txt")) < 0)
+    {
+        printf("Failed to read model parameters\n");
+        return 1;
+    }
+    if (model_inputs(params) != INITIAL_IMAGE_SIZE)
+    {
+        printf("Error: The model takes %d inputs, images have %d pixels\n", model_inputs(params), INITIAL_IMAGE_SIZE);
+        return 1;
+    }
+    int outputs = model_outputs(params);
+
+    // calibrate on the images following the scored ones, or on the scored ones when there are none left
+    const float *calibration = images;
+    int num_calibration = num_images < CALIBRATION_IMAGES ? num_images : CALIBRATION_IMAGES;
+    if (num_loaded >= num_images + CALIBRATION_IMAGES)
+    {
+        calibration = images + (size_t)num_images * INITIAL_IMAGE_SIZE;
+    }
+
+    int *true_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/mnist_labels.txt", num_images);
+    int *predicted_labels = read_labels("/home/ashlynsun/vhss-to-fnn/data/predicted_labels.txt", num_images);
+    if (!true_labels || !predicted_labels)
+    {
+        printf("Failed to read labels\n");
+        return 1;
+    }
+
+    thpool_t pool;
+    if (thpool_init(pool, thpool_default_threads()) < 0)
+    {
+        printf("Error: Thread pool creation failure\n");
+        return 1;
+    }
+
+    QuantizedModel model;
+    if (create_model(&model, params) < 0 || calibrate_model(pool, &model, calibration, num_calibration) < 0)
+    {
+        return 1;
+    }
+
+    float *logits = (float *)malloc((size_t)num_images * outputs * sizeof(float));
+    int *float_labels = (int *)malloc(num_images * sizeof(int));
+    int *fixed_labels = (int *)malloc(num_images * sizeof(int));
+    int *int8_labels = (int *)malloc(num_images * sizeof(int));
+    if (!logits || !float_labels || !fixed_labels || !int8_labels)
+    {
+        printf("Error: Memory allocation failure\n");
+        return 1;
+    }
+
+    double time = run_float(pool, &model, images, num_images, logits);
+    RunResult float_run = score_run(logits, outputs, num_images, time, true_labels, predicted_labels, float_labels);
+    time = run_fixed_point(pool, &model, images, num_images, logits);
+    RunResult fixed_run = score_run(logits, outputs, num_images, time, true_labels, predicted_labels, fixed_labels);
+    time = run_int8(pool, &model, images, num_images, logits);
+    RunResult int8_run = score_run(logits, outputs, num_images, time, true_labels, predicted_labels, int8_labels);
+
+    printf("Total sample size: %d\n", num_images);
+    printf("Calibration sample size: %d\n", num_calibration);
+    print_run("FP32", float_run, float_labels, float_run, float_labels, num_images);
+    print_run("Fixed point x100 (secure path scaling)", fixed_run, fixed_labels, float_run, float_labels, num_images);
+    print_run("INT8 per-channel", int8_run, int8_labels, float_run, float_labels, num_images);
+
+    printf("\nAccuracy cost against FP32:\n");
+    printf("----------------------------------------\n");
+    printf("Fixed point x100: %+.2f points\n", (float)(fixed_run.correct - float_run.correct) / num_images * 100);
+    printf("INT8 per-channel: %+.2f points\n\n", (float)(int8_run.correct - float_run.correct) / num_images * 100);
+
+    // 释放内存
+    free(logits);
+    free(float_labels);
+    free(fixed_labels);
+    free(int8_labels);
+    free(true_labels);
+    free(predicted_labels);
+    free_model(&model);
+    model_clear(params);
+    thpool_clear(pool);
+    free(images);
+    return 0;
+}
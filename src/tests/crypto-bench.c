@@ -0,0 +1,316 @@
+/*
+ * Micro-benchmark of the cryptographic primitives of the scheme.
+ *
+ * For every modulus size and every k a key pair is generated, then each
+ * primitive is sampled for a fixed period with
+ * perform_clock_cycles_sampling_period. One tab-separated row per primitive
+ * and configuration is written to the output, times in microseconds, so runs
+ * before and after a change can be compared with any table tool.
+ *
+ * With $VHSS_PERF set the hardware events of each sample are counted too, by
+ * the sampling macro itself through set_sampling_counters, and appended to
+ * the row divided by the number of samples. They are read outside the timed
+ * interval and cover the sampled code alone, not the cleanup code.
+ *
+ * A primitive that gives a wrong result fails the run, after the remaining
+ * configurations are measured.
+ *
+ * usage: crypto-bench [-m 256,512,...] [-k 16,32,...] [-t seconds] [-o file]
+ */
+
+#include "../demo.h"
+#include "../poly_vri/vpoly.h"
+#include "../prf/acef.h"
+#include <lib-perf.h>
+#include <lib-timing.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define sampling_time 1 /* secondi */
+#define max_samples 100000
+#define keygen_samples 5
+#define max_sizes 16
+#define min_prime_bits 64 /* of p' = (p - 1) / 2^k, below it keygen rarely ends */
+#define base_size 48      /* of the encryption randomness, as in the drivers */
+#define random_draws 100  /* per sample of the random draws */
+
+static const unsigned int default_mod_bits[] = {256, 512, 1024, 2048, 3072};
+static const unsigned int default_k[] = {16, 32, 64, 128};
+
+static bool counting = false;
+static perf_group_t perf_group;
+
+/* prs_keys_clear leaves the decryption table entries allocated */
+static void release_keys(prs_keys_t *keys) {
+    for (unsigned int i = 0; keys[0]->d != NULL && i + 1 < keys[0]->k; i++)
+        mpz_clear(keys[0]->d[i]);
+    prs_keys_clear(keys);
+}
+
+/* comma separated list of positive sizes, returns their number or -1 */
+static int parse_sizes(const char *arg, unsigned int *sizes) {
+    int n = 0;
+    char *end;
+    do {
+        long size = strtol(arg, &end, 10);
+        if (end == arg || size <= 0 || n == max_sizes)
+            return -1;
+        sizes[n++] = (unsigned int)size;
+        arg = end + 1;
+    } while (*end == ',');
+    return *end == '\0' ? n : -1;
+}
+
+static void print_row(FILE *out, const char *name, unsigned int mod_bits, unsigned int k, const stats_t stats,
+                      const perf_values_t counters) {
+    fprintf(out, "%s\t%u\t%u\t%zu\t%zu\t%.3lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf", name, mod_bits, k, stats->size,
+            stats->ksize, stats->median, stats->stddev, stats->mean, stats->min, stats->max);
+    if (counting) {
+        for (int c = 0; c < PERF_COUNTERS; c++) {
+            if (counters->available[c])
+                fprintf(out, "\t%.0lf", (double)counters->count[c] / stats->size);
+            else
+                fprintf(out, "\t-");
+        }
+        if (counters->available[perf_cycles] && counters->available[perf_instructions] &&
+            counters->count[perf_cycles] > 0)
+            fprintf(out, "\t%.3lf", (double)counters->count[perf_instructions] / counters->count[perf_cycles]);
+        else
+            fprintf(out, "\t-");
+    }
+    fprintf(out, "\n");
+    fflush(out);
+    fprintf_short_stats(stderr, name, stats, "");
+    if (counting)
+        fprintf_perf(stderr, "  per sample", counters, stats->size, "");
+}
+
+/* -1 if a primitive gives a wrong result */
+static int bench(FILE *out, unsigned int mod_bits, unsigned int k, double period) {
+    int status = 0;
+    stats_t stats;
+    perf_values_t counters;
+    prs_keys_t keys[1];
+    prs_plaintext_t pt, dec, share_pt, co_pt;
+    prs_ciphertext_t ct, c, s, sigma, eval_ct;
+    mpz_t k1, k2, alpha, phi, tmp, sigma_1, r;
+    uint8_t digest[HASH_LEN];
+
+    fprintf(stderr, "mod_bits=%u k=%u\n", mod_bits, k);
+    if (counting)
+        set_sampling_counters(perf_group, counters);
+    prs_keys_init(keys);
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, keygen_samples, tu_micros,
+                                         { prs_generate_keys(keys, k, mod_bits, prng); },
+                                         {
+                                             release_keys(keys);
+                                             prs_keys_init(keys);
+                                         });
+    print_row(out, "keygen", mod_bits, k, stats, counters);
+
+    /* the globals of the scheme used by evaluate, f, prob_gen and verify */
+    mpz_set(N, keys[0]->n);
+    mpz_set(k_2, keys[0]->k_2);
+
+    prs_plaintext_init(pt);
+    prs_plaintext_init(dec);
+    prs_plaintext_init(share_pt);
+    prs_plaintext_init(co_pt);
+    prs_ciphertext_init(ct);
+    prs_ciphertext_init(c);
+    prs_ciphertext_init(s);
+    prs_ciphertext_init(sigma);
+    prs_ciphertext_init(eval_ct);
+    mpz_inits(k1, k2, alpha, phi, tmp, sigma_1, r, NULL);
+    unsigned int base = base_size < k ? base_size : k;
+
+    /* the encryption randomness, from the shared GMP state and from the
+     * stream of the thread; a single draw is below the timer resolution */
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, max_samples, tu_micros,
+                                         {
+                                             for (int d = 0; d < random_draws; d++)
+                                                 mpz_urandomm(tmp, prng, N);
+                                         }, {});
+    print_row(out, "mpz_urandomm_x100", mod_bits, k, stats, counters);
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, max_samples, tu_micros,
+                                         {
+                                             for (int d = 0; d < random_draws; d++)
+                                                 mpz_prg_urandomm(tmp, prg_local(), N);
+                                         }, {});
+    print_row(out, "prg_urandomm_x100", mod_bits, k, stats, counters);
+
+    mpz_urandomb(pt->m, prng, k);
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, max_samples, tu_micros,
+                                         { prs_encrypt(ct, k, keys[0]->y, N, k_2, pt, prg_local(), base); }, {});
+    print_row(out, "prs_encrypt", mod_bits, k, stats, counters);
+
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, max_samples, tu_micros,
+                                         { prs_decrypt(dec, keys[0]->p, k, keys[0]->d, ct); }, {});
+    print_row(out, "prs_decrypt", mod_bits, k, stats, counters);
+    if (mpz_cmp(pt->m, dec->m) != 0) {
+        fprintf(stderr, "mod_bits=%u k=%u: decryption does not give back the plaintext\n", mod_bits, k);
+        status = -1;
+    }
+
+    /* one server's evaluation as in process_rounded_val: c is its encrypted
+     * share, co_1 the other share shifted by the polynomial */
+    uint8_t *k1_bytes = generate_seed(prg_local(), k1);
+    uint8_t *k2_bytes = generate_seed(prg_local(), k2);
+    mpz_sub_ui(phi, keys[0]->p, 1);
+    mpz_sub_ui(tmp, keys[0]->q, 1);
+    mpz_mul(phi, phi, tmp);
+    do {
+        mpz_urandomm(alpha, prng, phi);
+        mpz_add_ui(alpha, alpha, 1);
+        mpz_gcd(tmp, alpha, phi);
+    } while (mpz_cmp_ui(tmp, 1) != 0);
+    mpz_urandomb(share_pt->m, prng, k);
+    prs_encrypt(c, k, keys[0]->y, N, k_2, share_pt, prg_local(), base);
+    mpz_urandomb(co_1, prng, k);
+    mpz_urandomb(co_pt->m, prng, k);
+    prs_encrypt(eval_ct, k, keys[0]->y, N, k_2, co_pt, prg_local(), base);
+
+    size_t share_size = (mpz_sizeinbase(share_pt->m, 2) + 7) / 8;
+    uint8_t *share_bytes = malloc(share_size);
+    mpz_export(share_bytes, &share_size, 1, sizeof(uint8_t), 0, 0, share_pt->m);
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, max_samples, tu_micros,
+                                         { hmac(digest, share_bytes, (int)share_size, k1_bytes); }, {});
+    print_row(out, "hmac", mod_bits, k, stats, counters);
+    free(share_bytes);
+
+    uint8_t delta[SEC_PARAM];
+    get_delta(delta, k1_bytes, share_pt->m);
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, max_samples, tu_micros,
+                                         { f(delta, 1, k1_bytes, k2_bytes, r, keys[0]->g, keys[0]->n_prime); }, {});
+    print_row(out, "f", mod_bits, k, stats, counters);
+
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(
+        stats, period, max_samples, tu_micros,
+        { prob_gen(delta, k1_bytes, k2_bytes, sigma_1, alpha, keys[0]->g, keys[0]->n_prime, r, c->c); }, {});
+    print_row(out, "prob_gen", mod_bits, k, stats, counters);
+
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(stats, period, max_samples, tu_micros,
+                                         {
+                                             mpz_set_ui(s->c, 1);
+                                             evaluate(s, c->c, eval_ct);
+                                         },
+                                         {});
+    print_row(out, "evaluate", mod_bits, k, stats, counters);
+
+    mpz_set_ui(sigma->c, 1);
+    evaluate(sigma, sigma_1, eval_ct);
+    bool passed = false;
+    perf_values_clear(counters);
+    perform_clock_cycles_sampling_period(
+        stats, period, max_samples, tu_micros,
+        { passed = verify(s->c, sigma->c, r, alpha, co_1, keys[0]->y, eval_ct); }, {});
+    print_row(out, "verify", mod_bits, k, stats, counters);
+    if (!passed) {
+        fprintf(stderr, "mod_bits=%u k=%u: verification of an honest evaluation failed\n", mod_bits, k);
+        status = -1;
+    }
+
+    free(k1_bytes);
+    free(k2_bytes);
+    mpz_clears(k1, k2, alpha, phi, tmp, sigma_1, r, NULL);
+    prs_plaintext_clear(pt);
+    prs_plaintext_clear(dec);
+    prs_plaintext_clear(share_pt);
+    prs_plaintext_clear(co_pt);
+    prs_ciphertext_clear(ct);
+    prs_ciphertext_clear(c);
+    prs_ciphertext_clear(s);
+    prs_ciphertext_clear(sigma);
+    prs_ciphertext_clear(eval_ct);
+    release_keys(keys);
+    set_sampling_counters(NULL, NULL);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int mod_bits[max_sizes], ks[max_sizes];
+    int num_mod_bits = sizeof(default_mod_bits) / sizeof(default_mod_bits[0]);
+    int num_ks = sizeof(default_k) / sizeof(default_k[0]);
+    memcpy(mod_bits, default_mod_bits, sizeof(default_mod_bits));
+    memcpy(ks, default_k, sizeof(default_k));
+    double period = sampling_time;
+    FILE *out = stdout;
+    int status = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:k:t:o:")) != -1) {
+        switch (opt) {
+        case 'm':
+            num_mod_bits = parse_sizes(optarg, mod_bits);
+            break;
+        case 'k':
+            num_ks = parse_sizes(optarg, ks);
+            break;
+        case 't':
+            period = atof(optarg);
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL) {
+                fprintf(stderr, "can't open %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            num_mod_bits = -1;
+        }
+        if (num_mod_bits < 0 || num_ks < 0 || period <= 0) {
+            fprintf(stderr, "usage: %s [-m 256,512,...] [-k 16,32,...] [-t seconds] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    gmp_randinit_default(prng);
+    gmp_randseed_os_rng(prng, prng_sec_level);
+    mpz_inits(N, k_2, co_1, co_2, NULL);
+
+    fprintf(stderr, "Calibrating timing tools...\n");
+    calibrate_clock_cycles_ratio();
+    detect_clock_cycles_overhead();
+    perf_group->leader = -1;
+    if (perf_enabled()) {
+        counting = true;
+        if (perf_group_open(perf_group, false) == 0)
+            fprintf(stderr, "Hardware counters not available, columns left empty\n");
+    }
+
+    fprintf(out, "primitive\tmod_bits\tk\tsamples\tkernel\tmedian_us\tstddev_us\tmean_us\tmin_us\tmax_us");
+    if (counting)
+        for (int c = 0; c < PERF_COUNTERS; c++)
+            fprintf(out, "\t%s", perf_counter_name((perf_counter_t)c));
+    fprintf(out, "%s\n", counting ? "\tipc" : "");
+    for (int m = 0; m < num_mod_bits; m++) {
+        for (int j = 0; j < num_ks; j++) {
+            if (ks[j] < 2 || mod_bits[m] / 2 < ks[j] + min_prime_bits) {
+                fprintf(stderr, "mod_bits=%u k=%u: skipped, k leaves p' too small\n", mod_bits[m], ks[j]);
+                continue;
+            }
+            if (bench(out, mod_bits[m], ks[j], period) < 0)
+                status = 1;
+        }
+    }
+
+    if (counting)
+        perf_group_close(perf_group);
+    if (out != stdout)
+        fclose(out);
+    mpz_clears(N, k_2, co_1, co_2, NULL);
+    gmp_randclear(prng);
+    return status;
+}
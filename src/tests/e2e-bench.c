@@ -0,0 +1,440 @@
+/*
+ * End-to-end throughput benchmark of the inference drivers.
+ *
+ * Every variant is run as its own process over the swept thread counts and
+ * batch sizes, a few times per configuration. The batch sizes default to the
+ * ones that fit each driver: the secure scheme evaluates a single batch of a
+ * few images, the other drivers stream the whole dataset. A run gives the
+ * wall-clock throughput of the whole process, the per-image latency
+ * percentiles the driver reports and the peak RSS of the process. The summary
+ * is written as a tab-separated table that can be stored and given back with
+ * -c as the baseline: a configuration whose throughput is significantly lower
+ * or whose latency is significantly higher, by a Welch t-test on the stats_t
+ * of the runs, or whose peak RSS grew beyond the tolerance, is reported and
+ * makes the exit status 2. The t-test needs a variance on both sides, so a
+ * comparison takes enough runs to keep two of them after the kernel cut, and
+ * a configuration whose runs all agree is reported as not testable.
+ *
+ * usage: e2e-bench [-d dir] [-v original,fnn,...] [-b 0,64,...] [-t 1,2,...]
+ *                  [-r runs] [-x tolerance%] [-o file] [-c baseline]
+ */
+
+#include <lib-timing.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#define max_sizes 16
+#define max_variants 8
+#define max_configs 1024
+#define default_runs 5
+#define default_tolerance 5.0 /* % */
+#define field_size 64
+
+struct variant_struct {
+    const char *name;
+    int batches[max_sizes]; /* swept through $VHSS_BATCH unless -b is given, 0 leaves it unset */
+    int num_batches;
+};
+
+static const struct variant_struct variants[] = {{"original", {0, 64, 512}, 3},
+                                                 {"fnn", {0, 64, 512}, 3},
+                                                 {"linear-vhss-to-fnn", {0, 64, 512}, 3},
+                                                 {"vhss-to-fnn", {1, 2, 4}, 3}};
+#define num_known_variants (int)(sizeof(variants) / sizeof(variants[0]))
+
+struct result_struct {
+    char variant[field_size];
+    int batch, threads;
+    stats_t throughput; /* images/s */
+    stats_t p50, p99;   /* ms */
+    long rss;           /* KB */
+};
+
+struct run_struct {
+    int images;
+    double wall; /* s */
+    double p50, p99;
+    long rss;
+};
+
+/* comma separated list of sizes, returns their number or -1 */
+static int parse_sizes(const char *arg, int *sizes, int min) {
+    int n = 0;
+    char *end;
+    do {
+        long size = strtol(arg, &end, 10);
+        if (end == arg || size < min || n == max_sizes)
+            return -1;
+        sizes[n++] = (int)size;
+        arg = end + 1;
+    } while (*end == ',');
+    return *end == '\0' ? n : -1;
+}
+
+static int parse_variants(char *arg, const struct variant_struct **selected) {
+    int n = 0;
+    for (char *save, *name = strtok_r(arg, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        int v = 0;
+        while (v < num_known_variants && strcmp(variants[v].name, name) != 0)
+            v++;
+        if (v == num_known_variants || n == max_variants)
+            return -1;
+        selected[n++] = &variants[v];
+    }
+    return n;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* runs path with the given settings and reads what it reports */
+static int run_driver(const char *path, int batch, int threads, struct run_struct *run) {
+    int fds[2];
+    if (pipe(fds) < 0)
+        return -1;
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        char value[field_size];
+        snprintf(value, sizeof(value), "%d", threads);
+        setenv("VHSS_THREADS", value, 1);
+        if (batch > 0) {
+            snprintf(value, sizeof(value), "%d", batch);
+            setenv("VHSS_BATCH", value, 1);
+        } else {
+            unsetenv("VHSS_BATCH");
+        }
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(path, path, (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    size_t size = 0, capacity = 1 << 16;
+    char *output = malloc(capacity);
+    ssize_t n;
+    while (output != NULL && (n = read(fds[0], output + size, capacity - size - 1)) > 0) {
+        size += n;
+        if (capacity - size < 4096) {
+            char *grown = realloc(output, capacity * 2);
+            if (grown == NULL) {
+                free(output);
+                output = NULL;
+                break;
+            }
+            output = grown;
+            capacity *= 2;
+        }
+    }
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || output == NULL) {
+        free(output);
+        return -1;
+    }
+    run->wall = now() - start;
+    run->rss = usage.ru_maxrss;
+    output[size] = '\0';
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        free(output);
+        return -1;
+    }
+
+    const char *line = strstr(output, "Total sample size: ");
+    run->images = line != NULL ? atoi(line + strlen("Total sample size: ")) : 0;
+    line = strstr(output, "Latency p50: ");
+    bool latency = line != NULL && sscanf(line, "Latency p50: %lf ms, p99: %lf ms", &run->p50, &run->p99) == 2;
+    free(output);
+    if (!latency)
+        fprintf(stderr, "%s reports no latency\n", path);
+    return run->images > 0 && latency ? 0 : -1;
+}
+
+/* runs left by the kernel cut of extract_stats */
+static size_t kernel_size(int runs) {
+    elapsed_time_t *zeros = calloc(runs, sizeof(elapsed_time_t));
+    assert(zeros);
+    stats_t stats;
+    extract_stats(stats, zeros, runs, tu_nanos);
+    free(zeros);
+    return stats->ksize;
+}
+
+static int measure(const char *dir, const char *variant, int batch, int threads, int runs,
+                   struct result_struct *result) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, variant);
+    elapsed_time_t *throughput = malloc(runs * sizeof(elapsed_time_t));
+    elapsed_time_t *p50 = malloc(runs * sizeof(elapsed_time_t));
+    elapsed_time_t *p99 = malloc(runs * sizeof(elapsed_time_t));
+    assert(throughput && p50 && p99);
+
+    snprintf(result->variant, sizeof(result->variant), "%s", variant);
+    result->batch = batch;
+    result->threads = threads;
+    result->rss = 0;
+    int status = 0;
+    for (int r = 0; status == 0 && r < runs; r++) {
+        struct run_struct run;
+        status = run_driver(path, batch, threads, &run);
+        if (status < 0)
+            break;
+        throughput[r] = run.images / run.wall;
+        p50[r] = run.p50;
+        p99[r] = run.p99;
+        if (run.rss > result->rss)
+            result->rss = run.rss;
+    }
+    if (status == 0) {
+        extract_stats(result->throughput, throughput, runs, tu_nanos);
+        extract_stats(result->p50, p50, runs, tu_millis);
+        extract_stats(result->p99, p99, runs, tu_millis);
+    }
+    free(throughput);
+    free(p50);
+    free(p99);
+    return status;
+}
+
+static void print_header(FILE *out) {
+    fprintf(out, "variant\tbatch\tthreads\truns\tkernel\timages_per_s\tmean\tstddev\tp50_ms\tp50_mean\tp50_stddev\t"
+                 "p99_ms\tp99_mean\tp99_stddev\trss_kb\n");
+}
+
+static void print_result(FILE *out, const struct result_struct *r) {
+    fprintf(out, "%s\t%d\t%d\t%zu\t%zu\t%.3lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf\t%.3lf\t%ld\n",
+            r->variant, r->batch, r->threads, r->throughput->size, r->throughput->ksize, r->throughput->median,
+            r->throughput->mean, r->throughput->stddev, r->p50->median, r->p50->mean, r->p50->stddev, r->p99->median,
+            r->p99->mean, r->p99->stddev, r->rss);
+    fflush(out);
+}
+
+/* the table written by a previous run, returns the number of rows or -1 */
+static int read_baseline(const char *filename, struct result_struct *rows) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+        return -1;
+    char line[1024];
+    int n = 0;
+    while (n < max_configs && fgets(line, sizeof(line), file)) {
+        struct result_struct *r = &rows[n];
+        memset(r, 0, sizeof(*r));
+        if (sscanf(line, "%63s %d %d %zu %zu %lf %lf %lf %lf %lf %lf %lf %lf %lf %ld", r->variant, &r->batch,
+                   &r->threads, &r->throughput->size, &r->throughput->ksize, &r->throughput->median,
+                   &r->throughput->mean, &r->throughput->stddev, &r->p50->median, &r->p50->mean, &r->p50->stddev,
+                   &r->p99->median, &r->p99->mean, &r->p99->stddev, &r->rss) == 15) {
+            /* the latencies come from the same runs as the throughput */
+            r->p50->size = r->p99->size = r->throughput->size;
+            r->p50->ksize = r->p99->ksize = r->throughput->ksize;
+            n++;
+        }
+    }
+    fclose(file);
+    return n;
+}
+
+/* one-sided 95% quantiles of Student's t by degrees of freedom */
+static double t_critical(double df) {
+    static const double table[] = {6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812,
+                                   1.796, 1.782, 1.771, 1.761, 1.753, 1.746, 1.740, 1.734, 1.729, 1.725,
+                                   1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697};
+    int i = (int)floor(df);
+    if (i < 1)
+        return table[0];
+    return i <= 30 ? table[i - 1] : 1.645;
+}
+
+/* Welch's t of a drop from before to after, with its degrees of freedom;
+ * a rise is a drop from after to before. NAN when a side has a single run or
+ * neither has any variance: the difference cannot be tested */
+static double welch_t(const stats_t before, const stats_t after, double *df) {
+    double vb = before->stddev * before->stddev / before->ksize;
+    double va = after->stddev * after->stddev / after->ksize;
+    if (before->ksize < 2 || after->ksize < 2 || vb + va == 0.0) {
+        *df = NAN;
+        return NAN;
+    }
+    *df = (vb + va) * (vb + va) / (vb * vb / (before->ksize - 1) + va * va / (after->ksize - 1));
+    return (before->mean - after->mean) / sqrt(vb + va);
+}
+
+/* whether a change beyond the tolerance is significant */
+static bool significant(double change, double tolerance, double t, double df) {
+    return change > tolerance && !isnan(t) && t > t_critical(df);
+}
+
+static const char *describe_t(char *buffer, size_t size, double t, double df) {
+    if (isnan(t))
+        return "not testable";
+    snprintf(buffer, size, "t=%.2f, df=%.1f", t, df);
+    return buffer;
+}
+
+/* returns the number of regressions against the baseline */
+static int compare(const struct result_struct *results, int n, const struct result_struct *baseline, int m,
+                   double tolerance) {
+    int regressions = 0;
+    for (int i = 0; i < n; i++) {
+        const struct result_struct *r = &results[i];
+        const struct result_struct *b = NULL;
+        for (int j = 0; b == NULL && j < m; j++)
+            if (strcmp(baseline[j].variant, r->variant) == 0 && baseline[j].batch == r->batch &&
+                baseline[j].threads == r->threads)
+                b = &baseline[j];
+        if (b == NULL)
+            continue;
+
+        double df, t = welch_t(b->throughput, r->throughput, &df);
+        double change = (r->throughput->mean / b->throughput->mean - 1.0) * 100;
+        bool slower = significant(-change, tolerance, t, df);
+        /* the latencies regress when they rise */
+        double p50_df, p50_t = welch_t(r->p50, b->p50, &p50_df);
+        double p50_change = b->p50->mean > 0.0 ? (r->p50->mean / b->p50->mean - 1.0) * 100 : 0.0;
+        double p99_df, p99_t = welch_t(r->p99, b->p99, &p99_df);
+        double p99_change = b->p99->mean > 0.0 ? (r->p99->mean / b->p99->mean - 1.0) * 100 : 0.0;
+        bool later = significant(p50_change, tolerance, p50_t, p50_df) ||
+                     significant(p99_change, tolerance, p99_t, p99_df);
+        double rss_change = b->rss > 0 ? ((double)r->rss / b->rss - 1.0) * 100 : 0.0;
+        bool bigger = rss_change > tolerance;
+        char tests[3][field_size];
+        fprintf(stderr,
+                "%s batch=%d threads=%d: throughput %+.1f%% (%s), latency p50 %+.1f%% (%s), p99 %+.1f%% (%s), "
+                "rss %+.1f%%%s\n",
+                r->variant, r->batch, r->threads, change, describe_t(tests[0], field_size, t, df), p50_change,
+                describe_t(tests[1], field_size, p50_t, p50_df), p99_change,
+                describe_t(tests[2], field_size, p99_t, p99_df), rss_change,
+                slower || later || bigger ? "  REGRESSION" : "");
+        regressions += slower || later || bigger;
+    }
+    return regressions;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-d dir] [-v original,fnn,...] [-b 0,64,...] [-t 1,2,...] [-r runs] [-x tolerance%%] "
+            "[-o file] [-c baseline]\n",
+            name);
+}
+
+int main(int argc, char *argv[]) {
+    const struct variant_struct *selected[max_variants];
+    int num_selected = num_known_variants;
+    for (int v = 0; v < num_known_variants; v++)
+        selected[v] = &variants[v];
+    int batches[max_sizes], num_batches = 0; /* the defaults of each variant */
+    int threads[max_sizes], num_threads = 0;
+    int runs = default_runs;
+    double tolerance = default_tolerance;
+    const char *baseline_file = NULL;
+    FILE *out = stdout;
+
+    /* the drivers are looked for next to this program */
+    char dir[4096] = ".";
+    const char *slash = strrchr(argv[0], '/');
+    if (slash != NULL)
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - argv[0]), argv[0]);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int t = 1; t < cores && num_threads < max_sizes - 1; t *= 2)
+        threads[num_threads++] = t;
+    threads[num_threads++] = cores > 0 ? (int)cores : 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:v:b:t:r:x:o:c:")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'd':
+            snprintf(dir, sizeof(dir), "%s", optarg);
+            break;
+        case 'v':
+            ok = (num_selected = parse_variants(optarg, selected)) > 0;
+            break;
+        case 'b':
+            ok = (num_batches = parse_sizes(optarg, batches, 0)) > 0;
+            break;
+        case 't':
+            ok = (num_threads = parse_sizes(optarg, threads, 1)) > 0;
+            break;
+        case 'r':
+            ok = (runs = atoi(optarg)) > 0;
+            break;
+        case 'x':
+            ok = (tolerance = atof(optarg)) >= 0;
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL) {
+                fprintf(stderr, "can't open %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            baseline_file = optarg;
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (baseline_file != NULL && kernel_size(runs) < 2) {
+        fprintf(stderr, "-r %d keeps %zu run(s) after the kernel cut, a comparison needs at least 2\n", runs,
+                kernel_size(runs));
+        return 1;
+    }
+
+    struct result_struct *results = calloc(max_configs, sizeof(struct result_struct));
+    assert(results);
+    int num_results = 0, failures = 0;
+    print_header(out);
+    for (int v = 0; v < num_selected; v++) {
+        const int *sweep = num_batches > 0 ? batches : selected[v]->batches;
+        for (int b = 0; b < (num_batches > 0 ? num_batches : selected[v]->num_batches); b++) {
+            int batch = sweep[b];
+            for (int t = 0; t < num_threads && num_results < max_configs; t++) {
+                fprintf(stderr, "%s batch=%d threads=%d\n", selected[v]->name, batch, threads[t]);
+                if (measure(dir, selected[v]->name, batch, threads[t], runs, &results[num_results]) < 0) {
+                    fprintf(stderr, "%s/%s failed\n", dir, selected[v]->name);
+                    failures++;
+                    continue;
+                }
+                print_result(out, &results[num_results++]);
+            }
+        }
+    }
+    if (out != stdout)
+        fclose(out);
+
+    int regressions = 0;
+    if (baseline_file != NULL) {
+        struct result_struct *baseline = calloc(max_configs, sizeof(struct result_struct));
+        assert(baseline);
+        int m = read_baseline(baseline_file, baseline);
+        if (m < 0) {
+            fprintf(stderr, "can't read the baseline %s\n", baseline_file);
+            failures++;
+        } else {
+            regressions = compare(results, num_results, baseline, m, tolerance);
+            fprintf(stderr, "%d regression(s) against %s\n", regressions, baseline_file);
+        }
+        free(baseline);
+    }
+    free(results);
+    return failures > 0 ? 1 : regressions > 0 ? 2 : 0;
+}
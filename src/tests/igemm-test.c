@@ -0,0 +1,152 @@
+/*
+ * Test of the INT8 GEMM of lib-igemm.
+ *
+ * Both layers of the library are compared with a naive int32 product of the
+ * int8 weights and activations, rescaled, biased, rectified and requantized
+ * as the epilogue does. The scales and biases are powers of two or multiples
+ * of them, so the float epilogue is exact and the results must match to the
+ * bit whatever the microkernel the CPU selects (pmaddubsw on AVX2, vpdpbusd
+ * with AVX512-VNNI, the generic loop otherwise). The weights and activations
+ * span all of [-127, 127], the shapes leave partial panels, image slices and
+ * column quads, and one of them has the pool split the output features.
+ * $VHSS_IGEMM_KERNEL runs the test on a slower kernel than the CPU's best.
+ *
+ * usage: igemm-test
+ */
+
+#include <lib-igemm.h>
+#include <lib-prg.h>
+#include <lib-thpool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define test_threads 3
+#define x_scale (1.0f / 128)
+#define y_scale (1.0f / 16)
+
+struct shape_struct {
+    int rows, cols;
+    size_t n;
+};
+
+/* many panels over few images are split between the threads */
+static const struct shape_struct shapes[] = {{1, 1, 1}, {16, 32, 6}, {37, 75, 101}, {150, 130, 20}};
+#define num_shapes (int)(sizeof(shapes) / sizeof(shapes[0]))
+
+static int failures = 0;
+
+/* uniform in [-127, 127] */
+static int8_t draw_s8(const prg_t prg, uint64_t stream, uint64_t i) {
+    uint32_t word;
+    prg_words(prg, stream, i, &word, 1);
+    return (int8_t)((int)(word % 255) - 127);
+}
+
+/* the requantization of the epilogue */
+static int8_t requantize(float v) {
+    float q = v * (1.0f / y_scale);
+    if (q >= 127.0f)
+        return 127;
+    if (q <= -127.0f)
+        return -127;
+    return (int8_t)(int)(q + (q >= 0.0f ? 0.5f : -0.5f));
+}
+
+static void check(bool ok, const char *what, const struct shape_struct *shape, bool relu) {
+    if (!ok) {
+        printf("FAILED: %s (%dx%d, %zu images%s)\n", what, shape->rows, shape->cols, shape->n,
+               relu ? ", relu" : "");
+        failures++;
+    }
+}
+
+int main(void) {
+    uint8_t seed[PRG_SEED_BYTES] = {2};
+    prg_t prg;
+    prg_init(prg, seed);
+    uint64_t stream = 0;
+
+    thpool_t pool;
+    if (thpool_init(pool, test_threads) < 0) {
+        printf("can't start the thread pool\n");
+        return 1;
+    }
+
+    for (int s = 0; s < num_shapes; s++) {
+        const struct shape_struct *shape = &shapes[s];
+        size_t x_ld = igemm_ld(shape->cols), y_ld = igemm_ld(shape->rows);
+        int8_t *weight = malloc((size_t)shape->rows * shape->cols);
+        float *scale = malloc(shape->rows * sizeof(float));
+        float *bias = malloc(shape->rows * sizeof(float));
+        int8_t *x = malloc(shape->n * x_ld);
+        float *expected = malloc(shape->n * shape->rows * sizeof(float));
+        float *y_f32 = malloc(shape->n * shape->rows * sizeof(float));
+        int8_t *y_s8 = malloc(shape->n * y_ld);
+        imatrix_t w;
+        if (!weight || !scale || !bias || !x || !expected || !y_f32 || !y_s8 ||
+            imatrix_init(w, shape->rows, shape->cols) < 0) {
+            printf("out of memory\n");
+            return 1;
+        }
+
+        for (size_t i = 0; i < (size_t)shape->rows * shape->cols; i++)
+            weight[i] = draw_s8(prg, stream, i);
+        stream++;
+        for (int i = 0; i < shape->rows; i++) {
+            scale[i] = 1.0f / (float)(64 << (i % 3));
+            bias[i] = draw_s8(prg, stream, i) / 8.0f;
+        }
+        stream++;
+        memset(x, 0, shape->n * x_ld);
+        for (size_t j = 0; j < shape->n; j++)
+            for (int k = 0; k < shape->cols; k++)
+                x[j * x_ld + k] = draw_s8(prg, stream, j * shape->cols + k);
+        stream++;
+        imatrix_load(w, weight, scale, bias);
+
+        for (int relu = 0; relu < 2; relu++) {
+            for (size_t j = 0; j < shape->n; j++) {
+                for (int i = 0; i < shape->rows; i++) {
+                    int32_t acc = 0;
+                    for (int k = 0; k < shape->cols; k++)
+                        acc += (int32_t)weight[(size_t)i * shape->cols + k] * x[j * x_ld + k];
+                    float v = (float)acc * (x_scale * scale[i]) + bias[i];
+                    expected[j * shape->rows + i] = relu && v < 0.0f ? 0.0f : v;
+                }
+            }
+
+            memset(y_f32, 0, shape->n * shape->rows * sizeof(float));
+            igemm_layer_f32(pool, w, relu, x, x_scale, x_ld, y_f32, shape->rows, shape->n);
+            check(memcmp(y_f32, expected, shape->n * shape->rows * sizeof(float)) == 0, "igemm_layer_f32", shape,
+                  relu);
+
+            /* the padding of the int8 rows is cleared for the next layer */
+            memset(y_s8, 0x55, shape->n * y_ld);
+            igemm_layer_s8(pool, w, relu, x, x_scale, x_ld, y_s8, y_scale, y_ld, shape->n);
+            bool same = true;
+            for (size_t j = 0; j < shape->n; j++)
+                for (size_t i = 0; i < y_ld; i++)
+                    same &= y_s8[j * y_ld + i] ==
+                            (i < (size_t)shape->rows ? requantize(expected[j * shape->rows + i]) : 0);
+            check(same, "igemm_layer_s8", shape, relu);
+        }
+
+        imatrix_clear(w);
+        free(weight);
+        free(scale);
+        free(bias);
+        free(x);
+        free(expected);
+        free(y_f32);
+        free(y_s8);
+    }
+    thpool_clear(pool);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All igemm checks passed\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Test of the ChaCha20 PRG of lib-prg.
+ *
+ * The first block under the all-zero key, nonce (stream) and counter is the
+ * standard ChaCha20 keystream. The words of a stream must not depend on how
+ * they are asked for: every offset and every split of a range is compared
+ * with the range generated one block at a time, which runs the scalar block
+ * function alone, while the long ranges go through the eight-block AVX2 path
+ * on the CPUs that have it. The stream reader must hand out the same words.
+ *
+ * usage: prg-test
+ */
+
+#include <lib-prg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define test_words (40 * PRG_BLOCK_WORDS)
+#define test_streams 3
+
+/* ChaCha20 keystream of the all-zero key and nonce, block 0 */
+static const uint32_t zero_block[PRG_BLOCK_WORDS] = {
+    0xade0b876, 0x903df1a0, 0xe56a5d40, 0x28bd8653, 0xb819d2bd, 0x1aed8da0, 0xccef36a8, 0xc70d778b,
+    0x7c5941da, 0x8d485751, 0x3fe02477, 0x374ad8b8, 0xf4b8436a, 0x1ca11815, 0x69b687c3, 0x8665eeb2};
+
+static int failures = 0;
+
+static void check(int ok, const char *what, uint64_t stream, size_t offset, size_t count) {
+    if (!ok) {
+        printf("FAILED: %s (stream %lu, offset %zu, count %zu)\n", what, (unsigned long)stream, offset, count);
+        failures++;
+    }
+}
+
+int main(void) {
+    uint8_t seed[PRG_SEED_BYTES] = {0};
+    prg_t prg;
+    uint32_t block[PRG_BLOCK_WORDS];
+
+    prg_init(prg, seed);
+    prg_words(prg, 0, 0, block, PRG_BLOCK_WORDS);
+    check(memcmp(block, zero_block, sizeof(block)) == 0, "standard keystream", 0, 0, PRG_BLOCK_WORDS);
+
+    for (int i = 0; i < PRG_SEED_BYTES; i++)
+        seed[i] = (uint8_t)(i * 37 + 11);
+    prg_init(prg, seed);
+
+    static uint32_t reference[test_words], words[test_words];
+    for (uint64_t stream = 0; stream < test_streams; stream++) {
+        /* the whole range one block at a time, on the scalar path */
+        for (size_t b = 0; b < test_words / PRG_BLOCK_WORDS; b++)
+            prg_words(prg, stream, b * PRG_BLOCK_WORDS, reference + b * PRG_BLOCK_WORDS, PRG_BLOCK_WORDS);
+
+        prg_words(prg, stream, 0, words, test_words);
+        check(memcmp(words, reference, sizeof(words)) == 0, "whole range", stream, 0, test_words);
+
+        /* every offset, with a count long enough for the eight-block path */
+        for (size_t offset = 0; offset < 2 * PRG_BLOCK_WORDS; offset++) {
+            size_t count = test_words - offset - (offset % 5);
+            memset(words, 0, sizeof(words));
+            prg_words(prg, stream, offset, words, count);
+            check(memcmp(words, reference + offset, count * sizeof(uint32_t)) == 0, "offset", stream, offset,
+                  count);
+        }
+
+        /* the range split in two at every point */
+        for (size_t split = 1; split < test_words; split += 7) {
+            memset(words, 0, sizeof(words));
+            prg_words(prg, stream, 0, words, split);
+            prg_words(prg, stream, split, words + split, test_words - split);
+            check(memcmp(words, reference, sizeof(words)) == 0, "split", stream, split, test_words);
+        }
+
+        /* the stream reader, in draws of uneven sizes */
+        prg_stream_t rng;
+        prg_stream_init(rng, prg, stream);
+        size_t bytes = 0;
+        for (size_t draw = 1; bytes + draw <= sizeof(words); bytes += draw, draw = draw % 61 + 3)
+            prg_stream_bytes(rng, (uint8_t *)words + bytes, draw);
+        check(memcmp(words, reference, bytes) == 0, "stream reader", stream, 0, bytes / sizeof(uint32_t));
+    }
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All PRG checks passed\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Test of the int16 x int32 GEMM of lib-qgemm.
+ *
+ * Every product is compared with the naive sum of w[i][k] * x[k][j] + bias[i]
+ * modulo 2^32, on shapes that leave partial row slices, image panels and
+ * int16 pairs. The inputs are drawn either small, which leaves the high limbs
+ * at zero, or over the whole ring, which needs the high limb pass. The
+ * batches run alone, fused with a second share of the same weights, with an
+ * input expanded from a PRG stream and on a pool that splits the rows.
+ * $VHSS_QGEMM_KERNEL runs the test on the generic kernel on an AVX2 CPU.
+ *
+ * usage: qgemm-test
+ */
+
+#include <lib-prg.h>
+#include <lib-qgemm.h>
+#include <lib-thpool.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define test_threads 3
+
+struct shape_struct {
+    int rows, cols;
+    size_t n;
+};
+
+/* rows over QGEMM_MC with few images are split between the threads */
+static const struct shape_struct shapes[] = {{1, 1, 1}, {5, 3, 17}, {37, 75, 101}, {250, 130, 20}};
+#define num_shapes (int)(sizeof(shapes) / sizeof(shapes[0]))
+
+static int failures = 0;
+
+/* y[i][j] = bias[i] + sum_k w[i][k] * x[k][j] (mod 2^32), x and y image-major */
+static void reference(const int16_t *w, const int32_t *bias, const int32_t *x, int rows, int cols, size_t n,
+                      int32_t *y) {
+    for (size_t j = 0; j < n; j++) {
+        for (int i = 0; i < rows; i++) {
+            uint32_t sum = bias != NULL ? (uint32_t)bias[i] : 0;
+            for (int k = 0; k < cols; k++)
+                sum += (uint32_t)(int32_t)w[(size_t)i * cols + k] * (uint32_t)x[j * cols + k];
+            y[j * rows + i] = (int32_t)sum;
+        }
+    }
+}
+
+static void check(const int32_t *y, const int32_t *expected, size_t count, const char *what,
+                  const struct shape_struct *shape, bool wide) {
+    if (memcmp(y, expected, count * sizeof(int32_t)) != 0) {
+        printf("FAILED: %s (%dx%d, %zu images, %s inputs)\n", what, shape->rows, shape->cols, shape->n,
+               wide ? "wide" : "small");
+        failures++;
+    }
+}
+
+int main(void) {
+    uint8_t seed[PRG_SEED_BYTES] = {1};
+    prg_t prg;
+    prg_init(prg, seed);
+    uint64_t stream = 0;
+
+    thpool_t pool;
+    if (thpool_init(pool, test_threads) < 0) {
+        printf("can't start the thread pool\n");
+        return 1;
+    }
+
+    for (int s = 0; s < num_shapes; s++) {
+        const struct shape_struct *shape = &shapes[s];
+        size_t weights = (size_t)shape->rows * shape->cols, inputs = shape->n * shape->cols;
+        size_t outputs = shape->n * shape->rows;
+        int16_t *w = malloc(weights * sizeof(int16_t));
+        int32_t *bias = malloc(shape->rows * sizeof(int32_t));
+        int32_t *x[2] = {malloc(inputs * sizeof(int32_t)), malloc(inputs * sizeof(int32_t))};
+        int32_t *y[2] = {malloc(outputs * sizeof(int32_t)), malloc(outputs * sizeof(int32_t))};
+        int32_t *expected[2] = {malloc(outputs * sizeof(int32_t)), malloc(outputs * sizeof(int32_t))};
+        qmatrix_t q;
+        if (!w || !bias || !x[0] || !x[1] || !y[0] || !y[1] || !expected[0] || !expected[1] ||
+            qmatrix_init(q, shape->rows, shape->cols) < 0) {
+            printf("out of memory\n");
+            return 1;
+        }
+
+        /* weights in [-INT16_MAX, INT16_MAX], as qmatrix_quantize gives them */
+        for (size_t i = 0; i < weights; i++) {
+            uint32_t word;
+            prg_words(prg, stream, i, &word, 1);
+            w[i] = (int16_t)(word % (2 * INT16_MAX + 1) - INT16_MAX);
+        }
+        stream++;
+        prg_words(prg, stream++, 0, (uint32_t *)bias, shape->rows);
+        qmatrix_load(q, w);
+
+        for (int wide = 0; wide < 2; wide++) {
+            for (int share = 0; share < 2; share++) {
+                prg_words(prg, stream++, 0, (uint32_t *)x[share], inputs);
+                if (!wide)
+                    for (size_t i = 0; i < inputs; i++)
+                        x[share][i] = (int16_t)x[share][i];
+                reference(w, share == 0 ? bias : NULL, x[share], shape->rows, shape->cols, shape->n,
+                          expected[share]);
+            }
+
+            /* alone on the caller, y image-major as in the drivers */
+            qgemm_s32(q, bias, x[0], 1, shape->cols, y[0], 1, shape->rows, shape->n);
+            check(y[0], expected[0], outputs, "qgemm_s32", shape, wide);
+
+            /* both shares fused on the pool, the second without a bias */
+            struct qgemm_job_struct jobs[2];
+            for (int share = 0; share < 2; share++) {
+                struct qgemm_job_struct job = {q, share == 0 ? bias : NULL, x[share], 1, shape->cols, NULL, 0,
+                                               y[share], 1, shape->rows, shape->n};
+                jobs[share] = job;
+                memset(y[share], 0, outputs * sizeof(int32_t));
+            }
+            qgemm_s32_run(pool, jobs, 2);
+            check(y[0], expected[0], outputs, "fused share 1", shape, wide);
+            check(y[1], expected[1], outputs, "fused share 2", shape, wide);
+        }
+
+        /* the input as a PRG stream, image j being words [j * cols, (j + 1) * cols) */
+        prg_words(prg, stream, 0, (uint32_t *)x[0], inputs);
+        reference(w, bias, x[0], shape->rows, shape->cols, shape->n, expected[0]);
+        struct qgemm_job_struct job = {q, bias, NULL, 0, 0, prg, stream++, y[0], 1, shape->rows, shape->n};
+        memset(y[0], 0, outputs * sizeof(int32_t));
+        qgemm_s32_run(pool, &job, 1);
+        check(y[0], expected[0], outputs, "PRG input", shape, true);
+
+        qmatrix_clear(q);
+        free(w);
+        free(bias);
+        for (int share = 0; share < 2; share++) {
+            free(x[share]);
+            free(y[share]);
+            free(expected[share]);
+        }
+    }
+    thpool_clear(pool);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All qgemm checks passed\n");
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Chunked bump allocator and the GMP memory functions built on it.
+ *
+ * Allocations are rounded to ARENA_ALIGN and never freed one by one, except
+ * for the latest one, which GMP often frees or grows right after allocating
+ * it. Rewinding keeps the chunks for the next round.
+ */
+
+#include <lib-arena.h>
+#include <assert.h>
+#include <gmp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define arena_round(SIZE) (((SIZE) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* the arena the GMP functions allocate from on this thread, if any */
+static __thread struct arena_struct *arena_active = NULL;
+
+static pthread_once_t arena_local_once = PTHREAD_ONCE_INIT;
+static pthread_key_t arena_local_key;
+
+void arena_init(arena_t arena, size_t chunk_size) {
+    assert(arena);
+    memset(arena, 0, sizeof(struct arena_struct));
+    arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_CHUNK_SIZE;
+}
+
+void arena_clear(arena_t arena) {
+    assert(arena && arena_active != arena);
+    struct arena_chunk_struct *chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct arena_chunk_struct *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = arena->current = NULL;
+    arena->num_chunks = 0;
+    arena->last = NULL;
+}
+
+/* appends a chunk of at least size bytes, doubling the chunk size each time */
+static struct arena_chunk_struct *arena_grow(struct arena_struct *arena, size_t size) {
+    size_t chunk_size = arena->chunk_size << (arena->num_chunks < 16 ? arena->num_chunks : 16);
+    if (chunk_size < size)
+        chunk_size = size;
+    struct arena_chunk_struct *chunk = malloc(arena_round(sizeof(struct arena_chunk_struct)) + chunk_size);
+    if (chunk == NULL)
+        return NULL;
+    chunk->data = (char *)chunk + arena_round(sizeof(struct arena_chunk_struct));
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = NULL;
+    if (arena->current != NULL)
+        arena->current->next = chunk;
+    else
+        arena->chunks = chunk;
+    arena->num_chunks++;
+    return chunk;
+}
+
+/* NULL only if a new chunk was needed and malloc failed */
+void *arena_alloc(arena_t arena, size_t size) {
+    assert(arena);
+    size = arena_round(size > 0 ? size : 1);
+    struct arena_chunk_struct *chunk = arena->current;
+    /* chunks after the current one are left over from before a rewind */
+    while (chunk == NULL || chunk->size - chunk->used < size) {
+        struct arena_chunk_struct *next = chunk != NULL ? chunk->next : arena->chunks;
+        if (next == NULL)
+            next = arena_grow(arena, size);
+        if (next == NULL)
+            return NULL;
+        next->used = 0;
+        arena->current = chunk = next;
+    }
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+bool arena_owns(const arena_t arena, const void *ptr) {
+    for (const struct arena_chunk_struct *chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+        if ((const char *)ptr >= chunk->data && (const char *)ptr < chunk->data + chunk->size)
+            return true;
+    return false;
+}
+
+arena_mark_t arena_mark(const arena_t arena) {
+    arena_mark_t mark = {arena->current, arena->current != NULL ? arena->current->used : 0, NULL};
+    return mark;
+}
+
+/* gives back everything allocated since mark, keeping the chunks */
+void arena_rewind(arena_t arena, arena_mark_t mark) {
+    arena->current = mark.chunk;
+    if (mark.chunk != NULL)
+        mark.chunk->used = mark.used;
+    else if (arena->chunks != NULL)
+        arena->chunks->used = 0;
+    arena->last = NULL;
+}
+
+static void arena_local_free(void *arena) {
+    arena_clear(arena);
+    free(arena);
+}
+
+static void arena_local_key_create(void) {
+    pthread_key_create(&arena_local_key, arena_local_free);
+}
+
+/* an arena owned by the calling thread, released when the thread exits */
+struct arena_struct *arena_local(void) {
+    pthread_once(&arena_local_once, arena_local_key_create);
+    struct arena_struct *arena = pthread_getspecific(arena_local_key);
+    if (arena == NULL) {
+        arena = malloc(sizeof(struct arena_struct));
+        assert(arena);
+        arena_init(arena, ARENA_CHUNK_SIZE);
+        pthread_setspecific(arena_local_key, arena);
+    }
+    return arena;
+}
+
+/* makes arena the one GMP allocates from on this thread; scopes can nest */
+arena_mark_t arena_enter(arena_t arena) {
+    arena_mark_t mark = arena_mark(arena);
+    mark.outer = arena_active;
+    arena_active = arena;
+    return mark;
+}
+
+void arena_leave(arena_t arena, arena_mark_t mark) {
+    assert(arena_active == arena);
+    arena_rewind(arena, mark);
+    arena_active = mark.outer;
+}
+
+void arena_heap_begin(void) {
+    if (arena_active != NULL)
+        arena_active->heap++;
+}
+
+void arena_heap_end(void) {
+    if (arena_active != NULL)
+        arena_active->heap--;
+}
+
+static void *arena_gmp_failed(size_t size) {
+    fprintf(stderr, "GMP: cannot allocate %zu bytes\n", size);
+    abort();
+}
+
+static void *arena_gmp_alloc(size_t size) {
+    struct arena_struct *arena = arena_active;
+    void *ptr = arena != NULL && arena->heap == 0 ? arena_alloc(arena, size) : malloc(size);
+    return ptr != NULL ? ptr : arena_gmp_failed(size);
+}
+
+static void *arena_gmp_realloc(void *ptr, size_t old_size, size_t new_size) {
+    struct arena_struct *arena = arena_active;
+    if (arena == NULL || !arena_owns(arena, ptr)) {
+        ptr = realloc(ptr, new_size);
+        return ptr != NULL ? ptr : arena_gmp_failed(new_size);
+    }
+    /* the latest allocation grows or shrinks in place when its chunk allows */
+    struct arena_chunk_struct *chunk = arena->current;
+    if (ptr == arena->last) {
+        size_t offset = (char *)ptr - chunk->data;
+        if (offset + arena_round(new_size) <= chunk->size) {
+            chunk->used = offset + arena_round(new_size);
+            return ptr;
+        }
+    }
+    if (new_size <= old_size)
+        return ptr;
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (new_ptr == NULL)
+        return arena_gmp_failed(new_size);
+    memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+static void arena_gmp_free(void *ptr, size_t size) {
+    (void)size;
+    struct arena_struct *arena = arena_active;
+    if (arena == NULL || !arena_owns(arena, ptr)) {
+        free(ptr);
+        return;
+    }
+    if (ptr == arena->last) {
+        arena->current->used = (char *)ptr - arena->current->data;
+        arena->last = NULL;
+    }
+}
+
+static pthread_once_t arena_gmp_once = PTHREAD_ONCE_INIT;
+
+static void arena_gmp_set(void) {
+    mp_set_memory_functions(arena_gmp_alloc, arena_gmp_realloc, arena_gmp_free);
+}
+
+/* outside arena scopes the functions behave as the GMP defaults, so memory
+ * allocated before the call is still freed correctly */
+void arena_gmp_install(void) {
+    pthread_once(&arena_gmp_once, arena_gmp_set);
+}
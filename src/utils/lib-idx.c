@@ -0,0 +1,136 @@
+/*
+ * Memory-mapped IDX reader and pixel conversion.
+ *
+ * A pixel p in [0, 255] stands for p / 255. The pipeline keeps its inputs in
+ * fixed point with d decimals, so with scale 10^d a pixel becomes
+ * round(p * scale / 255) / scale, which is how the text images file writes
+ * them.
+ */
+
+#include <lib-idx.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IDX_X86
+#endif
+
+#define IDX_UNSIGNED_BYTE 0x08
+
+typedef void (*idx_convert_fn)(const uint8_t *pixels, size_t n, int scale, float *out);
+
+static uint32_t read_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+/* $VHSS_IMAGES if set, fallback otherwise */
+const char *idx_images_path(const char *fallback) {
+    const char *env = getenv(IDX_IMAGES_ENV);
+    return env != NULL && env[0] != '\0' ? env : fallback;
+}
+
+/* fails on anything but a complete unsigned-byte IDX file */
+int idx_open(idx_t idx, const char *filename) {
+    assert(idx && filename);
+    memset(idx, 0, sizeof(struct idx_struct));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 4) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return -1;
+
+    int dims = file[3];
+    size_t header = 4 + 4 * (size_t)dims;
+    if (file[0] != 0 || file[1] != 0 || file[2] != IDX_UNSIGNED_BYTE || dims < 1 || dims > IDX_MAX_DIMS ||
+        size < header) {
+        munmap((void *)file, size);
+        return -1;
+    }
+
+    /* every item and all of them together have to fit in the file */
+    size_t item_size = 1;
+    bool ok = true;
+    for (int d = 0; ok && d < dims; d++) {
+        uint32_t length = read_be32(file + 4 + 4 * d);
+        idx->shape[d] = (int)length;
+        ok = length <= INT32_MAX;
+        if (ok && d > 0) {
+            ok = length == 0 || item_size <= (size - header) / length;
+            item_size *= length;
+        }
+    }
+    if (!ok || (idx->shape[0] != 0 && item_size > (size - header) / idx->shape[0])) {
+        munmap((void *)file, size);
+        return -1;
+    }
+
+    madvise((void *)file, size, MADV_WILLNEED);
+    idx->map = (void *)file;
+    idx->map_size = size;
+    idx->data = file + header;
+    idx->dims = dims;
+    idx->count = idx->shape[0];
+    idx->item_size = item_size;
+    return 0;
+}
+
+void idx_close(idx_t idx) {
+    assert(idx);
+    if (idx->map != NULL)
+        munmap(idx->map, idx->map_size);
+    memset(idx, 0, sizeof(struct idx_struct));
+}
+
+/* rounds to nearest, ties to even, like the vector path */
+static void convert_generic(const uint8_t *pixels, size_t n, int scale, float *out) {
+    float factor = (float)scale / 255.0f;
+    for (size_t i = 0; i < n; i++)
+        out[i] = rintf((float)pixels[i] * factor) / (float)scale;
+}
+
+#if defined(IDX_X86)
+__attribute__((target("avx2"))) static void
+convert_avx2(const uint8_t *pixels, size_t n, int scale, float *out) {
+    const __m256 factor = _mm256_set1_ps((float)scale / 255.0f);
+    const __m256 divisor = _mm256_set1_ps((float)scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pixels + i)));
+        __m256 q = _mm256_round_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(p), factor),
+                                   _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_ps(out + i, _mm256_div_ps(q, divisor));
+    }
+    convert_generic(pixels + i, n - i, scale, out + i);
+}
+#endif /* IDX_X86 */
+
+static idx_convert_fn select_convert(void) {
+#if defined(IDX_X86)
+    if (__builtin_cpu_supports("avx2"))
+        return convert_avx2;
+#endif
+    return convert_generic;
+}
+
+/* n pixels to round(p * scale / 255) / scale */
+void idx_to_float(const uint8_t *pixels, size_t n, int scale, float *out) {
+    assert(pixels && out && scale > 0);
+    select_convert()(pixels, n, scale, out);
+}
@@ -0,0 +1,345 @@
+/*
+ * INT8 GEMM with int32 accumulation and a requantizing epilogue.
+ *
+ * Blocking: the weights are packed once into panels of IGEMM_NR output
+ * features, four columns at a time, so that one 32-byte load holds four
+ * columns of sixteen features. A task takes IGEMM_MC images and sweeps every
+ * panel of its feature range over them, IGEMM_MR images at a time, broadcasting
+ * four input bytes per image and step. The AVX2 microkernel multiplies with
+ * pmaddubsw on |x| and sign(w, x): with both sides in [-127, 127] the int16
+ * pair sums cannot saturate, so the result is exact. CPUs with AVX512-VNNI use
+ * vpdpbusd on 256-bit vectors instead.
+ */
+
+#include <lib-igemm.h>
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IGEMM_X86
+#endif
+
+/* images packed together in a task and weight panels per task when the
+ * output features are split between threads */
+#define IGEMM_MC (8 * IGEMM_MR)
+#define IGEMM_PANELS_PER_TILE 8
+
+typedef void (*igemm_kernel_fn)(int steps, const int8_t *b, const int32_t *sums,
+                                const int8_t *x[IGEMM_MR], int32_t acc[IGEMM_MR][IGEMM_NR]);
+
+/* round(v * inverse) clamped to [-127, 127], without a libm call per value */
+static inline int8_t quantize_s8(float v, float inverse) {
+    float q = v * inverse;
+    if (q >= 127.0f)
+        return 127;
+    if (q <= -127.0f)
+        return -127;
+    return (int8_t)(int)(q + (q >= 0.0f ? 0.5f : -0.5f));
+}
+
+static inline int32_t load_quad(const int8_t *x) {
+    int32_t quad;
+    memcpy(&quad, x, sizeof(quad));
+    return quad;
+}
+
+int imatrix_init(imatrix_t w, int rows, int cols) {
+    assert(w);
+    assert(rows > 0 && cols > 0);
+    w->rows = rows;
+    w->cols = cols;
+    w->ld = (int)igemm_ld(cols);
+    w->panels = (rows + IGEMM_NR - 1) / IGEMM_NR;
+    size_t bytes = (size_t)w->panels * w->ld * IGEMM_NR;
+    if (posix_memalign((void **)&w->data, 64, bytes) != 0) {
+        w->data = NULL;
+        return -1;
+    }
+    memset(w->data, 0, bytes);
+    w->scale = (float *)calloc((size_t)w->panels * IGEMM_NR, sizeof(float));
+    w->bias = (float *)calloc((size_t)w->panels * IGEMM_NR, sizeof(float));
+    w->sums = (int32_t *)calloc((size_t)w->panels * IGEMM_NR, sizeof(int32_t));
+    if (!w->scale || !w->bias || !w->sums) {
+        imatrix_clear(w);
+        return -1;
+    }
+    return 0;
+}
+
+void imatrix_clear(imatrix_t w) {
+    assert(w);
+    free(w->data);
+    free(w->scale);
+    free(w->bias);
+    free(w->sums);
+    w->data = NULL;
+    w->scale = w->bias = NULL;
+    w->sums = NULL;
+}
+
+/* quantizes and packs a rows x cols row-major float matrix, each row with
+ * the scale mapping its largest magnitude to 127; bias may be NULL */
+void imatrix_quantize(imatrix_t w, const float *weight, const float *bias) {
+    assert(w && w->data && weight);
+    for (int i = 0; i < w->rows; i++) {
+        const float *row = weight + (size_t)i * w->cols;
+        int8_t *panel = w->data + (size_t)(i / IGEMM_NR) * w->ld * IGEMM_NR;
+        float scale = igemm_scale(row, 0, w->cols, 1);
+        w->scale[i] = scale;
+        w->bias[i] = bias != NULL ? bias[i] : 0.0f;
+        w->sums[i] = 0;
+        for (int k = 0; k < w->cols; k++) {
+            int8_t q = quantize_s8(row[k], 1.0f / scale);
+            panel[(size_t)(k / 4) * IGEMM_NR * 4 + (i % IGEMM_NR) * 4 + k % 4] = q;
+            w->sums[i] += q;
+        }
+    }
+}
+
+/* takes rows x cols row-major int8 weights quantized ahead of time, as
+ * igemm_quantize does with the per-row scales */
+void imatrix_load(imatrix_t w, const int8_t *weight, const float *scale, const float *bias) {
+    assert(w && w->data && weight && scale);
+    for (int i = 0; i < w->rows; i++) {
+        const int8_t *row = weight + (size_t)i * w->cols;
+        int8_t *panel = w->data + (size_t)(i / IGEMM_NR) * w->ld * IGEMM_NR;
+        w->scale[i] = scale[i];
+        w->bias[i] = bias != NULL ? bias[i] : 0.0f;
+        w->sums[i] = 0;
+        for (int k = 0; k < w->cols; k++) {
+            panel[(size_t)(k / 4) * IGEMM_NR * 4 + (i % IGEMM_NR) * 4 + k % 4] = row[k];
+            w->sums[i] += row[k];
+        }
+    }
+}
+
+/* per-tensor scale of n rows of cols floats: the largest magnitude maps to
+ * 127 (1 for an all-zero tensor) */
+float igemm_scale(const float *x, size_t x_stride, int cols, size_t n) {
+    float max = 0.0f;
+    for (size_t j = 0; j < n; j++)
+        for (int k = 0; k < cols; k++)
+            max = fmaxf(max, fabsf(x[j * x_stride + k]));
+    return max > 0.0f ? max / 127.0f : 1.0f;
+}
+
+/* quantizes n rows of cols floats to int8 rows, zeroing the row padding */
+void igemm_quantize(const float *x, size_t x_stride, int cols, float scale, int8_t *q, size_t q_stride,
+                    size_t n) {
+    size_t ld = igemm_ld(cols);
+    assert(q_stride >= ld);
+    for (size_t j = 0; j < n; j++) {
+        for (int k = 0; k < cols; k++)
+            q[j * q_stride + k] = quantize_s8(x[j * x_stride + k], 1.0f / scale);
+        memset(q + j * q_stride + cols, 0, ld - cols);
+    }
+}
+
+static void kernel_generic(int steps, const int8_t *b, const int32_t *sums, const int8_t *x[IGEMM_MR],
+                           int32_t acc[IGEMM_MR][IGEMM_NR]) {
+    (void)sums;
+    memset(acc, 0, sizeof(int32_t) * IGEMM_MR * IGEMM_NR);
+    for (int p = 0; p < steps; p++) {
+        const int8_t *quad = b + (size_t)p * IGEMM_NR * 4;
+        for (int r = 0; r < IGEMM_MR; r++)
+            for (int c = 0; c < IGEMM_NR; c++)
+                for (int k = 0; k < 4; k++)
+                    acc[r][c] += (int32_t)quad[c * 4 + k] * x[r][p * 4 + k];
+    }
+}
+
+#if defined(IGEMM_X86)
+#define IGEMM_AVX2_ROW(R)                                                      \
+    a = _mm256_set1_epi32(load_quad(x[R] + 4 * p));                            \
+    u = _mm256_abs_epi8(a);                                                    \
+    c##R##0 = _mm256_add_epi32(                                                \
+        c##R##0, _mm256_madd_epi16(_mm256_maddubs_epi16(u, _mm256_sign_epi8(b0, a)), ones)); \
+    c##R##1 = _mm256_add_epi32(                                                \
+        c##R##1, _mm256_madd_epi16(_mm256_maddubs_epi16(u, _mm256_sign_epi8(b1, a)), ones));
+
+#define IGEMM_STORE_ROW(R, CORRECTION0, CORRECTION1)                           \
+    _mm256_storeu_si256((__m256i *)&acc[R][0], _mm256_sub_epi32(c##R##0, CORRECTION0)); \
+    _mm256_storeu_si256((__m256i *)&acc[R][8], _mm256_sub_epi32(c##R##1, CORRECTION1));
+
+__attribute__((target("avx2"))) static void
+kernel_avx2(int steps, const int8_t *b, const int32_t *sums, const int8_t *x[IGEMM_MR],
+            int32_t acc[IGEMM_MR][IGEMM_NR]) {
+    const __m256i ones = _mm256_set1_epi16(1), zero = _mm256_setzero_si256();
+    __m256i c00 = zero, c01 = zero, c10 = zero, c11 = zero, c20 = zero, c21 = zero;
+    __m256i c30 = zero, c31 = zero, c40 = zero, c41 = zero, c50 = zero, c51 = zero;
+    (void)sums;
+
+    for (int p = 0; p < steps; p++) {
+        __m256i b0 = _mm256_load_si256((const __m256i *)(b + (size_t)p * IGEMM_NR * 4));
+        __m256i b1 = _mm256_load_si256((const __m256i *)(b + (size_t)p * IGEMM_NR * 4 + 32));
+        __m256i a, u;
+        IGEMM_AVX2_ROW(0)
+        IGEMM_AVX2_ROW(1)
+        IGEMM_AVX2_ROW(2)
+        IGEMM_AVX2_ROW(3)
+        IGEMM_AVX2_ROW(4)
+        IGEMM_AVX2_ROW(5)
+    }
+
+    IGEMM_STORE_ROW(0, zero, zero)
+    IGEMM_STORE_ROW(1, zero, zero)
+    IGEMM_STORE_ROW(2, zero, zero)
+    IGEMM_STORE_ROW(3, zero, zero)
+    IGEMM_STORE_ROW(4, zero, zero)
+    IGEMM_STORE_ROW(5, zero, zero)
+}
+
+/* vpdpbusd multiplies unsigned by signed bytes straight into int32 lanes, so
+ * the activations are offset by 128 instead (x ^ 0x80 = x + 128 as a byte)
+ * and 128 times the row sums of the weights are taken off at the end. The
+ * instruction is issued by hand: GCC copies the accumulator of every
+ * _mm256_dpbusd_epi32 to a fresh register, which halves the throughput */
+#define IGEMM_DPBUSD(C, A, B) __asm__("vpdpbusd %2, %1, %0" : "+v"(C) : "v"(A), "v"(B))
+
+#define IGEMM_VNNI_ROW(R)                                                      \
+    a = _mm256_xor_si256(_mm256_set1_epi32(load_quad(x[R] + 4 * p)), offset); \
+    IGEMM_DPBUSD(c##R##0, a, b0);                                              \
+    IGEMM_DPBUSD(c##R##1, a, b1);
+
+__attribute__((target("avx2,avx512vl,avx512vnni"))) static void
+kernel_vnni(int steps, const int8_t *b, const int32_t *sums, const int8_t *x[IGEMM_MR],
+            int32_t acc[IGEMM_MR][IGEMM_NR]) {
+    const __m256i offset = _mm256_set1_epi8((char)0x80), zero = _mm256_setzero_si256();
+    __m256i c00 = zero, c01 = zero, c10 = zero, c11 = zero, c20 = zero, c21 = zero;
+    __m256i c30 = zero, c31 = zero, c40 = zero, c41 = zero, c50 = zero, c51 = zero;
+
+    for (int p = 0; p < steps; p++) {
+        __m256i b0 = _mm256_load_si256((const __m256i *)(b + (size_t)p * IGEMM_NR * 4));
+        __m256i b1 = _mm256_load_si256((const __m256i *)(b + (size_t)p * IGEMM_NR * 4 + 32));
+        __m256i a;
+        IGEMM_VNNI_ROW(0)
+        IGEMM_VNNI_ROW(1)
+        IGEMM_VNNI_ROW(2)
+        IGEMM_VNNI_ROW(3)
+        IGEMM_VNNI_ROW(4)
+        IGEMM_VNNI_ROW(5)
+    }
+
+    __m256i s0 = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i *)sums), 7);
+    __m256i s1 = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i *)(sums + 8)), 7);
+    IGEMM_STORE_ROW(0, s0, s1)
+    IGEMM_STORE_ROW(1, s0, s1)
+    IGEMM_STORE_ROW(2, s0, s1)
+    IGEMM_STORE_ROW(3, s0, s1)
+    IGEMM_STORE_ROW(4, s0, s1)
+    IGEMM_STORE_ROW(5, s0, s1)
+}
+#endif /* IGEMM_X86 */
+
+/* the fastest kernel of the CPU, or a slower one named by $VHSS_IGEMM_KERNEL */
+static igemm_kernel_fn select_kernel(void) {
+#if defined(IGEMM_X86)
+    const char *env = getenv(IGEMM_KERNEL_ENV);
+    bool generic = env != NULL && strcmp(env, "generic") == 0;
+    bool avx2 = env != NULL && strcmp(env, "avx2") == 0;
+    if (!generic && !avx2 && __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl"))
+        return kernel_vnni;
+    if (!generic && __builtin_cpu_supports("avx2"))
+        return kernel_avx2;
+#endif
+    return kernel_generic;
+}
+
+struct igemm_batch_struct {
+    const struct imatrix_struct *w;
+    bool relu;
+    const int8_t *x;
+    float x_scale;
+    size_t x_stride;
+    int8_t *y_s8; /* exactly one of y_s8 and y_f32 is set */
+    float *y_f32;
+    float y_scale;
+    size_t y_stride;
+    size_t n;
+    int panel_tile; /* weight panels per task */
+    igemm_kernel_fn kernel;
+};
+
+static void igemm_task(void *arg, size_t task, int worker) {
+    struct igemm_batch_struct *batch = arg;
+    const struct imatrix_struct *w = batch->w;
+    int tiles = (w->panels + batch->panel_tile - 1) / batch->panel_tile;
+    int p_begin = (int)(task % tiles) * batch->panel_tile;
+    int p_end = p_begin + batch->panel_tile < w->panels ? p_begin + batch->panel_tile : w->panels;
+    size_t n0 = (task / tiles) * IGEMM_MC;
+    size_t block = batch->n - n0 < IGEMM_MC ? batch->n - n0 : IGEMM_MC;
+    float inverse = 1.0f / batch->y_scale;
+    int32_t acc[IGEMM_MR][IGEMM_NR];
+    const int8_t *x[IGEMM_MR];
+    (void)worker;
+
+    for (int p = p_begin; p < p_end; p++) {
+        const int8_t *b = w->data + (size_t)p * w->ld * IGEMM_NR;
+        int features = w->rows - p * IGEMM_NR < IGEMM_NR ? w->rows - p * IGEMM_NR : IGEMM_NR;
+        for (size_t j = 0; j < block; j += IGEMM_MR) {
+            size_t valid = block - j < IGEMM_MR ? block - j : IGEMM_MR;
+            /* missing images of the last slice repeat the last one */
+            for (size_t r = 0; r < IGEMM_MR; r++)
+                x[r] = batch->x + (n0 + j + (r < valid ? r : valid - 1)) * batch->x_stride;
+            batch->kernel(w->ld / 4, b, w->sums + p * IGEMM_NR, x, acc);
+
+            for (size_t r = 0; r < valid; r++) {
+                size_t out = (n0 + j + r) * batch->y_stride + p * IGEMM_NR;
+                for (int c = 0; c < features; c++) {
+                    int i = p * IGEMM_NR + c;
+                    float v = (float)acc[r][c] * (batch->x_scale * w->scale[i]) + w->bias[i];
+                    if (batch->relu && v < 0.0f)
+                        v = 0.0f;
+                    if (batch->y_s8 != NULL)
+                        batch->y_s8[out + c] = quantize_s8(v, inverse);
+                    else
+                        batch->y_f32[out + c] = v;
+                }
+            }
+        }
+    }
+
+    if (batch->y_s8 != NULL && p_end == w->panels) {
+        size_t pad = igemm_ld(w->rows) - w->rows;
+        for (size_t j = 0; j < block; j++)
+            memset(batch->y_s8 + (n0 + j) * batch->y_stride + w->rows, 0, pad);
+    }
+}
+
+/* the images are cut into blocks of IGEMM_MC; the output features are also
+ * split into tiles when there are too few blocks to keep every thread busy */
+static void igemm_run(thpool_t pool, struct igemm_batch_struct *batch) {
+    const struct imatrix_struct *w = batch->w;
+    size_t blocks = (batch->n + IGEMM_MC - 1) / IGEMM_MC;
+
+    assert(w && w->data && batch->x);
+    assert(batch->x_stride >= (size_t)w->ld);
+    batch->panel_tile = w->panels;
+    batch->kernel = select_kernel();
+    if (blocks < 4 * (size_t)thpool_size(pool) && w->panels > IGEMM_PANELS_PER_TILE)
+        batch->panel_tile = IGEMM_PANELS_PER_TILE;
+
+    size_t tiles = (w->panels + batch->panel_tile - 1) / batch->panel_tile;
+    thpool_run(pool, igemm_task, batch, blocks * tiles);
+}
+
+/* y[j] = requantize(act(scale * (w x[j]) + bias), y_scale) for the n int8
+ * images of x; rows of y are zero padded so that they can feed the next
+ * layer, which needs y_stride >= igemm_ld(w->rows) */
+void igemm_layer_s8(thpool_t pool, const imatrix_t w, bool relu, const int8_t *x, float x_scale,
+                    size_t x_stride, int8_t *y, float y_scale, size_t y_stride, size_t n) {
+    struct igemm_batch_struct batch = {w, relu, x, x_scale, x_stride, y, NULL, y_scale, y_stride, n, 0, NULL};
+    assert(y && y_stride >= igemm_ld(w->rows));
+    igemm_run(pool, &batch);
+}
+
+/* same as igemm_layer_s8 with float outputs, for the last layer */
+void igemm_layer_f32(thpool_t pool, const imatrix_t w, bool relu, const int8_t *x, float x_scale,
+                     size_t x_stride, float *y, size_t y_stride, size_t n) {
+    struct igemm_batch_struct batch = {w, relu, x, x_scale, x_stride, NULL, y, 1.0f, y_stride, n, 0, NULL};
+    assert(y && y_stride >= (size_t)w->rows);
+    igemm_run(pool, &batch);
+}
@@ -0,0 +1,215 @@
+/*
+ * malloc wrappers, counting GMP memory functions and the leak detector.
+ *
+ * Bytes live on the heap are tracked with malloc_usable_size, so that free
+ * knows what it gives back; the counts of bytes allocated use the sizes
+ * asked for. Memory freed here but allocated where the wrappers do not reach
+ * makes the live bytes drift down, never up, so it cannot look like a leak.
+ */
+
+#include <lib-memstat.h>
+#include <gmp.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+static __thread struct memstat_struct memstat_self;
+static __thread int memstat_paused = 0;
+static int64_t memstat_live = 0; /* updated atomically */
+
+static void memstat_add(void *ptr, size_t size) {
+    if (ptr == NULL || memstat_paused)
+        return;
+    int64_t usable = (int64_t)malloc_usable_size(ptr);
+    memstat_self.allocs++;
+    memstat_self.bytes += size;
+    memstat_self.heap_live += usable;
+    __atomic_add_fetch(&memstat_live, usable, __ATOMIC_RELAXED);
+}
+
+static void memstat_sub(void *ptr) {
+    if (ptr == NULL || memstat_paused)
+        return;
+    int64_t usable = (int64_t)malloc_usable_size(ptr);
+    memstat_self.frees++;
+    memstat_self.heap_live -= usable;
+    __atomic_sub_fetch(&memstat_live, usable, __ATOMIC_RELAXED);
+}
+
+void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+    memstat_add(ptr, size);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    void *ptr = __real_calloc(count, size);
+    memstat_add(ptr, count * size);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (ptr != NULL && size == 0) {
+        memstat_sub(ptr);
+        return __real_realloc(ptr, size);
+    }
+    size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = __real_realloc(ptr, size);
+    if (new_ptr == NULL || memstat_paused)
+        return new_ptr;
+    /* a realloc is one allocation, and one free when it had a block */
+    if (ptr != NULL)
+        memstat_self.frees++;
+    int64_t growth = (int64_t)malloc_usable_size(new_ptr) - (int64_t)old_size;
+    memstat_self.allocs++;
+    memstat_self.bytes += size;
+    memstat_self.heap_live += growth;
+    __atomic_add_fetch(&memstat_live, growth, __ATOMIC_RELAXED);
+    return new_ptr;
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size) {
+    int ret = __real_posix_memalign(ptr, alignment, size);
+    if (ret == 0)
+        memstat_add(*ptr, size);
+    return ret;
+}
+
+void __wrap_free(void *ptr) {
+    memstat_sub(ptr);
+    __real_free(ptr);
+}
+
+/* $VHSS_MEMSTAT set to anything but 0 */
+bool memstat_enabled(void) {
+    const char *env = getenv(MEMSTAT_ENV);
+    return env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+}
+
+/* the functions installed before memstat_gmp_install, called through */
+static void *(*gmp_next_alloc)(size_t);
+static void *(*gmp_next_realloc)(void *, size_t, size_t);
+static void (*gmp_next_free)(void *, size_t);
+
+static void *memstat_gmp_alloc(size_t size) {
+    memstat_self.gmp_allocs++;
+    memstat_self.gmp_bytes += size;
+    memstat_self.gmp_live += size;
+    return gmp_next_alloc(size);
+}
+
+static void *memstat_gmp_realloc(void *ptr, size_t old_size, size_t new_size) {
+    memstat_self.gmp_allocs++;
+    memstat_self.gmp_frees++;
+    memstat_self.gmp_bytes += new_size;
+    memstat_self.gmp_live += (int64_t)new_size - (int64_t)old_size;
+    return gmp_next_realloc(ptr, old_size, new_size);
+}
+
+static void memstat_gmp_free(void *ptr, size_t size) {
+    memstat_self.gmp_frees++;
+    memstat_self.gmp_live -= size;
+    gmp_next_free(ptr, size);
+}
+
+static pthread_once_t memstat_gmp_once = PTHREAD_ONCE_INIT;
+
+static void memstat_gmp_set(void) {
+    mp_get_memory_functions(&gmp_next_alloc, &gmp_next_realloc, &gmp_next_free);
+    mp_set_memory_functions(memstat_gmp_alloc, memstat_gmp_realloc, memstat_gmp_free);
+}
+
+/* to be called after any other mp_set_memory_functions */
+void memstat_gmp_install(void) {
+    pthread_once(&memstat_gmp_once, memstat_gmp_set);
+}
+
+void memstat_thread(memstat_t stats) {
+    *stats = memstat_self;
+}
+
+/* leaves the allocations of the calling thread out until memstat_resume, for
+ * bookkeeping such as the profiler's own; the memory must also be freed
+ * while paused */
+void memstat_pause(void) {
+    memstat_paused++;
+}
+
+void memstat_resume(void) {
+    memstat_paused--;
+}
+
+int64_t memstat_heap_live(void) {
+    return __atomic_load_n(&memstat_live, __ATOMIC_RELAXED);
+}
+
+/* high-water resident set of the process, in KiB */
+long memstat_peak_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/* current resident set of the process in KiB, -1 where /proc is missing */
+long memstat_rss(void) {
+    long pages = -1;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+        return -1;
+    if (fscanf(statm, "%*s %ld", &pages) != 1)
+        pages = -1;
+    fclose(statm);
+    return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void leak_detector_init(leak_detector_t detector, uint64_t warmup) {
+    memset(detector, 0, sizeof(struct leak_detector_struct));
+    detector->warmup = warmup;
+}
+
+void leak_detector_begin(leak_detector_t detector) {
+    detector->heap_begin = memstat_self.heap_live;
+    detector->gmp_begin = memstat_self.gmp_live;
+}
+
+/* heap and GMP growth are those of the calling thread */
+void leak_detector_end(leak_detector_t detector) {
+    int64_t heap = memstat_self.heap_live - detector->heap_begin;
+    int64_t gmp = memstat_self.gmp_live - detector->gmp_begin;
+    if (detector->units++ < detector->warmup)
+        return;
+    detector->heap_growth += heap;
+    detector->gmp_growth += gmp;
+    if (heap > 0 || gmp > 0)
+        detector->growing_units++;
+}
+
+bool leak_detector_leaking(const leak_detector_t detector) {
+    return detector->heap_growth > LEAK_TOLERANCE || detector->gmp_growth > LEAK_TOLERANCE;
+}
+
+void leak_detector_report(FILE *stream, const char *unit, const leak_detector_t detector) {
+    if (detector->units <= detector->warmup) {
+        fprintf(stream, "leak check: %llu %ss, too few past the warm-up of %llu\n",
+                (unsigned long long)detector->units, unit, (unsigned long long)detector->warmup);
+        return;
+    }
+    uint64_t steady = detector->units - detector->warmup;
+    fprintf(stream,
+            "leak check: %llu %ss after a warm-up of %llu, heap %+lld bytes (%+.1lf per %s), "
+            "GMP %+lld bytes (%+.1lf per %s), %llu %ss grew: %s\n",
+            (unsigned long long)steady, unit, (unsigned long long)detector->warmup,
+            (long long)detector->heap_growth, (double)detector->heap_growth / steady, unit,
+            (long long)detector->gmp_growth, (double)detector->gmp_growth / steady, unit,
+            (unsigned long long)detector->growing_units, unit,
+            leak_detector_leaking(detector) ? "GROWING" : "flat");
+}
@@ -30,6 +30,13 @@
 
 #define dev_random "/dev/random"
 
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include <errno.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 /* estrae un seed sicuro, di lunghezza indicata, dall'interfaccia offerta dal
  * sistema operativo */
 int extract_randseed_os_rng(uint8_t *seed, size_t seed_bits) {
@@ -51,14 +58,36 @@ int extract_randseed_os_rng(uint8_t *seed, size_t seed_bits) {
     }
 #else
     int fd;
+    long done = 0;
 
+#if defined(SYS_getrandom)
+    /* getrandom() legge dallo stesso pool senza aprire file e restituisce
+       fino a 256 byte per chiamata anche se interrotta */
+    while (done < seed_bytes) {
+        long r = syscall(SYS_getrandom, seed + done, seed_bytes - done, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        done += r;
+    }
+    if (done == seed_bytes)
+        return 0;
+#endif /* defined(SYS_getrandom) */
+
+    /* kernel privi di getrandom(): il resto del seed in letture a blocchi */
     if ((fd = open(dev_random, O_RDONLY)) == -1)
         return -1;
-    for (long i = 0; i < seed_bytes; i++)
-        if (read(fd, seed + i, sizeof(char)) == -1) {
+    while (done < seed_bytes) {
+        ssize_t r = read(fd, seed + done, seed_bytes - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
             close(fd);
             return -1;
         }
+        done += r;
+    }
 #endif /* defined(_WIN32) || defined(__CYGWIN__) */
 
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -174,6 +203,7 @@ void select_pbc_param_by_security_level(pbc_param_t param,
             coeff2 223453750434935832526340182442577752002088701403249531976902972431624165964731236524743060367192438387353\
             nqr 244963173507266938235539383443602512137290519396344466970811861754786069712885850118391142918884286378163");
                 assert(r == 0);
+                (void)r; /* con NDEBUG l'esito non è controllato */
                 return;
             } else if (level <= 128) {
                 // discriminant = 2571363; // q=311 r=289 NB: scartato: su GT il
@@ -194,6 +224,7 @@ void select_pbc_param_by_security_level(pbc_param_t param,
             coeff2 3549997967747217887205475789788641988268970614616166759164310210564001720421074521811369039373155743849290380010316278955494511717982026644041982947095020083\
             nqr 5604379921766334530881484112875305450465392023664879178190451853254214902967795509774097034685746943497436675589223058860619716350787995577996572786003998092");
                 assert(r == 0);
+                (void)r;
                 return;
             } else if (level <= 192)
                 discriminant = 0;
@@ -205,6 +236,7 @@ void select_pbc_param_by_security_level(pbc_param_t param,
             int r = pbc_cm_search_d(_pairing_type_d_callback_function, param,
                                     discriminant, generic_dlog_secure_size + 1);
             assert(r != 0);
+            (void)r;
             /* param è impostato dalla funzione di callback */
         }; break;
         case pbc_pairing_type_e:
@@ -242,6 +274,7 @@ void select_pbc_param_by_security_level(pbc_param_t param,
                 coeff4 276516399170985053319078354072508042780594285\
                 nqr 406500356245222891204862603877753845883181622");
                 assert(r == 0);
+                (void)r;
                 return;
             } else if (level <= 112) {
                 // discriminant = 4543003; // q=231 r=220
@@ -261,6 +294,7 @@ void select_pbc_param_by_security_level(pbc_param_t param,
             coeff4 2452411591352386055443174334416949464654643533383661731752025726026678\
             nqr 2074735224075027951149830875709496958201021082523693876742983789505905");
                 assert(r == 0);
+                (void)r;
                 return;
             } else if (level <= 128) {
                 // discriminant = 35707; // q=301  r=279
@@ -280,6 +314,7 @@ void select_pbc_param_by_security_level(pbc_param_t param,
             coeff4 2523993882391765473378658713962982611636142997483221053152401658982457852754875186709328463\
             nqr 2723673016248314021528421180426075652790777832101902808425522706055238938106416730876895102");
                 assert(r == 0);
+                (void)r;
                 return;
             } else if (level <= 192)
                 discriminant = 0;
@@ -291,6 +326,7 @@ void select_pbc_param_by_security_level(pbc_param_t param,
             int r = pbc_cm_search_g(_pairing_type_g_callback_function, param,
                                     discriminant, generic_dlog_secure_size + 1);
             assert(r != 0);
+            (void)r;
             /* param è impostato dalla funzione di callback */
         }; break;
         case pbc_pairing_type_i:
@@ -0,0 +1,511 @@
+/*
+ * Loader of the model_parameters.txt layout and of the binary container.
+ *
+ * A text file is mapped and scanned once for the tensor headers, which gives
+ * the byte range of every tensor; the tensors are then parsed concurrently on
+ * a short-lived thread pool. A binary file stays mapped and its tensors are
+ * used in place.
+ */
+
+#include <lib-model.h>
+#include <lib-thpool.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* longest header line looked at; tensor headers are far shorter */
+#define MODEL_HEADER_MAX 128
+
+/* longest number handed to the strtod fallback */
+#define MODEL_NUMBER_MAX 64
+
+struct model_span_struct {
+    const char *begin, *end; /* text of the values */
+    float *values;
+    size_t count;
+    bool ok;
+};
+
+/* exact powers of ten as doubles */
+static const double pow10_table[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                     1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/* any token the fixed-format path does not take, e.g. with an exponent */
+static const char *parse_number_slow(const char *p, const char *end, float *value) {
+    char token[MODEL_NUMBER_MAX];
+    size_t length = 0;
+    while (p + length < end && !is_space(p[length]) && length < sizeof(token) - 1)
+        length++;
+    memcpy(token, p, length);
+    token[length] = '\0';
+
+    char *stop;
+    double parsed = strtod(token, &stop);
+    if (length == 0 || stop != token + length)
+        return NULL;
+    *value = (float)parsed;
+    return p + length;
+}
+
+/* [-]digits[.digits] as written by the export script. Up to 15 digits are
+ * gathered in an integer and divided once by an exact power of ten; both are
+ * exact doubles, so the quotient is the correctly rounded double strtod would
+ * return and the result matches (float)strtod bit for bit */
+static const char *parse_number(const char *p, const char *end, float *value) {
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0, decimals = 0;
+    while (p < end && is_digit(*p)) {
+        mantissa = mantissa * 10 + (uint64_t)(*p++ - '0');
+        digits++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && is_digit(*p)) {
+            mantissa = mantissa * 10 + (uint64_t)(*p++ - '0');
+            digits++;
+            decimals++;
+        }
+    }
+
+    if (digits == 0 || digits > 15 || (p < end && !is_space(*p)))
+        return parse_number_slow(start, end, value);
+    double magnitude = (double)mantissa / pow10_table[decimals];
+    *value = (float)(negative ? -magnitude : magnitude);
+    return p;
+}
+
+/* exactly count numbers, followed by nothing but whitespace */
+static void parse_tensor(void *arg, size_t index, int worker) {
+    struct model_span_struct *tensor = &((struct model_span_struct *)arg)[index];
+    const char *p = tensor->begin, *end = tensor->end;
+    (void)worker;
+
+    size_t read = 0;
+    for (;;) {
+        while (p < end && is_space(*p))
+            p++;
+        if (p == end || read == tensor->count)
+            break;
+        p = parse_number(p, end, &tensor->values[read]);
+        if (p == NULL)
+            return;
+        read++;
+    }
+    tensor->ok = read == tensor->count && p == end;
+}
+
+/* grows the layer array up to layer index (1-based) */
+static int reserve_layers(model_t model, int index) {
+    if (index <= model->num_layers)
+        return 0;
+    struct model_layer_struct *layers =
+        (struct model_layer_struct *)realloc(model->layers, index * sizeof(struct model_layer_struct));
+    if (!layers)
+        return -1;
+    memset(layers + model->num_layers, 0, (index - model->num_layers) * sizeof(struct model_layer_struct));
+    model->layers = layers;
+    model->num_layers = index;
+    return 0;
+}
+
+static const char *next_line(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', end - p);
+    return newline != NULL ? newline + 1 : end;
+}
+
+/* records the header at line and allocates its tensor, whose text starts
+ * after the caption line following the header. Returns 1 for a header, 0 for
+ * any other line and -1 on error */
+static int read_header(model_t model, const char *line, const char *end, struct model_span_struct *tensor) {
+    char header[MODEL_HEADER_MAX];
+    const char *caption = next_line(line, end);
+    size_t length = caption - line;
+    if (length >= sizeof(header))
+        return 0;
+    memcpy(header, line, length);
+    header[length] = '\0';
+
+    int index, rows, cols = 0;
+    bool is_weight = sscanf(header, "Shape of weight %d: torch.Size([%d, %d])", &index, &rows, &cols) == 3;
+    bool is_bias = !is_weight && sscanf(header, "Shape of bia %d: torch.Size([%d])", &index, &rows) == 2;
+    if (!is_weight && !is_bias)
+        return 0;
+    if (index < 1 || rows < 1 || (is_weight && cols < 1) || caption == end || reserve_layers(model, index) < 0)
+        return -1;
+
+    struct model_layer_struct *layer = &model->layers[index - 1];
+    const float **values = is_weight ? &layer->weight : &layer->bias;
+    if (*values != NULL || (layer->rows != 0 && layer->rows != rows))
+        return -1;
+    layer->rows = rows;
+    if (is_weight)
+        layer->cols = cols;
+
+    tensor->count = is_weight ? (size_t)rows * cols : (size_t)rows;
+    tensor->values = (float *)malloc(tensor->count * sizeof(float));
+    if (tensor->values == NULL)
+        return -1;
+    *values = tensor->values;
+    tensor->begin = next_line(caption, end);
+    tensor->end = end;
+    tensor->ok = false;
+    return 1;
+}
+
+/* the layers are numbered from 1 and each is used as found: a tensor header,
+ * one caption line, then the values up to the next header */
+static bool read_text(model_t model, const char *text, size_t size) {
+    const char *end = text + size;
+
+    /* a single scan over the line starts; the values of a tensor end where
+     * the next header begins */
+    struct model_span_struct *tensors = NULL;
+    size_t num_tensors = 0, capacity = 0;
+    bool ok = true;
+    for (const char *line = text; ok && line < end; line = next_line(line, end)) {
+        if (*line != 'S')
+            continue;
+        if (num_tensors == capacity) {
+            capacity = capacity ? 2 * capacity : 8;
+            struct model_span_struct *grown =
+                (struct model_span_struct *)realloc(tensors, capacity * sizeof(struct model_span_struct));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            tensors = grown;
+        }
+        int status = read_header(model, line, end, &tensors[num_tensors]);
+        if (status < 0) {
+            ok = false;
+        } else if (status > 0) {
+            if (num_tensors > 0)
+                tensors[num_tensors - 1].end = line;
+            num_tensors++;
+        }
+    }
+
+    if (ok && num_tensors > 0) {
+        thpool_t pool;
+        int threads = thpool_default_threads();
+        bool threaded = num_tensors > 1 && threads > 1 && thpool_init(pool, threads) == 0;
+        thpool_run(threaded ? pool : NULL, parse_tensor, tensors, num_tensors);
+        if (threaded)
+            thpool_clear(pool);
+        for (size_t t = 0; ok && t < num_tensors; t++)
+            ok = tensors[t].ok;
+    }
+    free(tensors);
+    return ok;
+}
+
+static size_t dtype_size(uint32_t dtype) {
+    switch (dtype) {
+    case model_f32:
+        return sizeof(float);
+    case model_s16:
+        return sizeof(int16_t);
+    case model_s8:
+        return sizeof(int8_t);
+    default:
+        return 0;
+    }
+}
+
+/* the tensors of a layer found in a binary file */
+struct model_entries_struct {
+    const struct model_file_tensor_struct *weight, *bias, *s16, *s8, *s8_scale;
+};
+
+static bool entry_is(const struct model_file_tensor_struct *entry, uint32_t dtype, int rows, int cols) {
+    return entry->dtype == dtype && entry->rows == (uint32_t)rows && entry->cols == (uint32_t)cols;
+}
+
+/* points the layers at the tensors of a mapped binary file; tensors with
+ * other names are skipped */
+static bool read_binary(model_t model, const char *data, size_t size) {
+    const struct model_file_header_struct *header = (const struct model_file_header_struct *)data;
+    const struct model_file_tensor_struct *entries = (const struct model_file_tensor_struct *)(header + 1);
+    if (header->size != size || header->num_tensors > (size - sizeof(*header)) / sizeof(*entries))
+        return false;
+
+    struct model_entries_struct *found = NULL;
+    bool ok = true;
+    for (uint32_t t = 0; ok && t < header->num_tensors; t++) {
+        const struct model_file_tensor_struct *entry = &entries[t];
+        size_t bytes = dtype_size(entry->dtype) * entry->rows * entry->cols;
+        if (memchr(entry->name, '\0', MODEL_NAME_MAX) == NULL || bytes == 0 || entry->bytes != bytes ||
+            entry->offset % MODEL_FILE_ALIGN != 0 || entry->offset > size || bytes > size - entry->offset) {
+            ok = false;
+            break;
+        }
+
+        int index, length = 0;
+        const struct model_file_tensor_struct **slot = NULL;
+        bool is_weight = sscanf(entry->name, "weight.%d%n", &index, &length) == 1;
+        if (!is_weight && sscanf(entry->name, "bias.%d%n", &index, &length) != 1)
+            continue;
+        if (index < 1 || index > 1 << 16) {
+            ok = false;
+            break;
+        }
+        if (index > model->num_layers) {
+            struct model_entries_struct *grown =
+                (struct model_entries_struct *)realloc(found, index * sizeof(struct model_entries_struct));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            found = grown;
+            memset(found + model->num_layers, 0, (index - model->num_layers) * sizeof(struct model_entries_struct));
+            if (reserve_layers(model, index) < 0) {
+                ok = false;
+                break;
+            }
+        }
+
+        const char *suffix = entry->name + length;
+        struct model_entries_struct *layer = &found[index - 1];
+        if (!is_weight)
+            slot = suffix[0] == '\0' ? &layer->bias : NULL;
+        else if (suffix[0] == '\0')
+            slot = &layer->weight;
+        else if (strcmp(suffix, ".s16") == 0)
+            slot = &layer->s16;
+        else if (strcmp(suffix, ".s8") == 0)
+            slot = &layer->s8;
+        else if (strcmp(suffix, ".s8.scale") == 0)
+            slot = &layer->s8_scale;
+        if (slot == NULL)
+            continue;
+        if (*slot != NULL) {
+            ok = false;
+            break;
+        }
+        *slot = entry;
+    }
+
+    for (int l = 0; ok && l < model->num_layers; l++) {
+        const struct model_entries_struct *layer = &found[l];
+        ok = layer->weight != NULL && layer->bias != NULL && layer->weight->dtype == model_f32;
+        if (!ok)
+            break;
+        int rows = (int)layer->weight->rows, cols = (int)layer->weight->cols;
+        ok = rows > 0 && cols > 0 && entry_is(layer->bias, model_f32, rows, 1) &&
+             (layer->s16 == NULL || entry_is(layer->s16, model_s16, rows, cols)) &&
+             (layer->s8 == NULL) == (layer->s8_scale == NULL) &&
+             (layer->s8 == NULL || (entry_is(layer->s8, model_s8, rows, cols) &&
+                                    entry_is(layer->s8_scale, model_f32, rows, 1)));
+        if (!ok)
+            break;
+
+        struct model_layer_struct *out = &model->layers[l];
+        out->rows = rows;
+        out->cols = cols;
+        out->weight = (const float *)(data + layer->weight->offset);
+        out->bias = (const float *)(data + layer->bias->offset);
+        if (layer->s16 != NULL) {
+            out->weight_s16 = (const int16_t *)(data + layer->s16->offset);
+            out->scale_s16 = layer->s16->scale;
+        }
+        if (layer->s8 != NULL) {
+            out->weight_s8 = (const int8_t *)(data + layer->s8->offset);
+            out->scale_s8 = (const float *)(data + layer->s8_scale->offset);
+        }
+    }
+    free(found);
+    return ok;
+}
+
+/* $VHSS_MODEL if set, fallback otherwise */
+const char *model_default_path(const char *fallback) {
+    const char *env = getenv(MODEL_FILE_ENV);
+    return env != NULL && env[0] != '\0' ? env : fallback;
+}
+
+/* reads either format, told apart by the magic of the binary container */
+int model_read(model_t model, const char *filename) {
+    assert(model && filename);
+    model->num_layers = 0;
+    model->layers = NULL;
+    model->map = NULL;
+    model->map_size = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+        return -1;
+    madvise((void *)text, size, MADV_WILLNEED);
+
+    bool ok;
+    if (size >= sizeof(struct model_file_header_struct) && memcmp(text, MODEL_FILE_MAGIC, 8) == 0) {
+        /* the layers point into the mapping, which stays until model_clear */
+        model->map = (void *)text;
+        model->map_size = size;
+        ok = read_binary(model, text, size);
+    } else {
+        ok = read_text(model, text, size);
+        munmap((void *)text, size);
+    }
+
+    /* every layer needs both tensors and has to take the previous output */
+    for (int l = 0; ok && l < model->num_layers; l++) {
+        const struct model_layer_struct *layer = &model->layers[l];
+        ok = layer->weight != NULL && layer->bias != NULL && (l == 0 || layer->cols == model->layers[l - 1].rows);
+    }
+    if (!ok || model->num_layers == 0) {
+        model_clear(model);
+        return -1;
+    }
+    return 0;
+}
+
+/* fills the table entry of a tensor stored at *offset and moves *offset past it */
+static int describe_tensor(struct model_file_tensor_struct *entry, const char *name, uint32_t dtype, int rows,
+                           int cols, float scale, uint64_t *offset) {
+    memset(entry, 0, sizeof(*entry));
+    if (snprintf(entry->name, MODEL_NAME_MAX, "%s", name) >= MODEL_NAME_MAX)
+        return -1;
+    entry->dtype = dtype;
+    entry->rows = (uint32_t)rows;
+    entry->cols = (uint32_t)cols;
+    entry->scale = scale;
+    entry->offset = *offset;
+    entry->bytes = dtype_size(dtype) * rows * cols;
+    *offset += (entry->bytes + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+    return 0;
+}
+
+/* writes the binary container: the fp32 tensors of every layer, plus the
+ * pre-quantized weights the layers carry */
+int model_write(const model_t model, const char *filename) {
+    assert(model && filename);
+    assert(sizeof(struct model_file_header_struct) == 64 && sizeof(struct model_file_tensor_struct) == 64);
+
+    int num_tensors = 0;
+    for (int l = 0; l < model->num_layers; l++) {
+        const struct model_layer_struct *layer = &model->layers[l];
+        num_tensors += 2 + (layer->weight_s16 != NULL) + 2 * (layer->weight_s8 != NULL && layer->scale_s8 != NULL);
+    }
+    struct model_file_tensor_struct *entries =
+        (struct model_file_tensor_struct *)calloc(num_tensors, sizeof(struct model_file_tensor_struct));
+    const void **sources = (const void **)calloc(num_tensors, sizeof(void *));
+    if (!entries || !sources) {
+        free(entries);
+        free(sources);
+        return -1;
+    }
+
+    /* the table is followed by the data, each tensor aligned */
+    uint64_t offset = sizeof(struct model_file_header_struct) + num_tensors * sizeof(struct model_file_tensor_struct);
+    offset = (offset + MODEL_FILE_ALIGN - 1) / MODEL_FILE_ALIGN * MODEL_FILE_ALIGN;
+    int t = 0, status = 0;
+    char name[MODEL_NAME_MAX];
+    for (int l = 0; status == 0 && l < model->num_layers; l++) {
+        const struct model_layer_struct *layer = &model->layers[l];
+        snprintf(name, sizeof(name), "weight.%d", l + 1);
+        sources[t] = layer->weight;
+        status |= describe_tensor(&entries[t++], name, model_f32, layer->rows, layer->cols, 0.0f, &offset);
+        snprintf(name, sizeof(name), "bias.%d", l + 1);
+        sources[t] = layer->bias;
+        status |= describe_tensor(&entries[t++], name, model_f32, layer->rows, 1, 0.0f, &offset);
+        if (layer->weight_s16 != NULL) {
+            snprintf(name, sizeof(name), "weight.%d.s16", l + 1);
+            sources[t] = layer->weight_s16;
+            status |= describe_tensor(&entries[t++], name, model_s16, layer->rows, layer->cols, layer->scale_s16,
+                                   &offset);
+        }
+        if (layer->weight_s8 != NULL && layer->scale_s8 != NULL) {
+            snprintf(name, sizeof(name), "weight.%d.s8", l + 1);
+            sources[t] = layer->weight_s8;
+            status |= describe_tensor(&entries[t++], name, model_s8, layer->rows, layer->cols, 0.0f, &offset);
+            snprintf(name, sizeof(name), "weight.%d.s8.scale", l + 1);
+            sources[t] = layer->scale_s8;
+            status |= describe_tensor(&entries[t++], name, model_f32, layer->rows, 1, 0.0f, &offset);
+        }
+    }
+
+    struct model_file_header_struct header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_FILE_MAGIC, sizeof(header.magic));
+    header.num_tensors = (uint32_t)num_tensors;
+    header.size = offset;
+
+    FILE *file = status == 0 ? fopen(filename, "wb") : NULL;
+    if (file != NULL) {
+        static const uint8_t zeros[MODEL_FILE_ALIGN];
+        uint64_t written = sizeof(header) + num_tensors * sizeof(struct model_file_tensor_struct);
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(entries, sizeof(struct model_file_tensor_struct), num_tensors, file) == (size_t)num_tensors;
+        for (t = 0; ok && t < num_tensors; t++) {
+            ok = fwrite(zeros, 1, entries[t].offset - written, file) == entries[t].offset - written &&
+                 fwrite(sources[t], 1, entries[t].bytes, file) == entries[t].bytes;
+            written = entries[t].offset + entries[t].bytes;
+        }
+        ok = ok && fwrite(zeros, 1, offset - written, file) == offset - written;
+        status = fclose(file) == 0 && ok ? 0 : -1;
+    } else {
+        status = -1;
+    }
+    free(entries);
+    free(sources);
+    return status;
+}
+
+void model_clear(model_t model) {
+    assert(model);
+    if (model->map != NULL) {
+        munmap(model->map, model->map_size);
+    } else {
+        for (int l = 0; l < model->num_layers; l++) {
+            free((void *)model->layers[l].weight);
+            free((void *)model->layers[l].bias);
+            free((void *)model->layers[l].weight_s16);
+            free((void *)model->layers[l].weight_s8);
+            free((void *)model->layers[l].scale_s8);
+        }
+    }
+    free(model->layers);
+    model->layers = NULL;
+    model->num_layers = 0;
+    model->map = NULL;
+    model->map_size = 0;
+}
+
+/* largest number of features held by an image at any point of the network */
+int model_max_width(const model_t model) {
+    int width = model_inputs(model);
+    for (int l = 0; l < model->num_layers; l++)
+        if (model->layers[l].rows > width)
+            width = model->layers[l].rows;
+    return width;
+}
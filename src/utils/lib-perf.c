@@ -0,0 +1,191 @@
+/*
+ * perf_event_open counter groups.
+ *
+ * The group is read in one read() with PERF_FORMAT_GROUP, which for an
+ * inherited group also adds up the counts of its copies in the child threads,
+ * those still running and those already exited. When the PMU has fewer
+ * counters than the group needs the kernel time-multiplexes it, and the counts
+ * are scaled by the time the group was enabled over the time it ran.
+ */
+
+#include <lib-perf.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define PERF_LINUX
+#endif
+
+static const char *perf_names[PERF_COUNTERS] = {"cycles", "instructions", "llc-misses", "branch-misses",
+                                                "dtlb-misses"};
+
+/* $VHSS_PERF set to anything but 0 */
+bool perf_enabled(void) {
+    const char *env = getenv(PERF_COUNTERS_ENV);
+    return env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+}
+
+const char *perf_counter_name(perf_counter_t counter) {
+    return counter < PERF_COUNTERS ? perf_names[counter] : "unknown";
+}
+
+#if defined(PERF_LINUX)
+static void perf_attr(perf_counter_t counter, struct perf_event_attr *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->read_format =
+        PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* user space only, which is what perf_event_paranoid 2 allows */
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    switch (counter) {
+    case perf_cycles:
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case perf_instructions:
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case perf_llc_misses:
+        attr->config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case perf_branch_misses:
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    default:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                       PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    }
+}
+#endif /* PERF_LINUX */
+
+/* counts the calling thread from now on, and with inherit the threads it
+ * creates from now on too; returns the number of events opened */
+int perf_group_open(perf_group_t group, bool inherit) {
+    assert(group);
+    group->leader = -1;
+    group->num_open = 0;
+    for (int c = 0; c < PERF_COUNTERS; c++)
+        group->fd[c] = -1;
+#if defined(PERF_LINUX)
+    /* the first event that opens leads the group */
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+        struct perf_event_attr attr;
+        perf_attr((perf_counter_t)c, &attr);
+        attr.disabled = group->leader < 0;
+        attr.inherit = inherit;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group->leader, 0);
+        if (fd < 0)
+            continue;
+        if (ioctl(fd, PERF_EVENT_IOC_ID, &group->id[c]) < 0) {
+            close(fd);
+            continue;
+        }
+        group->fd[c] = fd;
+        if (group->leader < 0)
+            group->leader = fd;
+        group->num_open++;
+    }
+    if (group->leader >= 0) {
+        ioctl(group->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif /* PERF_LINUX */
+    return group->num_open;
+}
+
+void perf_group_close(perf_group_t group) {
+    assert(group);
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+        if (group->fd[c] >= 0 && group->fd[c] != group->leader)
+            close(group->fd[c]);
+        group->fd[c] = -1;
+    }
+    if (group->leader >= 0)
+        close(group->leader);
+    group->leader = -1;
+    group->num_open = 0;
+}
+
+/* running totals since the group was opened, scaled when multiplexed */
+void perf_group_read(const perf_group_t group, perf_values_t values) {
+    assert(group && values);
+    perf_values_clear(values);
+#if defined(PERF_LINUX)
+    if (group->leader < 0)
+        return;
+    struct {
+        uint64_t nr, time_enabled, time_running;
+        struct {
+            uint64_t value, id;
+        } events[PERF_COUNTERS];
+    } data;
+    if (read(group->leader, &data, sizeof(data)) <= 0 || data.time_running == 0)
+        return;
+    double scale = (double)data.time_enabled / data.time_running;
+    for (uint64_t e = 0; e < data.nr && e < PERF_COUNTERS; e++) {
+        for (int c = 0; c < PERF_COUNTERS; c++) {
+            if (group->fd[c] >= 0 && group->id[c] == data.events[e].id) {
+                values->count[c] = (uint64_t)(data.events[e].value * scale);
+                values->available[c] = true;
+            }
+        }
+    }
+#endif /* PERF_LINUX */
+}
+
+void perf_values_clear(perf_values_t values) {
+    assert(values);
+    memset(values, 0, sizeof(struct perf_values_struct));
+}
+
+/* adds after - before to values; an event is available once any delta had it */
+void perf_values_add_delta(perf_values_t values, const perf_values_t before, const perf_values_t after) {
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+        if (!before->available[c] || !after->available[c])
+            continue;
+        values->count[c] += after->count[c] > before->count[c] ? after->count[c] - before->count[c] : 0;
+        values->available[c] = true;
+    }
+}
+
+/* the counts divided by runs, with the IPC when both events are there */
+void fprintf_perf(FILE *stream, const char *name, const perf_values_t values, double runs, const char *suffix) {
+    bool any = false;
+    if (strlen(name) > 0)
+        fprintf(stream, "%s: ", name);
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+        if (!values->available[c])
+            continue;
+        fprintf(stream, "%s%s=%.0lf", any ? ", " : "", perf_names[c], values->count[c] / runs);
+        any = true;
+    }
+    if (values->available[perf_cycles] && values->available[perf_instructions] && values->count[perf_cycles] > 0)
+        fprintf(stream, ", ipc=%.2lf", (double)values->count[perf_instructions] / values->count[perf_cycles]);
+    if (!any)
+        fprintf(stream, "counters not available");
+    fprintf(stream, "%s\n", suffix);
+}
+
+/* the same as a JSON object, null for the events not available */
+void fprintf_perf_json(FILE *stream, const perf_values_t values, double runs) {
+    fprintf(stream, "{");
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+        fprintf(stream, "%s\"%s\": ", c ? ", " : "", perf_names[c]);
+        if (values->available[c])
+            fprintf(stream, "%.1lf", values->count[c] / runs);
+        else
+            fprintf(stream, "null");
+    }
+    fprintf(stream, ", \"ipc\": ");
+    if (values->available[perf_cycles] && values->available[perf_instructions] && values->count[perf_cycles] > 0)
+        fprintf(stream, "%.3lf}", (double)values->count[perf_instructions] / values->count[perf_cycles]);
+    else
+        fprintf(stream, "null}");
+}
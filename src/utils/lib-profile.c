@@ -0,0 +1,465 @@
+/*
+ * TSC phase profiler.
+ *
+ * A thread registers its accumulators on its first profile_begin and keeps
+ * them until profile_clear, so the runs of threads that already exited are
+ * still merged. The runs of a phase are summed up as they end, in cycles:
+ * their count, Welford's running mean and squared deviations, the extremes
+ * and a reservoir sample of PROFILE_RESERVOIR runs (Vitter's algorithm R),
+ * so a thread's accumulators have a fixed size however many runs it makes.
+ * The reports merge the moments exactly and estimate the median from the
+ * reservoirs, each kept run standing for count / kept runs of its thread.
+ *
+ * The process CPU time of a run also counts whatever the other threads did
+ * meanwhile, so it is only added up for the runs of the main thread, whose
+ * phases are the ones fanning work out to the pool. Thread CPU time is exact
+ * on any thread and is summed over all of them.
+ */
+
+#include <lib-profile.h>
+#include <pthread.h>
+
+struct profile_samples_struct {
+    size_t count;
+    double mean, m2; /* cycles, Welford's running moments */
+    clock_cycles_t min, max;
+    clock_cycles_t reservoir[PROFILE_RESERVOIR]; /* the first min(count, PROFILE_RESERVOIR) are kept runs */
+    clock_cycles_t total, children;
+    int parent; /* -2 until the phase first ran on this thread */
+    elapsed_time_t wall, process, thread; /* ns, summed over the runs */
+    perf_values_t counters;
+    struct profile_memory_struct memory;
+};
+
+struct profile_thread_struct {
+    struct profile_samples_struct phases[PROFILE_PHASES];
+    profile_phase_t stack[PROFILE_MAX_DEPTH];
+    clock_cycles_t begin[PROFILE_MAX_DEPTH];
+    thread_times_t begin_times[PROFILE_MAX_DEPTH];
+    perf_values_t begin_counters[PROFILE_MAX_DEPTH];
+    memstat_t begin_memory[PROFILE_MAX_DEPTH];
+    long begin_rss[PROFILE_MAX_DEPTH];
+    perf_group_t perf; /* leader -1 when not counting */
+    uint64_t random;   /* xorshift state of the reservoir sampling */
+    int depth;
+    bool main; /* the thread that called profile_init */
+    struct profile_thread_struct *next;
+};
+
+static const char *profile_names[PROFILE_PHASES] = {"keygen",   "split",  "share",  "linear", "hss_evaluate",
+                                                    "prob_gen", "verify", "decode", "rescale"};
+static const char *profile_units[] = {"ns", "us", "ms", "s"};
+/* the phases whose runs also read the CPU clocks and, on the main thread,
+ * count the events of the whole process: the per-neuron ones are too short
+ * for two system calls at each end */
+static const bool profile_coarse[PROFILE_PHASES] = {[phase_keygen] = true, [phase_split] = true,
+                                                     [phase_linear] = true};
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool profile_counters = false;
+static bool profile_memory = false;
+static int profile_width = 1;
+static perf_group_t profile_process = {{.leader = -1}}; /* inherited by the threads started later */
+static struct profile_thread_struct *profile_threads = NULL;
+static __thread struct profile_thread_struct *profile_self = NULL;
+
+static struct profile_thread_struct *profile_thread(void) {
+    if (profile_self != NULL)
+        return profile_self;
+    /* the only allocation of the profiler on the thread, left out of the counts */
+    memstat_pause();
+    struct profile_thread_struct *self = calloc(1, sizeof(struct profile_thread_struct));
+    memstat_resume();
+    assert(self);
+    for (int p = 0; p < PROFILE_PHASES; p++)
+        self->phases[p].parent = -2;
+    self->random = (uint64_t)(uintptr_t)self | 1;
+    self->perf->leader = -1;
+    if (profile_counters)
+        perf_group_open(self->perf, false);
+    pthread_mutex_lock(&profile_lock);
+    self->next = profile_threads;
+    profile_threads = self;
+    pthread_mutex_unlock(&profile_lock);
+    profile_self = self;
+    return self;
+}
+
+/* measures the TSC frequency and marks the calling thread as the main one;
+ * threads is the number the phases can spread over, for the efficiency;
+ * hardware events and allocations are counted from here on if $VHSS_PERF and
+ * $VHSS_MEMSTAT ask for them */
+void profile_init(int threads) {
+    calibrate_clock_cycles_ratio();
+    profile_width = threads > 0 ? threads : 1;
+    profile_counters = perf_enabled();
+    profile_memory = memstat_enabled();
+    if (profile_counters)
+        perf_group_open(profile_process, true);
+    profile_thread()->main = true;
+}
+
+/* whether events are counted, even if the system made none available */
+bool profile_counting(void) {
+    return profile_counters;
+}
+
+bool profile_measuring_memory(void) {
+    return profile_memory;
+}
+
+/* drops every run recorded so far, closes the counters and frees the
+ * accumulators of all the threads: the other threads must be done with the
+ * profiler, the calling one registers again on its next profile_begin */
+void profile_clear(void) {
+    pthread_mutex_lock(&profile_lock);
+    memstat_pause();
+    while (profile_threads != NULL) {
+        struct profile_thread_struct *t = profile_threads;
+        profile_threads = t->next;
+        if (t->perf->leader >= 0)
+            perf_group_close(t->perf);
+        free(t);
+    }
+    memstat_resume();
+    profile_self = NULL;
+    if (profile_process->leader >= 0)
+        perf_group_close(profile_process);
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* the counters a run of phase reads on the thread */
+static const struct perf_group_struct *profile_perf(const struct profile_thread_struct *self,
+                                                    profile_phase_t phase) {
+    return self->main && profile_coarse[phase] && profile_process->leader >= 0 ? profile_process : self->perf;
+}
+
+/* adds a run to the moments and to the reservoir */
+static void profile_sample(struct profile_thread_struct *self, struct profile_samples_struct *samples,
+                           clock_cycles_t cycles) {
+    size_t n = ++samples->count;
+    double delta = (double)cycles - samples->mean;
+    samples->mean += delta / n;
+    samples->m2 += delta * ((double)cycles - samples->mean);
+    if (n == 1 || cycles < samples->min)
+        samples->min = cycles;
+    if (cycles > samples->max)
+        samples->max = cycles;
+    if (n <= PROFILE_RESERVOIR) {
+        samples->reservoir[n - 1] = cycles;
+        return;
+    }
+    self->random ^= self->random << 13;
+    self->random ^= self->random >> 7;
+    self->random ^= self->random << 17;
+    uint64_t slot = self->random % n;
+    if (slot < PROFILE_RESERVOIR)
+        samples->reservoir[slot] = cycles;
+}
+
+void profile_begin(profile_phase_t phase) {
+    struct profile_thread_struct *self = profile_thread();
+    assert(phase < PROFILE_PHASES && self->depth < PROFILE_MAX_DEPTH);
+    self->stack[self->depth] = phase;
+    if (profile_memory) {
+        self->begin_rss[self->depth] = memstat_peak_rss();
+        memstat_thread(self->begin_memory[self->depth]);
+    }
+    const struct perf_group_struct *perf = profile_perf(self, phase);
+    if (perf->leader >= 0)
+        perf_group_read(perf, self->begin_counters[self->depth]);
+    if (profile_coarse[phase])
+        get_thread_times(self->begin_times[self->depth]);
+    self->begin[self->depth++] = rdtsc();
+}
+
+void profile_end(profile_phase_t phase) {
+    clock_cycles_t end = rdtsc();
+    struct profile_thread_struct *self = profile_self;
+    assert(self && self->depth > 0 && self->stack[self->depth - 1] == phase);
+    clock_cycles_t cycles = end - self->begin[--self->depth];
+
+    struct profile_samples_struct *samples = &self->phases[phase];
+    if (profile_coarse[phase]) {
+        thread_times_t end_times;
+        get_thread_times(end_times);
+        elapsed_times_t times;
+        get_elapsed_times(times, self->begin_times[self->depth], end_times);
+        samples->thread += times->thread;
+        if (self->main) {
+            samples->wall += times->wall;
+            samples->process += times->process;
+        }
+    }
+    const struct perf_group_struct *perf = profile_perf(self, phase);
+    if (perf->leader >= 0) {
+        perf_values_t counters;
+        perf_group_read(perf, counters);
+        perf_values_add_delta(samples->counters, self->begin_counters[self->depth], counters);
+    }
+    if (profile_memory) {
+        memstat_t memory;
+        memstat_thread(memory);
+        const struct memstat_struct *begin = self->begin_memory[self->depth];
+        long rss = memstat_peak_rss();
+        samples->memory.allocs += memory->allocs - begin->allocs;
+        samples->memory.bytes += memory->bytes - begin->bytes;
+        samples->memory.gmp_allocs += memory->gmp_allocs - begin->gmp_allocs;
+        samples->memory.gmp_bytes += memory->gmp_bytes - begin->gmp_bytes;
+        samples->memory.rss_growth += rss - self->begin_rss[self->depth];
+        if (rss > samples->memory.peak_rss)
+            samples->memory.peak_rss = rss;
+    }
+    profile_sample(self, samples, cycles);
+    samples->total += cycles;
+    if (samples->parent == -2)
+        samples->parent = self->depth > 0 ? (int)self->stack[self->depth - 1] : -1;
+    if (self->depth > 0)
+        self->phases[self->stack[self->depth - 1]].children += cycles;
+}
+
+const char *profile_phase_name(profile_phase_t phase) {
+    return phase < PROFILE_PHASES ? profile_names[phase] : "unknown";
+}
+
+/* $VHSS_PROFILE if set, NULL otherwise */
+const char *profile_json_path(void) {
+    const char *env = getenv(PROFILE_JSON_ENV);
+    return env != NULL && env[0] != '\0' ? env : NULL;
+}
+
+static elapsed_time_t cycles_to(double cycles, enum time_unit unit) {
+    return et_to(cycles / get_clock_cycles_per_ns(), unit);
+}
+
+struct profile_kept_struct {
+    clock_cycles_t cycles;
+    double weight; /* runs it stands for */
+};
+
+static int profile_kept_compare(const void *a, const void *b) {
+    clock_cycles_t x = ((const struct profile_kept_struct *)a)->cycles;
+    clock_cycles_t y = ((const struct profile_kept_struct *)b)->cycles;
+    return (x > y) - (x < y);
+}
+
+/* the statistics of the count runs of phase on all threads, with no kernel
+ * cut: the moments and the extremes are exact, the median is the weighted
+ * median of the reservoirs; called with profile_lock held */
+static void profile_merge_stats(stats_t stats, int phase, size_t count, int threads, enum time_unit unit) {
+    size_t capacity = (size_t)threads * PROFILE_RESERVOIR;
+    struct profile_kept_struct *kept = malloc((count < capacity ? count : capacity) * sizeof(*kept));
+    double mean = 0.0, m2 = 0.0;
+    clock_cycles_t min = 0, max = 0;
+    size_t seen = 0, k = 0;
+    for (struct profile_thread_struct *t = profile_threads; t != NULL; t = t->next) {
+        const struct profile_samples_struct *samples = &t->phases[phase];
+        if (samples->count == 0)
+            continue;
+        /* Chan et al.'s pairwise update of the moments */
+        double delta = samples->mean - mean;
+        size_t n = seen + samples->count;
+        mean += delta * samples->count / n;
+        m2 += samples->m2 + delta * delta * seen * samples->count / n;
+        if (seen == 0 || samples->min < min)
+            min = samples->min;
+        if (samples->max > max)
+            max = samples->max;
+        seen = n;
+        size_t size = samples->count < PROFILE_RESERVOIR ? samples->count : PROFILE_RESERVOIR;
+        for (size_t s = 0; s < size && kept != NULL; s++, k++) {
+            kept[k].cycles = samples->reservoir[s];
+            kept[k].weight = (double)samples->count / size;
+        }
+    }
+
+    stats->unit = unit;
+    stats->size = stats->ksize = count;
+    stats->mean = cycles_to(mean, unit);
+    stats->stddev = cycles_to(sqrt(m2 / count), unit);
+    stats->min = cycles_to(min, unit);
+    stats->max = cycles_to(max, unit);
+    stats->median = stats->mean;
+    if (kept != NULL) {
+        qsort(kept, k, sizeof(*kept), profile_kept_compare);
+        double weight = 0.0;
+        for (size_t i = 0; i < k; i++) {
+            weight += kept[i].weight;
+            if (weight >= 0.5 * count) {
+                stats->median = cycles_to(kept[i].cycles, unit);
+                break;
+            }
+        }
+        free(kept);
+    }
+}
+
+/* appends the phases below parent in depth-first order */
+static void summarize_below(struct profile_summary_struct *merged, int parent, int depth,
+                            struct profile_summary_struct *summary, int *n) {
+    for (int p = 0; p < PROFILE_PHASES; p++) {
+        if (merged[p].threads == 0 || merged[p].parent != parent)
+            continue;
+        merged[p].depth = depth;
+        summary[(*n)++] = merged[p];
+        summarize_below(merged, p, depth + 1, summary, n);
+    }
+}
+
+/* merges the threads and fills summary with the phases that ran, parents
+ * before their children; returns their number */
+int profile_summarize(struct profile_summary_struct summary[PROFILE_PHASES], enum time_unit unit) {
+    struct profile_summary_struct merged[PROFILE_PHASES];
+    memset(merged, 0, sizeof(merged));
+
+    pthread_mutex_lock(&profile_lock);
+    for (int p = 0; p < PROFILE_PHASES; p++) {
+        size_t count = 0;
+        clock_cycles_t total = 0, children = 0;
+        elapsed_times_t main_times = {{0.0, 0.0, 0.0}};
+        elapsed_time_t thread = 0.0;
+        merged[p].phase = (profile_phase_t)p;
+        merged[p].parent = -1;
+        for (struct profile_thread_struct *t = profile_threads; t != NULL; t = t->next) {
+            const struct profile_samples_struct *samples = &t->phases[p];
+            if (samples->count == 0)
+                continue;
+            /* a phase seen at different depths is filed under its first parent */
+            if (merged[p].threads++ == 0)
+                merged[p].parent = samples->parent;
+            count += samples->count;
+            total += samples->total;
+            children += samples->children;
+            thread += samples->thread;
+            if (t->main) {
+                main_times->wall += samples->wall;
+                main_times->process += samples->process;
+            }
+            for (int c = 0; c < PERF_COUNTERS; c++) {
+                merged[p].counters->count[c] += samples->counters->count[c];
+                merged[p].counters->available[c] |= samples->counters->available[c];
+            }
+            merged[p].memory.allocs += samples->memory.allocs;
+            merged[p].memory.bytes += samples->memory.bytes;
+            merged[p].memory.gmp_allocs += samples->memory.gmp_allocs;
+            merged[p].memory.gmp_bytes += samples->memory.gmp_bytes;
+            merged[p].memory.rss_growth += samples->memory.rss_growth;
+            if (samples->memory.peak_rss > merged[p].memory.peak_rss)
+                merged[p].memory.peak_rss = samples->memory.peak_rss;
+        }
+        if (count == 0)
+            continue;
+
+        profile_merge_stats(merged[p].stats, p, count, merged[p].threads, unit);
+        merged[p].total = cycles_to(total, unit);
+        merged[p].self = cycles_to(total - children, unit);
+        merged[p].thread_cpu = profile_coarse[p] ? et_to(thread, unit) : -1.0;
+        merged[p].cpu = merged[p].efficiency = -1.0;
+        if (main_times->wall > 0.0) {
+            merged[p].cpu = et_to(main_times->process, unit);
+            merged[p].efficiency = get_parallel_efficiency(main_times, profile_width);
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    /* a parent that never ran on its own makes its children top-level */
+    for (int p = 0; p < PROFILE_PHASES; p++)
+        if (merged[p].parent >= 0 && merged[merged[p].parent].threads == 0)
+            merged[p].parent = -1;
+
+    int n = 0;
+    summarize_below(merged, -1, 0, summary, &n);
+    return n;
+}
+
+/* time spent in the top-level phases of the main thread */
+elapsed_time_t profile_total(enum time_unit unit) {
+    clock_cycles_t total = 0;
+    pthread_mutex_lock(&profile_lock);
+    for (struct profile_thread_struct *t = profile_threads; t != NULL; t = t->next) {
+        if (!t->main)
+            continue;
+        for (int p = 0; p < PROFILE_PHASES; p++)
+            if (t->phases[p].parent == -1)
+                total += t->phases[p].total;
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return cycles_to(total, unit);
+}
+
+/* one fprintf_stats line per phase, indented under its parent, followed by
+ * the events and the allocations when they are measured */
+void profile_report(FILE *stream, enum time_unit unit) {
+    struct profile_summary_struct summary[PROFILE_PHASES];
+    int n = profile_summarize(summary, unit);
+    for (int i = 0; i < n; i++) {
+        char name[64], suffix[256];
+        snprintf(name, sizeof(name), "%*s%s", 2 * summary[i].depth, "", profile_phase_name(summary[i].phase));
+        int length = snprintf(suffix, sizeof(suffix), ", total=%.3lf %s, self=%.3lf %s, threads=%d",
+                              summary[i].total, profile_units[unit], summary[i].self, profile_units[unit],
+                              summary[i].threads);
+        if (summary[i].thread_cpu >= 0.0)
+            length += snprintf(suffix + length, sizeof(suffix) - length, ", thread cpu=%.3lf %s",
+                               summary[i].thread_cpu, profile_units[unit]);
+        if (summary[i].cpu >= 0.0)
+            snprintf(suffix + length, sizeof(suffix) - length, ", cpu=%.3lf %s, efficiency=%.2lf", summary[i].cpu,
+                     profile_units[unit], summary[i].efficiency);
+        fprintf_stats(stream, name, summary[i].stats, suffix);
+        if (profile_counters) {
+            snprintf(name, sizeof(name), "%*sevents", 2 * summary[i].depth + 2, "");
+            fprintf_perf(stream, name, summary[i].counters, summary[i].stats->size, "");
+        }
+        if (profile_memory) {
+            const struct profile_memory_struct *m = &summary[i].memory;
+            double runs = summary[i].stats->size;
+            fprintf(stream,
+                    "%*smemory: allocs=%.1lf, bytes=%.0lf, gmp allocs=%.1lf, gmp bytes=%.0lf per run, "
+                    "rss growth=%ld KiB, peak rss=%ld KiB\n",
+                    2 * summary[i].depth + 2, "", m->allocs / runs, m->bytes / runs, m->gmp_allocs / runs,
+                    m->gmp_bytes / runs, m->rss_growth, m->peak_rss);
+        }
+    }
+}
+
+void profile_report_json(FILE *stream, enum time_unit unit) {
+    struct profile_summary_struct summary[PROFILE_PHASES];
+    int n = profile_summarize(summary, unit);
+    fprintf(stream, "{\n  \"unit\": \"%s\",\n  \"total\": %.6lf,\n  \"threads\": %d,\n  \"phases\": [",
+            profile_units[unit], profile_total(unit), profile_width);
+    for (int i = 0; i < n; i++) {
+        const struct profile_summary_struct *s = &summary[i];
+        fprintf(stream, "%s\n    {\"name\": \"%s\", \"parent\": ", i ? "," : "", profile_phase_name(s->phase));
+        if (s->parent < 0)
+            fprintf(stream, "null");
+        else
+            fprintf(stream, "\"%s\"", profile_phase_name((profile_phase_t)s->parent));
+        fprintf(stream,
+                ", \"depth\": %d, \"threads\": %d, \"count\": %zu, \"total\": %.6lf, \"self\": %.6lf, "
+                "\"mean\": %.6lf, \"median\": %.6lf, \"stddev\": %.6lf, \"min\": %.6lf, \"max\": %.6lf, "
+                "\"kernel\": %zu",
+                s->depth, s->threads, s->stats->size, s->total, s->self, s->stats->mean, s->stats->median,
+                s->stats->stddev, s->stats->min, s->stats->max, s->stats->ksize);
+        if (s->thread_cpu >= 0.0)
+            fprintf(stream, ", \"thread_cpu\": %.6lf", s->thread_cpu);
+        else
+            fprintf(stream, ", \"thread_cpu\": null");
+        if (s->cpu >= 0.0)
+            fprintf(stream, ", \"cpu\": %.6lf, \"efficiency\": %.4lf", s->cpu, s->efficiency);
+        else
+            fprintf(stream, ", \"cpu\": null, \"efficiency\": null");
+        if (profile_counters) {
+            fprintf(stream, ", \"counters\": ");
+            fprintf_perf_json(stream, s->counters, s->stats->size);
+        }
+        if (profile_memory) {
+            const struct profile_memory_struct *m = &s->memory;
+            fprintf(stream,
+                    ", \"memory\": {\"allocs\": %llu, \"bytes\": %llu, \"gmp_allocs\": %llu, \"gmp_bytes\": %llu, "
+                    "\"rss_growth_kb\": %ld, \"peak_rss_kb\": %ld}",
+                    (unsigned long long)m->allocs, (unsigned long long)m->bytes, (unsigned long long)m->gmp_allocs,
+                    (unsigned long long)m->gmp_bytes, m->rss_growth, m->peak_rss);
+        }
+        fprintf(stream, "}");
+    }
+    fprintf(stream, "\n  ]\n}\n");
+}
@@ -0,0 +1,345 @@
+/*
+ * Cache-blocked int16 x int32 GEMM in the ring Z_2^32.
+ *
+ * Blocking: the activations of QGEMM_NC images are packed once into int16
+ * pair panels (kept in L2) and swept by every QGEMM_MR-row slice of the
+ * weights (kept in L1). The microkernel computes a QGEMM_MR x QGEMM_NR tile
+ * with pmaddwd; the high limb pass, when needed, is accumulated first and
+ * shifted by 16 bits before the low limb pass is added on top.
+ */
+
+#include <lib-qgemm.h>
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QGEMM_X86
+#endif
+
+/* images packed together in a panel block and rows per task when the rows
+ * are split between threads */
+#define QGEMM_NC (4 * QGEMM_NR)
+#define QGEMM_MC (32 * QGEMM_MR)
+
+typedef void (*qgemm_kernel_fn)(const int16_t *w, size_t ldw, int pairs, const int32_t *lo,
+                                const int32_t *hi, uint32_t acc[QGEMM_MR][QGEMM_NR]);
+
+static size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+int qmatrix_init(qmatrix_t q, int rows, int cols) {
+    assert(q);
+    assert(rows > 0 && cols > 0);
+    q->rows = rows;
+    q->cols = cols;
+    q->ld = (int)round_up(cols, 32);
+    size_t bytes = round_up(rows, QGEMM_MR) * q->ld * sizeof(int16_t);
+    if (posix_memalign((void **)&q->data, 64, bytes) != 0) {
+        q->data = NULL;
+        return -1;
+    }
+    memset(q->data, 0, bytes);
+    return 0;
+}
+
+void qmatrix_clear(qmatrix_t q) {
+    assert(q);
+    free(q->data);
+    q->data = NULL;
+}
+
+/* quantizes a rows x cols row-major float matrix as round(w * scale) */
+void qmatrix_quantize(qmatrix_t q, const float *weight, int scale) {
+    assert(q && q->data && weight);
+    for (int i = 0; i < q->rows; i++) {
+        for (int j = 0; j < q->cols; j++) {
+            long v = lroundf(weight[(size_t)i * q->cols + j] * scale);
+            if (v > INT16_MAX)
+                v = INT16_MAX;
+            else if (v < -INT16_MAX)
+                v = -INT16_MAX;
+            q->data[(size_t)i * q->ld + j] = (int16_t)v;
+        }
+    }
+}
+
+/* takes a rows x cols row-major matrix quantized ahead of time */
+void qmatrix_load(qmatrix_t q, const int16_t *weight) {
+    assert(q && q->data && weight);
+    for (int i = 0; i < q->rows; i++)
+        memcpy(q->data + (size_t)i * q->ld, weight + (size_t)i * q->cols, q->cols * sizeof(int16_t));
+}
+
+/* packs the QGEMM_NR images starting at first into lo/hi panels of int32
+ * words, each holding the int16 limbs of inputs 2p and 2p+1 such that
+ * x = hi * 2^16 + lo (mod 2^32); images of a PRG-defined input are expanded
+ * into row first. Returns whether any high limb is non-zero */
+static bool pack_panel(int32_t *lo, int32_t *hi, const struct qgemm_job_struct *job, size_t first,
+                       size_t valid, int cols, uint32_t *row) {
+    int pairs = (cols + 1) / 2;
+    uint32_t wide = 0;
+
+    for (size_t c = 0; c < QGEMM_NR; c++) {
+        if (c >= valid) {
+            for (int p = 0; p < pairs; p++)
+                lo[p * QGEMM_NR + c] = hi[p * QGEMM_NR + c] = 0;
+            continue;
+        }
+
+        const int32_t *x;
+        size_t k_stride;
+        if (job->x_prg != NULL) {
+            prg_words(job->x_prg, job->x_stream, (uint64_t)(first + c) * cols, row, cols);
+            x = (const int32_t *)row;
+            k_stride = 1;
+        } else {
+            x = job->x + (first + c) * job->x_n_stride;
+            k_stride = job->x_k_stride;
+        }
+
+        for (int p = 0; p < pairs; p++) {
+            uint32_t x0 = (uint32_t)x[(size_t)(2 * p) * k_stride];
+            uint32_t x1 = 2 * p + 1 < cols ? (uint32_t)x[(size_t)(2 * p + 1) * k_stride] : 0;
+            uint16_t l0 = (uint16_t)x0, l1 = (uint16_t)x1;
+            uint16_t h0 = (uint16_t)((x0 - (uint32_t)(int32_t)(int16_t)l0) >> 16);
+            uint16_t h1 = (uint16_t)((x1 - (uint32_t)(int32_t)(int16_t)l1) >> 16);
+            lo[p * QGEMM_NR + c] = (int32_t)(l0 | ((uint32_t)l1 << 16));
+            hi[p * QGEMM_NR + c] = (int32_t)(h0 | ((uint32_t)h1 << 16));
+            wide |= h0 | h1;
+        }
+    }
+    return wide != 0;
+}
+
+static inline int32_t load_pair(const int16_t *w) {
+    int32_t pair;
+    memcpy(&pair, w, sizeof(pair));
+    return pair;
+}
+
+static void kernel_generic(const int16_t *w, size_t ldw, int pairs, const int32_t *lo,
+                           const int32_t *hi, uint32_t acc[QGEMM_MR][QGEMM_NR]) {
+    memset(acc, 0, sizeof(uint32_t) * QGEMM_MR * QGEMM_NR);
+    for (int pass = (hi != NULL ? 0 : 1); pass < 2; pass++) {
+        const int32_t *panel = pass == 0 ? hi : lo;
+        if (pass == 1 && hi != NULL) {
+            for (int r = 0; r < QGEMM_MR; r++)
+                for (int c = 0; c < QGEMM_NR; c++)
+                    acc[r][c] <<= 16;
+        }
+        for (int r = 0; r < QGEMM_MR; r++) {
+            const int16_t *row = w + r * ldw;
+            for (int p = 0; p < pairs; p++) {
+                int32_t w0 = row[2 * p], w1 = row[2 * p + 1];
+                for (int c = 0; c < QGEMM_NR; c++) {
+                    uint32_t word = (uint32_t)panel[p * QGEMM_NR + c];
+                    int32_t x0 = (int16_t)(word & 0xffff), x1 = (int16_t)(word >> 16);
+                    acc[r][c] += (uint32_t)(w0 * x0 + w1 * x1);
+                }
+            }
+        }
+    }
+}
+
+#if defined(QGEMM_X86)
+#define QGEMM_AVX2_PASS(PANEL)                                                 \
+    for (int p = 0; p < pairs; p++) {                                          \
+        __m256i b0 = _mm256_load_si256((const __m256i *)(PANEL + p * QGEMM_NR)); \
+        __m256i b1 =                                                           \
+            _mm256_load_si256((const __m256i *)(PANEL + p * QGEMM_NR + 8));     \
+        __m256i a = _mm256_set1_epi32(load_pair(w0 + 2 * p));                  \
+        c00 = _mm256_add_epi32(c00, _mm256_madd_epi16(a, b0));                 \
+        c01 = _mm256_add_epi32(c01, _mm256_madd_epi16(a, b1));                 \
+        a = _mm256_set1_epi32(load_pair(w1 + 2 * p));                          \
+        c10 = _mm256_add_epi32(c10, _mm256_madd_epi16(a, b0));                 \
+        c11 = _mm256_add_epi32(c11, _mm256_madd_epi16(a, b1));                 \
+        a = _mm256_set1_epi32(load_pair(w2 + 2 * p));                          \
+        c20 = _mm256_add_epi32(c20, _mm256_madd_epi16(a, b0));                 \
+        c21 = _mm256_add_epi32(c21, _mm256_madd_epi16(a, b1));                 \
+        a = _mm256_set1_epi32(load_pair(w3 + 2 * p));                          \
+        c30 = _mm256_add_epi32(c30, _mm256_madd_epi16(a, b0));                 \
+        c31 = _mm256_add_epi32(c31, _mm256_madd_epi16(a, b1));                 \
+    }
+
+__attribute__((target("avx2"))) static void
+kernel_avx2(const int16_t *w, size_t ldw, int pairs, const int32_t *lo, const int32_t *hi,
+            uint32_t acc[QGEMM_MR][QGEMM_NR]) {
+    const int16_t *w0 = w, *w1 = w + ldw, *w2 = w + 2 * ldw, *w3 = w + 3 * ldw;
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+
+    if (hi != NULL) {
+        QGEMM_AVX2_PASS(hi)
+        c00 = _mm256_slli_epi32(c00, 16), c01 = _mm256_slli_epi32(c01, 16);
+        c10 = _mm256_slli_epi32(c10, 16), c11 = _mm256_slli_epi32(c11, 16);
+        c20 = _mm256_slli_epi32(c20, 16), c21 = _mm256_slli_epi32(c21, 16);
+        c30 = _mm256_slli_epi32(c30, 16), c31 = _mm256_slli_epi32(c31, 16);
+    }
+    QGEMM_AVX2_PASS(lo)
+
+    _mm256_storeu_si256((__m256i *)&acc[0][0], c00);
+    _mm256_storeu_si256((__m256i *)&acc[0][8], c01);
+    _mm256_storeu_si256((__m256i *)&acc[1][0], c10);
+    _mm256_storeu_si256((__m256i *)&acc[1][8], c11);
+    _mm256_storeu_si256((__m256i *)&acc[2][0], c20);
+    _mm256_storeu_si256((__m256i *)&acc[2][8], c21);
+    _mm256_storeu_si256((__m256i *)&acc[3][0], c30);
+    _mm256_storeu_si256((__m256i *)&acc[3][8], c31);
+}
+#endif /* QGEMM_X86 */
+
+/* the fastest kernel of the CPU, or the generic one if $VHSS_QGEMM_KERNEL says so */
+static qgemm_kernel_fn select_kernel(void) {
+#if defined(QGEMM_X86)
+    const char *env = getenv(QGEMM_KERNEL_ENV);
+    if ((env == NULL || strcmp(env, "generic") != 0) && __builtin_cpu_supports("avx2"))
+        return kernel_avx2;
+#endif
+    return kernel_generic;
+}
+
+/* consecutive jobs with the same weights and number of images are fused: a
+ * task packs the image block of every job of the group, then sweeps each
+ * QGEMM_MR-row slice of the weights over all of them while it is in L1 */
+struct qgemm_group_struct {
+    int first_job, num_jobs;
+    int row_tile;      /* rows per task */
+    size_t first_task; /* index of the first task of the group */
+};
+
+struct qgemm_batch_struct {
+    const struct qgemm_job_struct *jobs;
+    struct qgemm_group_struct *groups;
+    int num_groups;
+    int32_t *scratch; /* per worker: one lo/hi panel block per job of a group and one input row */
+    size_t scratch_words;
+    qgemm_kernel_fn kernel;
+};
+
+static size_t block_words(const struct qmatrix_struct *w) {
+    return 2 * (QGEMM_NC / QGEMM_NR) * (size_t)((w->cols + 1) / 2) * QGEMM_NR;
+}
+
+static void qgemm_task(void *arg, size_t task, int worker) {
+    struct qgemm_batch_struct *batch = arg;
+    int g = 0;
+    while (g + 1 < batch->num_groups && task >= batch->groups[g + 1].first_task)
+        g++;
+
+    const struct qgemm_group_struct *group = &batch->groups[g];
+    const struct qgemm_job_struct *jobs = batch->jobs + group->first_job;
+    const struct qmatrix_struct *w = jobs[0].w;
+    int row_tiles = (w->rows + group->row_tile - 1) / group->row_tile;
+    size_t local = task - group->first_task;
+    int m_begin = (int)(local % row_tiles) * group->row_tile;
+    int m_end = m_begin + group->row_tile < w->rows ? m_begin + group->row_tile : w->rows;
+    size_t n0 = (local / row_tiles) * QGEMM_NC;
+    size_t block = jobs[0].n - n0 < QGEMM_NC ? jobs[0].n - n0 : QGEMM_NC;
+    int panels = (int)((block + QGEMM_NR - 1) / QGEMM_NR);
+
+    int pairs = (w->cols + 1) / 2;
+    size_t panel_words = (size_t)pairs * QGEMM_NR;
+    size_t job_words = block_words(w);
+    int32_t *scratch = batch->scratch + (size_t)worker * batch->scratch_words;
+    uint32_t *row = (uint32_t *)(scratch + group->num_jobs * job_words);
+    bool wide[group->num_jobs][QGEMM_NC / QGEMM_NR];
+    uint32_t acc[QGEMM_MR][QGEMM_NR];
+
+    for (int j = 0; j < group->num_jobs; j++) {
+        int32_t *lo = scratch + j * job_words, *hi = lo + (QGEMM_NC / QGEMM_NR) * panel_words;
+        for (int s = 0; s < panels; s++) {
+            size_t valid = block - s * QGEMM_NR < QGEMM_NR ? block - s * QGEMM_NR : QGEMM_NR;
+            wide[j][s] = pack_panel(lo + s * panel_words, hi + s * panel_words, &jobs[j],
+                                    n0 + s * QGEMM_NR, valid, w->cols, row);
+        }
+    }
+
+    for (int m0 = m_begin; m0 < m_end; m0 += QGEMM_MR) {
+        int rows = m_end - m0 < QGEMM_MR ? m_end - m0 : QGEMM_MR;
+        for (int j = 0; j < group->num_jobs; j++) {
+            const struct qgemm_job_struct *job = &jobs[j];
+            int32_t *lo = scratch + j * job_words, *hi = lo + (QGEMM_NC / QGEMM_NR) * panel_words;
+            for (int s = 0; s < panels; s++) {
+                size_t valid = block - s * QGEMM_NR < QGEMM_NR ? block - s * QGEMM_NR : QGEMM_NR;
+                batch->kernel(w->data + (size_t)m0 * w->ld, w->ld, pairs, lo + s * panel_words,
+                       wide[j][s] ? hi + s * panel_words : NULL, acc);
+                for (int r = 0; r < rows; r++) {
+                    uint32_t b = job->bias != NULL ? (uint32_t)job->bias[m0 + r] : 0;
+                    int32_t *out = job->y + (size_t)(m0 + r) * job->y_m_stride +
+                                   (n0 + s * QGEMM_NR) * job->y_n_stride;
+                    for (size_t c = 0; c < valid; c++)
+                        out[c * job->y_n_stride] = (int32_t)(acc[r][c] + b);
+                }
+            }
+        }
+    }
+}
+
+/* runs several GEMMs on the pool (NULL runs them on the caller), e.g. the
+ * products of the k shares of a layer. Each group of fused jobs is cut into
+ * blocks of QGEMM_NC images; the rows are also split into tiles when there
+ * are too few image blocks to keep every thread busy */
+void qgemm_s32_run(thpool_t pool, const struct qgemm_job_struct *jobs, int num_jobs) {
+    struct qgemm_batch_struct batch;
+    int threads = thpool_size(pool);
+    size_t blocks = 0;
+
+    assert(jobs && num_jobs > 0);
+    batch.jobs = jobs;
+    batch.kernel = select_kernel();
+    batch.groups = (struct qgemm_group_struct *)malloc(num_jobs * sizeof(struct qgemm_group_struct));
+    assert(batch.groups);
+
+    batch.num_groups = 0;
+    batch.scratch_words = 0;
+    for (int j = 0; j < num_jobs; j++) {
+        struct qgemm_group_struct *group = batch.num_groups > 0 ? &batch.groups[batch.num_groups - 1] : NULL;
+        if (group != NULL && jobs[group->first_job].w == jobs[j].w && jobs[group->first_job].n == jobs[j].n) {
+            group->num_jobs++;
+        } else {
+            group = &batch.groups[batch.num_groups++];
+            group->first_job = j;
+            group->num_jobs = 1;
+            blocks += (jobs[j].n + QGEMM_NC - 1) / QGEMM_NC;
+        }
+        size_t words = group->num_jobs * block_words(jobs[j].w) + (size_t)(jobs[j].w->cols + 15) / 16 * 16;
+        if (words > batch.scratch_words)
+            batch.scratch_words = words;
+    }
+
+    size_t tasks = 0;
+    for (int g = 0; g < batch.num_groups; g++) {
+        struct qgemm_group_struct *group = &batch.groups[g];
+        const struct qmatrix_struct *w = jobs[group->first_job].w;
+        size_t group_blocks = (jobs[group->first_job].n + QGEMM_NC - 1) / QGEMM_NC;
+        group->row_tile = w->rows;
+        if (blocks < 4 * (size_t)threads && w->rows > QGEMM_MC)
+            group->row_tile = QGEMM_MC;
+        group->first_task = tasks;
+        tasks += group_blocks * ((w->rows + group->row_tile - 1) / group->row_tile);
+    }
+
+    if (posix_memalign((void **)&batch.scratch, 64, threads * batch.scratch_words * sizeof(int32_t)) != 0)
+        abort();
+
+    thpool_run(pool, qgemm_task, &batch, tasks);
+
+    free(batch.scratch);
+    free(batch.groups);
+}
+
+/* y[i][j] = bias[i] + sum_k w[i][k] * x[k][j] (mod 2^32) for the n columns of
+ * x; element (k, j) of x is x[k * x_k_stride + j * x_n_stride] and element
+ * (i, j) of y is y[i * y_m_stride + j * y_n_stride]; bias may be NULL */
+void qgemm_s32(const qmatrix_t w, const int32_t *bias, const int32_t *x, size_t x_k_stride,
+               size_t x_n_stride, int32_t *y, size_t y_m_stride, size_t y_n_stride, size_t n) {
+    struct qgemm_job_struct job = {w, bias, x, x_k_stride, x_n_stride, NULL, 0, y, y_m_stride, y_n_stride, n};
+    qgemm_s32_run(NULL, &job, 1);
+}
@@ -0,0 +1,230 @@
+/*
+ * Cache-blocked FP32 GEMM with a fused bias/activation epilogue.
+ *
+ * Blocking: the weights are packed once into k-major panels of SGEMM_NR
+ * output features. A task packs SGEMM_MC images into k-major SGEMM_MR-image
+ * panels (kept in L2) and sweeps every weight panel of its feature range over
+ * them, one SGEMM_MR x SGEMM_NR register tile at a time.
+ */
+
+#include <lib-sgemm.h>
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SGEMM_X86
+#endif
+
+/* images packed together in a task and weight panels per task when the
+ * output features are split between threads */
+#define SGEMM_MC (8 * SGEMM_MR)
+#define SGEMM_PANELS_PER_TILE 8
+
+typedef void (*sgemm_kernel_fn)(int k, const float *a, const float *b, float acc[SGEMM_MR][SGEMM_NR]);
+
+int smatrix_init(smatrix_t w, int rows, int cols) {
+    assert(w);
+    assert(rows > 0 && cols > 0);
+    w->rows = rows;
+    w->cols = cols;
+    w->panels = (rows + SGEMM_NR - 1) / SGEMM_NR;
+    size_t floats = (size_t)w->panels * cols * SGEMM_NR;
+    if (posix_memalign((void **)&w->data, 64, floats * sizeof(float)) != 0) {
+        w->data = NULL;
+        return -1;
+    }
+    w->bias = (float *)calloc((size_t)w->panels * SGEMM_NR, sizeof(float));
+    if (!w->bias) {
+        free(w->data);
+        w->data = NULL;
+        return -1;
+    }
+    memset(w->data, 0, floats * sizeof(float));
+    return 0;
+}
+
+void smatrix_clear(smatrix_t w) {
+    assert(w);
+    free(w->data);
+    free(w->bias);
+    w->data = NULL;
+    w->bias = NULL;
+}
+
+/* packs a rows x cols row-major weight matrix and its bias (may be NULL) */
+void smatrix_pack(smatrix_t w, const float *weight, const float *bias) {
+    assert(w && w->data && weight);
+    for (int i = 0; i < w->rows; i++) {
+        float *panel = w->data + (size_t)(i / SGEMM_NR) * w->cols * SGEMM_NR;
+        for (int k = 0; k < w->cols; k++)
+            panel[(size_t)k * SGEMM_NR + i % SGEMM_NR] = weight[(size_t)i * w->cols + k];
+        w->bias[i] = bias != NULL ? bias[i] : 0.0f;
+    }
+}
+
+/* packs valid (<= SGEMM_MR) images into a k-major panel, zero padded */
+static void pack_images(float *a, const float *x, size_t x_stride, size_t valid, int k) {
+    for (size_t r = 0; r < SGEMM_MR; r++) {
+        if (r >= valid) {
+            for (int p = 0; p < k; p++)
+                a[p * SGEMM_MR + r] = 0.0f;
+            continue;
+        }
+        const float *row = x + r * x_stride;
+        for (int p = 0; p < k; p++)
+            a[p * SGEMM_MR + r] = row[p];
+    }
+}
+
+static void kernel_generic(int k, const float *a, const float *b, float acc[SGEMM_MR][SGEMM_NR]) {
+    memset(acc, 0, sizeof(float) * SGEMM_MR * SGEMM_NR);
+    for (int p = 0; p < k; p++) {
+        for (int r = 0; r < SGEMM_MR; r++) {
+            float x = a[p * SGEMM_MR + r];
+            for (int c = 0; c < SGEMM_NR; c++)
+                acc[r][c] += x * b[p * SGEMM_NR + c];
+        }
+    }
+}
+
+#if defined(SGEMM_X86)
+#define SGEMM_FMA_ROW(R)                                                       \
+    x = _mm256_broadcast_ss(a + p * SGEMM_MR + R);                             \
+    c##R##0 = _mm256_fmadd_ps(x, b0, c##R##0);                                 \
+    c##R##1 = _mm256_fmadd_ps(x, b1, c##R##1);
+
+__attribute__((target("avx2,fma"))) static void
+kernel_avx2(int k, const float *a, const float *b, float acc[SGEMM_MR][SGEMM_NR]) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+    for (int p = 0; p < k; p++) {
+        __m256 b0 = _mm256_load_ps(b + p * SGEMM_NR);
+        __m256 b1 = _mm256_load_ps(b + p * SGEMM_NR + 8);
+        __m256 x;
+        SGEMM_FMA_ROW(0)
+        SGEMM_FMA_ROW(1)
+        SGEMM_FMA_ROW(2)
+        SGEMM_FMA_ROW(3)
+        SGEMM_FMA_ROW(4)
+        SGEMM_FMA_ROW(5)
+    }
+
+    _mm256_storeu_ps(&acc[0][0], c00), _mm256_storeu_ps(&acc[0][8], c01);
+    _mm256_storeu_ps(&acc[1][0], c10), _mm256_storeu_ps(&acc[1][8], c11);
+    _mm256_storeu_ps(&acc[2][0], c20), _mm256_storeu_ps(&acc[2][8], c21);
+    _mm256_storeu_ps(&acc[3][0], c30), _mm256_storeu_ps(&acc[3][8], c31);
+    _mm256_storeu_ps(&acc[4][0], c40), _mm256_storeu_ps(&acc[4][8], c41);
+    _mm256_storeu_ps(&acc[5][0], c50), _mm256_storeu_ps(&acc[5][8], c51);
+}
+#endif /* SGEMM_X86 */
+
+static sgemm_kernel_fn select_kernel(void) {
+#if defined(SGEMM_X86)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return kernel_avx2;
+#endif
+    return kernel_generic;
+}
+
+static inline float activate(float v, sgemm_activation_t activation) {
+    switch (activation) {
+    case sgemm_relu:
+        return v > 0.0f ? v : 0.0f;
+    case sgemm_square_plus: {
+        float rounded = roundf(v * 100) / 100;
+        return roundf((rounded * rounded + rounded) * 100) / 100;
+    }
+    default:
+        return v;
+    }
+}
+
+struct sgemm_batch_struct {
+    const struct smatrix_struct *w;
+    sgemm_activation_t activation;
+    const float *x;
+    size_t x_stride;
+    float *y;
+    size_t y_stride;
+    size_t n;
+    int panel_tile; /* weight panels per task */
+    float *scratch; /* per worker: SGEMM_MC packed images */
+    size_t scratch_floats;
+};
+
+static void sgemm_task(void *arg, size_t task, int worker) {
+    struct sgemm_batch_struct *batch = arg;
+    const struct smatrix_struct *w = batch->w;
+    int tiles = (w->panels + batch->panel_tile - 1) / batch->panel_tile;
+    int p_begin = (int)(task % tiles) * batch->panel_tile;
+    int p_end = p_begin + batch->panel_tile < w->panels ? p_begin + batch->panel_tile : w->panels;
+    size_t n0 = (task / tiles) * SGEMM_MC;
+    size_t block = batch->n - n0 < SGEMM_MC ? batch->n - n0 : SGEMM_MC;
+    int slices = (int)((block + SGEMM_MR - 1) / SGEMM_MR);
+
+    sgemm_kernel_fn kernel = select_kernel();
+    size_t slice_floats = (size_t)w->cols * SGEMM_MR;
+    float *a = batch->scratch + (size_t)worker * batch->scratch_floats;
+    float acc[SGEMM_MR][SGEMM_NR];
+
+    for (int s = 0; s < slices; s++) {
+        size_t valid = block - s * SGEMM_MR < SGEMM_MR ? block - s * SGEMM_MR : SGEMM_MR;
+        pack_images(a + s * slice_floats, batch->x + (n0 + s * SGEMM_MR) * batch->x_stride,
+                    batch->x_stride, valid, w->cols);
+    }
+
+    for (int p = p_begin; p < p_end; p++) {
+        const float *b = w->data + (size_t)p * w->cols * SGEMM_NR;
+        const float *bias = w->bias + p * SGEMM_NR;
+        int features = w->rows - p * SGEMM_NR < SGEMM_NR ? w->rows - p * SGEMM_NR : SGEMM_NR;
+        for (int s = 0; s < slices; s++) {
+            size_t valid = block - s * SGEMM_MR < SGEMM_MR ? block - s * SGEMM_MR : SGEMM_MR;
+            kernel(w->cols, a + s * slice_floats, b, acc);
+            for (size_t r = 0; r < valid; r++) {
+                float *out = batch->y + (n0 + s * SGEMM_MR + r) * batch->y_stride + p * SGEMM_NR;
+                for (int c = 0; c < features; c++)
+                    out[c] = activate(acc[r][c] + bias[c], batch->activation);
+            }
+        }
+    }
+}
+
+/* y[j][i] = act(bias[i] + sum_k w[i][k] * x[j][k]) for the n images of x;
+ * image j starts at x + j * x_stride and its outputs at y + j * y_stride.
+ * The images are cut into blocks of SGEMM_MC; the output features are also
+ * split into tiles when there are too few blocks to keep every thread busy */
+void sgemm_layer(thpool_t pool, const smatrix_t w, sgemm_activation_t activation, const float *x,
+                 size_t x_stride, float *y, size_t y_stride, size_t n) {
+    struct sgemm_batch_struct batch;
+    int threads = thpool_size(pool);
+    size_t blocks = (n + SGEMM_MC - 1) / SGEMM_MC;
+
+    assert(w && w->data && x && y);
+    batch.w = w;
+    batch.activation = activation;
+    batch.x = x;
+    batch.x_stride = x_stride;
+    batch.y = y;
+    batch.y_stride = y_stride;
+    batch.n = n;
+    batch.panel_tile = w->panels;
+    if (blocks < 4 * (size_t)threads && w->panels > SGEMM_PANELS_PER_TILE)
+        batch.panel_tile = SGEMM_PANELS_PER_TILE;
+    batch.scratch_floats = (size_t)(SGEMM_MC / SGEMM_MR) * w->cols * SGEMM_MR;
+
+    if (posix_memalign((void **)&batch.scratch, 64, threads * batch.scratch_floats * sizeof(float)) != 0)
+        abort();
+
+    size_t tiles = (w->panels + batch.panel_tile - 1) / batch.panel_tile;
+    thpool_run(pool, sgemm_task, &batch, blocks * tiles);
+
+    free(batch.scratch);
+}
@@ -0,0 +1,255 @@
+/*
+ * Double-buffered image stream.
+ *
+ * The loader thread fills buffer 0, 1, 0, ... and blocks while the buffer it
+ * is due to fill is still held by the caller. image_stream_next gives back the
+ * buffer handed out by the previous call, so a batch stays valid until then.
+ */
+
+#include <lib-stream.h>
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_LABELS_LINE 4096
+
+/* $VHSS_BATCH if set to a positive size, 0 otherwise */
+int image_stream_default_batch(void) {
+    const char *env = getenv(IMAGE_STREAM_BATCH_ENV);
+    return env != NULL && atoi(env) > 0 ? atoi(env) : 0;
+}
+
+/* one image per line, lines with fewer values are skipped as in the batch readers */
+static int load_text(image_stream_t stream, float *images, int n) {
+    int count = 0;
+    while (count < n && getline(&stream->line, &stream->line_size, stream->file) >= 0) {
+        if (stream->line[0] == '#')
+            continue;
+        float *image = images + (size_t)count * stream->pixels;
+        char *save;
+        char *token = strtok_r(stream->line, " \n", &save);
+        int pixel = 0;
+        while (token != NULL && pixel < stream->pixels) {
+            image[pixel++] = (float)strtod(token, NULL);
+            token = strtok_r(NULL, " \n", &save);
+        }
+        if (pixel == stream->pixels)
+            count++;
+    }
+    return ferror(stream->file) ? -1 : count;
+}
+
+static int load_batch(image_stream_t stream, float *images) {
+    int n = stream->left < stream->batch ? stream->left : stream->batch;
+    if (n == 0)
+        return 0;
+    if (stream->file == NULL) {
+        idx_to_float(idx_item(stream->idx, stream->loaded), (size_t)n * stream->pixels, IDX_PIXEL_SCALE, images);
+    } else {
+        n = load_text(stream, images, n);
+        if (n < 0)
+            return -1;
+    }
+    stream->left -= n;
+    stream->loaded += n;
+    return n;
+}
+
+static void *load_loop(void *arg) {
+    struct image_stream_struct *stream = arg;
+    for (int b = 0;; b ^= 1) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->full[b] && !stream->stopping)
+            pthread_cond_wait(&stream->emptied, &stream->lock);
+        bool stopping = stream->stopping;
+        pthread_mutex_unlock(&stream->lock);
+        if (stopping)
+            break;
+
+        int count = load_batch(stream, stream->buffer[b]);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->count[b] = count;
+        stream->full[b] = true;
+        pthread_cond_signal(&stream->filled);
+        pthread_mutex_unlock(&stream->lock);
+        if (count <= 0)
+            break;
+    }
+    return NULL;
+}
+
+/* streams at most limit images of the given size, all of them when limit <= 0 */
+int image_stream_open(image_stream_t stream, const char *filename, int pixels, int batch, int limit) {
+    assert(stream && filename && pixels > 0 && batch > 0);
+    memset(stream, 0, sizeof(struct image_stream_struct));
+    stream->pixels = pixels;
+    stream->batch = batch;
+    stream->current = -1;
+    stream->left = limit > 0 ? limit : INT_MAX;
+
+    if (idx_open(stream->idx, filename) == 0) {
+        if (stream->idx->item_size != (size_t)pixels) {
+            idx_close(stream->idx);
+            return -1;
+        }
+        if (stream->idx->count < stream->left)
+            stream->left = stream->idx->count;
+    } else {
+        stream->file = fopen(filename, "r");
+        if (stream->file == NULL)
+            return -1;
+    }
+
+    stream->buffer[0] = malloc((size_t)batch * pixels * sizeof(float));
+    stream->buffer[1] = malloc((size_t)batch * pixels * sizeof(float));
+    if (stream->buffer[0] == NULL || stream->buffer[1] == NULL)
+        goto fail;
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->filled, NULL);
+    pthread_cond_init(&stream->emptied, NULL);
+    if (pthread_create(&stream->thread, NULL, load_loop, stream) != 0) {
+        pthread_cond_destroy(&stream->emptied);
+        pthread_cond_destroy(&stream->filled);
+        pthread_mutex_destroy(&stream->lock);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    free(stream->buffer[0]);
+    free(stream->buffer[1]);
+    if (stream->file != NULL)
+        fclose(stream->file);
+    idx_close(stream->idx);
+    return -1;
+}
+
+/* the images of the next batch; returns their number, 0 at the end and -1 on a read error */
+int image_stream_next(image_stream_t stream, const float **images) {
+    assert(stream && images);
+    pthread_mutex_lock(&stream->lock);
+    int b = 0;
+    if (stream->current >= 0) {
+        int count = stream->count[stream->current];
+        if (count <= 0) {
+            pthread_mutex_unlock(&stream->lock);
+            return count;
+        }
+        stream->full[stream->current] = false;
+        pthread_cond_signal(&stream->emptied);
+        b = stream->current ^ 1;
+    }
+    while (!stream->full[b])
+        pthread_cond_wait(&stream->filled, &stream->lock);
+    stream->current = b;
+    *images = stream->buffer[b];
+    int count = stream->count[b];
+    pthread_mutex_unlock(&stream->lock);
+    return count;
+}
+
+void image_stream_close(image_stream_t stream) {
+    assert(stream);
+    pthread_mutex_lock(&stream->lock);
+    stream->stopping = true;
+    pthread_cond_signal(&stream->emptied);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+
+    pthread_cond_destroy(&stream->emptied);
+    pthread_cond_destroy(&stream->filled);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream->buffer[0]);
+    free(stream->buffer[1]);
+    free(stream->line);
+    if (stream->file != NULL)
+        fclose(stream->file);
+    idx_close(stream->idx);
+    memset(stream, 0, sizeof(struct image_stream_struct));
+}
+
+/* a labels file, past its three header lines; NULL if it cannot be opened */
+FILE *image_labels_open(const char *filename) {
+    assert(filename);
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+        return NULL;
+    char line[IMAGE_LABELS_LINE];
+    for (int i = 0; i < 3 && fgets(line, sizeof(line), file); i++)
+        ;
+    return file;
+}
+
+/* reads up to n more labels, returns how many were read */
+int image_labels_next(FILE *file, int *labels, int n) {
+    assert(file && labels);
+    char line[IMAGE_LABELS_LINE];
+    int count = 0;
+    while (count < n && fgets(line, sizeof(line), file))
+        labels[count++] = atoi(line);
+    return count;
+}
+
+void batch_times_init(batch_times_t times) {
+    assert(times);
+    memset(times, 0, sizeof(struct batch_times_struct));
+}
+
+/* records a batch of count images completed in time seconds, -1 if out of memory */
+int batch_times_add(batch_times_t times, double time, int count) {
+    assert(times && count > 0);
+    if (times->size == times->capacity) {
+        int capacity = times->capacity > 0 ? 2 * times->capacity : 64;
+        struct batch_time_struct *batches = realloc(times->batches, capacity * sizeof(struct batch_time_struct));
+        if (batches == NULL)
+            return -1;
+        times->batches = batches;
+        times->capacity = capacity;
+    }
+    times->batches[times->size].time = time;
+    times->batches[times->size++].count = count;
+    times->images += count;
+    times->total += time;
+    return 0;
+}
+
+static int batch_time_compare(const void *a, const void *b) {
+    double x = ((const struct batch_time_struct *)a)->time, y = ((const struct batch_time_struct *)b)->time;
+    return (x > y) - (x < y);
+}
+
+/* per-image latency at quantile q: the batches are weighted by their images;
+ * sorts the batches */
+double batch_times_percentile(batch_times_t times, double q) {
+    assert(times);
+    qsort(times->batches, times->size, sizeof(struct batch_time_struct), batch_time_compare);
+    long seen = 0;
+    for (int b = 0; b < times->size; b++) {
+        seen += times->batches[b].count;
+        if (seen >= q * times->images)
+            return times->batches[b].time;
+    }
+    return times->size > 0 ? times->batches[times->size - 1].time : 0.0;
+}
+
+/* the lines read back by e2e-bench */
+void batch_times_report(FILE *out, batch_times_t times) {
+    assert(times);
+    if (times->size == 0)
+        return;
+    double p50 = batch_times_percentile(times, 0.50);
+    double p99 = batch_times_percentile(times, 0.99);
+    fprintf(out, "\nTotal time: %.3f ms\n", times->total * 1000);
+    fprintf(out, "Amortized time per image: %.3f ms\n", times->total * 1000 / times->images);
+    fprintf(out, "Batches: %d\n", times->size);
+    fprintf(out, "Latency p50: %.3f ms, p99: %.3f ms\n", p50 * 1000, p99 * 1000);
+}
+
+void batch_times_clear(batch_times_t times) {
+    assert(times);
+    free(times->batches);
+    memset(times, 0, sizeof(struct batch_times_struct));
+}
@@ -0,0 +1,72 @@
+/*
+ * Batch-major activation tensors with cache-line aligned rows.
+ */
+
+#include <lib-tensor.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t tensor_stride(int cols) {
+    size_t per_line = TENSOR_ALIGN / sizeof(float);
+    return ((size_t)cols + per_line - 1) / per_line * per_line;
+}
+
+static void *tensor_alloc(int rows, size_t stride) {
+    void *data;
+    size_t bytes = (size_t)rows * stride * sizeof(float);
+
+    if (bytes == 0)
+        return NULL;
+    if (posix_memalign(&data, TENSOR_ALIGN, bytes) != 0)
+        return NULL;
+    memset(data, 0, bytes);
+    return data;
+}
+
+/* allocates a zeroed tensor of rows images of cols features; rows may be 0 */
+int tensor_init(tensor_t t, int rows, int cols) {
+    assert(t);
+    assert(rows >= 0 && cols >= 0);
+    t->rows = rows;
+    t->cols = cols;
+    t->stride = tensor_stride(cols);
+    t->data = tensor_alloc(rows, t->stride);
+    if (t->data == NULL && rows > 0 && cols > 0)
+        return -1;
+    return 0;
+}
+
+void tensor_clear(tensor_t t) {
+    assert(t);
+    free(t->data);
+    t->data = NULL;
+    t->rows = 0;
+}
+
+/* changes the number of images, keeping the leading ones */
+int tensor_resize(tensor_t t, int rows) {
+    assert(t);
+    assert(rows >= 0);
+    if (rows == t->rows)
+        return 0;
+
+    void *data = tensor_alloc(rows, t->stride);
+    if (data == NULL && rows > 0 && t->cols > 0)
+        return -1;
+    if (data != NULL && t->data != NULL) {
+        int kept = rows < t->rows ? rows : t->rows;
+        memcpy(data, t->data, (size_t)kept * t->stride * sizeof(float));
+    }
+    free(t->data);
+    t->data = data;
+    t->rows = rows;
+    return 0;
+}
+
+/* exchanges the buffers of two tensors, used to ping-pong between layers */
+void tensor_swap(tensor_t a, tensor_t b) {
+    struct tensor_struct tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
@@ -0,0 +1,142 @@
+/*
+ * Fork-join thread pool for the data-parallel kernels.
+ */
+
+#include <lib-thpool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void thpool_work(struct thpool_struct *pool, thpool_task_fn fn, void *arg, size_t count,
+                        int worker) {
+    for (;;) {
+        size_t index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= count)
+            break;
+        fn(arg, index, worker);
+    }
+}
+
+struct thpool_worker_struct {
+    struct thpool_struct *pool;
+    int worker;
+};
+
+static void *thpool_worker(void *data) {
+    struct thpool_worker_struct *self = data;
+    struct thpool_struct *pool = self->pool;
+    int worker = self->worker;
+    unsigned long seen = 0;
+    free(self);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->stopping)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping)
+            break;
+        seen = pool->generation;
+        thpool_task_fn fn = pool->fn;
+        void *arg = pool->arg;
+        size_t count = pool->count;
+        pthread_mutex_unlock(&pool->lock);
+
+        thpool_work(pool, fn, arg, count, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->finish);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* number of threads to use: $VHSS_THREADS if set, the online cores otherwise */
+int thpool_default_threads(void) {
+    const char *env = getenv(THPOOL_THREADS_ENV);
+    if (env != NULL && atoi(env) > 0)
+        return atoi(env);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+/* starts a pool of num_threads threads in total, the caller included */
+int thpool_init(thpool_t pool, int num_threads) {
+    assert(pool);
+    assert(num_threads > 0);
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finish, NULL);
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->stopping = false;
+    pool->fn = NULL;
+    pool->arg = NULL;
+    pool->count = pool->next = 0;
+    pool->num_threads = 0;
+    pool->threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    if (!pool->threads)
+        return -1;
+
+    for (int i = 1; i < num_threads; i++) {
+        struct thpool_worker_struct *self = malloc(sizeof(struct thpool_worker_struct));
+        if (!self)
+            break;
+        self->pool = pool;
+        self->worker = i;
+        if (pthread_create(&pool->threads[pool->num_threads], NULL, thpool_worker, self) != 0) {
+            free(self);
+            break;
+        }
+        pool->num_threads++;
+    }
+    return 0;
+}
+
+void thpool_clear(thpool_t pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->num_threads = 0;
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finish);
+}
+
+/* runs fn(arg, i, worker) for every i in [0, count) and waits for all of them */
+void thpool_run(thpool_t pool, thpool_task_fn fn, void *arg, size_t count) {
+    assert(fn);
+    if (count == 0)
+        return;
+    if (pool == NULL || pool->num_threads == 0 || count == 1) {
+        for (size_t i = 0; i < count; i++)
+            fn(arg, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->pending = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    thpool_work(pool, fn, arg, count, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->finish, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -21,6 +21,7 @@
  */
 
 #include <lib-timing.h>
+#include <pthread.h>
 
 float stats_kernel_lower_cut = 0.005, stats_kernel_upper_cut = 0.05;
 double clock_cycles_per_ns = 1.0;
@@ -29,14 +30,27 @@ elapsed_time_t timestamp_timing_overhead = 0.0;
 const char *time_unit_str[] = {"ns", "μs", "ms", "s"};
 #define calibration_loop 1000000
 
+/* le calibrazioni scrivono le variabili globali qui sopra: vanno eseguite una
+ * alla volta e prima che altri thread inizino a campionare, che da lì in poi
+ * le leggono soltanto */
+static pthread_mutex_t calibration_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* i contatori delle macro di campionamento, per thread */
+static __thread struct perf_group_struct *sampling_perf_group = NULL;
+static __thread struct perf_values_struct *sampling_perf_values = NULL;
+
 /* cerca di rilevare i metodi di timestamp disponibili sul sistema;
  * in tale scelta si prediligono i metodi che misurano il tempo di CPU
- * eventualmente a discapito della precisione
+ * eventualmente a discapito della precisione; su Linux si usa quello del solo
+ * thread chiamante, perché il tempo di CPU del processo somma anche il lavoro
+ * degli altri thread che girano in parallelo al campionamento
  */
 #if defined(__MACH__)
 clockid_t clock_to_use = CLOCK_GETRUSAGE_ID;
 #elif defined(__linux__)
-#if defined(_POSIX_CPUTIME)
+#if defined(_POSIX_THREAD_CPUTIME)
+clockid_t clock_to_use = CLOCK_THREAD_CPUTIME_ID;
+#elif defined(_POSIX_CPUTIME)
 clockid_t clock_to_use = CLOCK_PROCESS_CPUTIME_ID;
 #else
 clockid_t clock_to_use = CLOCK_MONOTONIC;
@@ -153,27 +167,34 @@ inline clock_cycles_t rdtscp_cpuid() {
 }
 #endif /* __x86_64__ */
 
+#if defined(__MACH__)
+static pthread_once_t mac_services_once = PTHREAD_ONCE_INIT;
+static clock_serv_t cclock;
+static mach_timebase_info_data_t timebase_info;
+
+static void init_mac_services() {
+    host_get_clock_service(mach_host_self(), MAC_CLOCK_SERVICE_TO_USE, &cclock);
+    // mach_port_deallocate(mach_task_self(), cclock); // mai disallocato
+    mach_timebase_info(&timebase_info);
+}
+#endif /* defined(__MACH__) */
+
 /* ottiene il timestamp attuale con il metodo preconfigurato */
-inline void get_timestamp(timestamp_t ts) {
+inline void get_timestamp(timestamp_t ts) { get_timestamp_from(clock_to_use, ts); }
+
+/* ottiene il timestamp attuale con un metodo specifico, senza toccare quello
+ * preconfigurato che altri thread potrebbero usare nello stesso momento */
+void get_timestamp_from(clockid_t clock, timestamp_t ts) {
 #if defined(__MACH__)
-    static bool mac_services_initialized = false;
-    static clock_serv_t cclock;
-    static mach_timebase_info_data_t timebase_info;
-    if (!mac_services_initialized) {
-        host_get_clock_service(mach_host_self(), MAC_CLOCK_SERVICE_TO_USE,
-                               &cclock);
-        // mach_port_deallocate(mach_task_self(), cclock); // mai disallocato
-        mach_timebase_info(&timebase_info);
-        mac_services_initialized = true;
-    }
-    if (clock_to_use == (clockid_t)CLOCK_ABSTIME_MAC_ID) {
+    pthread_once(&mac_services_once, init_mac_services);
+    if (clock == (clockid_t)CLOCK_ABSTIME_MAC_ID) {
         assert(timebase_info.denom);
         double mts = (mach_absolute_time() * timebase_info.numer) /
                      (double)timebase_info.denom;
         ts->tv_sec = mts * 1e-9;
         ts->tv_nsec = mts - (ts->tv_sec * 1e+9);
         return;
-    } else if (clock_to_use == (clockid_t)CLOCK_SERVICE_MAC_ID) {
+    } else if (clock == (clockid_t)CLOCK_SERVICE_MAC_ID) {
         mach_timespec_t mts;
         clock_get_time(cclock, &mts);
         ts->tv_sec = mts.tv_sec;
@@ -191,7 +212,7 @@ inline void get_timestamp(timestamp_t ts) {
         handle = GetCurrentProcess();
         win_clock_initialized = true;
     }
-    if (clock_to_use == (clockid_t)CLOCK_QPC_WIN_ID) {
+    if (clock == (clockid_t)CLOCK_QPC_WIN_ID) {
         assert(counter_frequency.QuadPart > 0);
         LARGE_INTEGER pc;
         QueryPerformanceCounter(&pc);
@@ -199,7 +220,7 @@ inline void get_timestamp(timestamp_t ts) {
         ts->tv_sec = wts * 1e-9;
         ts->tv_nsec = wts - (ts->tv_sec * 1e+9);
         return;
-    } else if (clock_to_use == (clockid_t)CLOCK_PROCESS_TIME_WIN_ID) {
+    } else if (clock == (clockid_t)CLOCK_PROCESS_TIME_WIN_ID) {
         LARGE_INTEGER dummy_time, user_time;
         GetProcessTimes(handle, (FILETIME *)&dummy_time,
                         (FILETIME *)&dummy_time, (FILETIME *)&dummy_time,
@@ -207,19 +228,27 @@ inline void get_timestamp(timestamp_t ts) {
         ts->tv_sec = user_time.QuadPart * 1e+2 * 1e-9;
         ts->tv_nsec = user_time.QuadPart * 1e+2 - (ts->tv_sec * 1e+9);
         return;
+    } else if (clock == (clockid_t)CLOCK_THREAD_TIME_WIN_ID) {
+        LARGE_INTEGER dummy_time, user_time;
+        GetThreadTimes(GetCurrentThread(), (FILETIME *)&dummy_time,
+                       (FILETIME *)&dummy_time, (FILETIME *)&dummy_time,
+                       (FILETIME *)&user_time);
+        ts->tv_sec = user_time.QuadPart * 1e+2 * 1e-9;
+        ts->tv_nsec = user_time.QuadPart * 1e+2 - (ts->tv_sec * 1e+9);
+        return;
     }
 #endif /* defined(_WIN32) || defined(__CYGWIN__) */
 
     /* metodi POSIX */
-    if (clock_to_use == (clockid_t)CLOCK_GETRUSAGE_ID) {
+    if (clock == (clockid_t)CLOCK_GETRUSAGE_ID) {
         struct rusage res;
         getrusage(RUSAGE_SELF, &res);
         ts->tv_sec = res.ru_utime.tv_sec;
         ts->tv_nsec = res.ru_utime.tv_usec * 1e+3;
         return;
     }
-    if (clock_to_use != (clockid_t)CLOCK_NONE)
-        clock_gettime(clock_to_use, ts);
+    if (clock != (clockid_t)CLOCK_NONE)
+        clock_gettime(clock, ts);
     else {
         ts->tv_sec = 0;
         ts->tv_nsec = 0;
@@ -282,12 +311,63 @@ elapsed_time_t get_elapsed_time_from_timestamp(timestamp_t before,
     return deltat_s * 1e+9 + deltat_ns - timestamp_timing_overhead;
 }
 
+/* associa alle macro di campionamento del thread chiamante un gruppo di
+ * contatori e i valori cui sommarne gli eventi; NULL per smettere di contare */
+void set_sampling_counters(perf_group_t group, perf_values_t values) {
+    assert((group == NULL) == (values == NULL));
+    sampling_perf_group = group != NULL && group->leader >= 0 ? group : NULL;
+    sampling_perf_values = values;
+}
+
+/* lettura dei contatori prima di un campione, se impostati */
+void sampling_counters_before(perf_values_t before) {
+    if (sampling_perf_group != NULL)
+        perf_group_read(sampling_perf_group, before);
+}
+
+/* somma gli eventi del campione iniziato con sampling_counters_before */
+void sampling_counters_after(const perf_values_t before) {
+    if (sampling_perf_group != NULL) {
+        perf_values_t after;
+        perf_group_read(sampling_perf_group, after);
+        perf_values_add_delta(sampling_perf_values, before, after);
+    }
+}
+
 /* imposta i tagli statistici (basso e alto) all'insieme dei sample rilevati */
 void set_stats_kernel_cuts(float lower, float upper) {
     stats_kernel_lower_cut = lower;
     stats_kernel_upper_cut = upper;
 }
 
+/* rileva insieme tempo reale, tempo di CPU del processo e del thread
+ * chiamante */
+void get_thread_times(thread_times_t times) {
+    get_timestamp_from(CLOCK_WALL_ID, &times->wall);
+    get_timestamp_from(CLOCK_PROCESS_ID, &times->process);
+    get_timestamp_from(CLOCK_THREAD_ID, &times->thread);
+}
+
+/* calcola i tempi trascorsi (ns) tra due rilevamenti di get_thread_times; qui
+ * non si sottrae alcun overhead, trattandosi di tre clock diversi */
+void get_elapsed_times(elapsed_times_t elapsed, thread_times_t before,
+                       thread_times_t after) {
+    elapsed->wall = (after->wall.tv_sec - before->wall.tv_sec) * 1e+9 +
+                    (after->wall.tv_nsec - before->wall.tv_nsec);
+    elapsed->process = (after->process.tv_sec - before->process.tv_sec) * 1e+9 +
+                       (after->process.tv_nsec - before->process.tv_nsec);
+    elapsed->thread = (after->thread.tv_sec - before->thread.tv_sec) * 1e+9 +
+                      (after->thread.tv_nsec - before->thread.tv_nsec);
+}
+
+/* efficienza parallela CPU/reale/thread: 1 quando tutti i thread hanno
+ * lavorato per tutto il tempo reale */
+double get_parallel_efficiency(const elapsed_times_t elapsed, int threads) {
+    if (elapsed->wall <= 0.0 || threads <= 0)
+        return 0.0;
+    return elapsed->process / elapsed->wall / threads;
+}
+
 /* scrive direttamente e legge il rapporto cicli/ns preconfigurato */
 void set_clock_cycles_per_ns(double ratio) { clock_cycles_per_ns = ratio; }
 elapsed_time_t get_clock_cycles_per_ns() { return clock_cycles_per_ns; }
@@ -296,28 +376,19 @@ elapsed_time_t get_clock_cycles_per_ns() { return clock_cycles_per_ns; }
 void calibrate_clock_cycles_ratio() {
     timestamp_t before_ts, after_ts;
     clock_cycles_t before = 0, after = 0;
-    clockid_t old_clock_to_use = clock_to_use;
 
-/* seleziona un metodo non basato sul tempo di CPU */
-#if defined(__linux__)
-    clock_to_use = CLOCK_MONOTONIC;
-#elif defined(__MACH__)
-    clock_to_use = CLOCK_ABSTIME_MAC_ID;
-#else
-    clock_to_use = CLOCK_QPC_WIN_ID;
-#endif /* defined(__MACH__) ; defined(__linux__) */
-
-    get_timestamp(before_ts);
+    pthread_mutex_lock(&calibration_lock);
+    /* usa un metodo non basato sul tempo di CPU */
+    get_timestamp_from(CLOCK_WALL_ID, before_ts);
     before = get_clock_cycles_before();
     for (volatile unsigned long long i = 0; i < calibration_loop; i++)
         ;
     after = get_clock_cycles_after();
-    get_timestamp(after_ts);
+    get_timestamp_from(CLOCK_WALL_ID, after_ts);
     clock_cycles_per_ns =
             (double)(after - before) /
             (double)get_elapsed_time_from_timestamp(before_ts, after_ts);
-
-    clock_to_use = old_clock_to_use;
+    pthread_mutex_unlock(&calibration_lock);
 }
 
 /* legge il valore di overhead attualmente configurato per il metodo basato su
@@ -330,9 +401,11 @@ elapsed_time_t get_clock_cycles_overhead() {
  * cycles */
 void detect_clock_cycles_overhead() {
     stats_t stats;
+    pthread_mutex_lock(&calibration_lock);
     perform_clock_cycles_sampling(stats, NULL, calibration_loop, tu_nanos, {},
                                   {});
     clock_cycles_timing_overhead = stats->median;
+    pthread_mutex_unlock(&calibration_lock);
 }
 
 /* legge il valore di overhead attualmente configurato per il metodo timestamp
@@ -343,8 +416,10 @@ elapsed_time_t get_timestamp_overhead() { return timestamp_timing_overhead; }
  * preconfigurato */
 void detect_timestamp_overhead() {
     stats_t stats;
+    pthread_mutex_lock(&calibration_lock);
     perform_timestamp_sampling(stats, NULL, calibration_loop, tu_nanos, {}, {});
     timestamp_timing_overhead = stats->median;
+    pthread_mutex_unlock(&calibration_lock);
 }
 
 /* calcola il tempo trascorso (ns) tra due campionamenti tramite il metodo
@@ -396,8 +471,12 @@ void extract_stats(stats_t stats, elapsed_time_t vector[], size_t size,
     qsort(vector, size, sizeof(elapsed_time_t), __et_compare);
 
     first = (size_t)ceilf(size * stats_kernel_lower_cut);
+    /* con pochi campioni il kernel non deve superare quelli rimasti dopo il
+     * taglio basso */
+    if (stats->ksize > size - first)
+        stats->ksize = size - first;
 
-    stats->max = vector[stats->ksize - 1];
+    stats->max = vector[first + stats->ksize - 1];
     stats->min = vector[first];
 
     if (stats->ksize % 2)
@@ -0,0 +1,141 @@
+/*
+ * Worker pool behind the asynchronous verification pipeline.
+ */
+
+#include <lib-veri-pipeline.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void *veri_worker(void *arg) {
+    struct veri_pipeline_struct *pipeline = arg;
+
+    pthread_mutex_lock(&pipeline->lock);
+    for (;;) {
+        while (pipeline->head == NULL && !pipeline->stopping)
+            pthread_cond_wait(&pipeline->not_empty, &pipeline->lock);
+        if (pipeline->head == NULL)
+            break; /* stopping and nothing left to do */
+
+        struct veri_record_struct *record = pipeline->head;
+        pipeline->head = record->next;
+        if (pipeline->head == NULL)
+            pipeline->tail = NULL;
+        pipeline->queued--;
+        pipeline->running++;
+        pthread_cond_signal(&pipeline->not_full);
+        pthread_mutex_unlock(&pipeline->lock);
+
+        /* once a check failed the run is flagged: skip the remaining ones */
+        bool passed = veri_pipeline_failed(pipeline) || record->check(record->data);
+        if (record->release)
+            record->release(record->data);
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (!passed && !pipeline->failed) {
+            pipeline->failed_layer = record->layer;
+            __atomic_store_n(&pipeline->failed, true, __ATOMIC_RELEASE);
+        }
+        pipeline->checked++;
+        pipeline->running--;
+        if (pipeline->queued == 0 && pipeline->running == 0)
+            pthread_cond_broadcast(&pipeline->idle);
+        record->next = pipeline->spare;
+        pipeline->spare = record;
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+/* starts num_workers threads; at most capacity records are queued before
+ * veri_pipeline_submit blocks the producer */
+int veri_pipeline_init(veri_pipeline_t pipeline, int num_workers, size_t capacity) {
+    assert(pipeline);
+    assert(num_workers > 0 && capacity > 0);
+
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->not_empty, NULL);
+    pthread_cond_init(&pipeline->not_full, NULL);
+    pthread_cond_init(&pipeline->idle, NULL);
+    pipeline->capacity = capacity;
+    pipeline->queued = pipeline->running = pipeline->checked = 0;
+    pipeline->head = pipeline->tail = pipeline->spare = NULL;
+    pipeline->stopping = false;
+    pipeline->failed = false;
+    pipeline->failed_layer = 0;
+    pipeline->num_workers = 0;
+    pipeline->workers = (pthread_t *)malloc(num_workers * sizeof(pthread_t));
+    if (!pipeline->workers)
+        return -1;
+
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&pipeline->workers[i], NULL, veri_worker, pipeline) != 0)
+            break;
+        pipeline->num_workers++;
+    }
+    return pipeline->num_workers > 0 ? 0 : -1;
+}
+
+/* stops the workers after the queued records have been consumed */
+void veri_pipeline_clear(veri_pipeline_t pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stopping = true;
+    pthread_cond_broadcast(&pipeline->not_empty);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    for (int i = 0; i < pipeline->num_workers; i++)
+        pthread_join(pipeline->workers[i], NULL);
+    free(pipeline->workers);
+    pipeline->workers = NULL;
+    while (pipeline->spare != NULL) {
+        struct veri_record_struct *next = pipeline->spare->next;
+        free(pipeline->spare);
+        pipeline->spare = next;
+    }
+
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->not_empty);
+    pthread_cond_destroy(&pipeline->not_full);
+    pthread_cond_destroy(&pipeline->idle);
+}
+
+/* queues a check; ownership of data passes to the pipeline, which calls
+ * release once the record has been processed (or dropped). Records are
+ * recycled, so once the queue reached its usual depth submitting no longer
+ * allocates */
+void veri_pipeline_submit(veri_pipeline_t pipeline, int layer, veri_check_fn check,
+                          veri_release_fn release, void *data) {
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->queued >= pipeline->capacity)
+        pthread_cond_wait(&pipeline->not_full, &pipeline->lock);
+    struct veri_record_struct *record = pipeline->spare;
+    if (record != NULL)
+        pipeline->spare = record->next;
+    else
+        record = malloc(sizeof(struct veri_record_struct));
+    assert(record);
+    record->layer = layer;
+    record->check = check;
+    record->release = release;
+    record->data = data;
+    record->next = NULL;
+
+    if (pipeline->tail)
+        pipeline->tail->next = record;
+    else
+        pipeline->head = record;
+    pipeline->tail = record;
+    pipeline->queued++;
+    pthread_cond_signal(&pipeline->not_empty);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/* waits for every queued check, returns true if all of them passed */
+bool veri_pipeline_drain(veri_pipeline_t pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->queued > 0 || pipeline->running > 0)
+        pthread_cond_wait(&pipeline->idle, &pipeline->lock);
+    bool passed = !pipeline->failed;
+    pthread_mutex_unlock(&pipeline->lock);
+    return passed;
+}